@@ -0,0 +1,240 @@
+#include "rh_blob.h"
+
+namespace rh {
+
+static const uint64_t blob_prime1 = UINT64_C(0x9e3779b185ebca87);
+static const uint64_t blob_prime2 = UINT64_C(0xc2b2ae3d27d4eb4f);
+static const uint64_t blob_prime3 = UINT64_C(0x165667b19e3779f9);
+static const uint64_t blob_prime4 = UINT64_C(0x85ebca77c2b2ae63);
+static const uint64_t blob_prime5 = UINT64_C(0x27d4eb2f165667c5);
+
+static RHMAP_FORCEINLINE uint64_t blob_rotl(uint64_t v, uint32_t r) { return v << r | v >> (64u - r); }
+
+static RHMAP_FORCEINLINE uint64_t blob_read64(const unsigned char *p) { uint64_t v; memcpy(&v, p, sizeof(v)); return v; }
+static RHMAP_FORCEINLINE uint32_t blob_read32(const unsigned char *p) { uint32_t v; memcpy(&v, p, sizeof(v)); return v; }
+
+static RHMAP_FORCEINLINE uint64_t blob_round(uint64_t acc, uint64_t input)
+{
+	return blob_rotl(acc + input * blob_prime2, 31u) * blob_prime1;
+}
+
+static RHMAP_FORCEINLINE uint64_t blob_merge(uint64_t acc, uint64_t lane)
+{
+	return (acc ^ blob_round(0, lane)) * blob_prime1 + blob_prime4;
+}
+
+// Four independent lanes over 32-byte stripes and a full avalanche at the end,
+// the same structure as XXH64.
+uint64_t blob_cache::hash_buffer(const void *data, size_t size)
+{
+	const unsigned char *p = (const unsigned char*)data, *end = p + size;
+	uint64_t h;
+	if (size >= 32) {
+		uint64_t v0 = blob_prime1 + blob_prime2, v1 = blob_prime2, v2 = 0, v3 = (uint64_t)0 - blob_prime1;
+		do {
+			v0 = blob_round(v0, blob_read64(p));
+			v1 = blob_round(v1, blob_read64(p + 8));
+			v2 = blob_round(v2, blob_read64(p + 16));
+			v3 = blob_round(v3, blob_read64(p + 24));
+			p += 32;
+		} while (end - p >= 32);
+		h = blob_rotl(v0, 1u) + blob_rotl(v1, 7u) + blob_rotl(v2, 12u) + blob_rotl(v3, 18u);
+		h = blob_merge(h, v0);
+		h = blob_merge(h, v1);
+		h = blob_merge(h, v2);
+		h = blob_merge(h, v3);
+	} else {
+		h = blob_prime5;
+	}
+
+	h += (uint64_t)size;
+	for (; end - p >= 8; p += 8) {
+		h ^= blob_round(0, blob_read64(p));
+		h = blob_rotl(h, 27u) * blob_prime1 + blob_prime4;
+	}
+	if (end - p >= 4) {
+		h ^= (uint64_t)blob_read32(p) * blob_prime1;
+		h = blob_rotl(h, 23u) * blob_prime2 + blob_prime3;
+		p += 4;
+	}
+	for (; p != end; p++) {
+		h ^= (uint64_t)*p * blob_prime5;
+		h = blob_rotl(h, 11u) * blob_prime1;
+	}
+
+	h ^= h >> 33u;
+	h *= blob_prime2;
+	h ^= h >> 29u;
+	h *= blob_prime3;
+	h ^= h >> 32u;
+	return h;
+}
+
+const blob *blob_cache::insert_hashed(const void *data, size_t size, uint64_t hash)
+{
+	uint32_t scan;
+	if (blob *b = imp_find(data, size, hash, &scan)) {
+		imp_ref(b);
+		hit_count++;
+		return b;
+	}
+
+	if (map.size == map.capacity) {
+		imp_grow(0);
+		imp_find(data, size, hash, &scan);
+	}
+
+	blob *b = (blob*)ator->allocate(ator->user, sizeof(blob) + size);
+	b->hash = hash;
+	b->size = size;
+	b->refs = 1;
+	b->index = map.size;
+	b->lru_prev = b->lru_next = nullptr;
+	memcpy(b + 1, data, size);
+	blobs.push_back(b);
+	rhmap_insert_inline(&map, (uint32_t)hash, scan, b->index);
+	cached_bytes += size;
+	miss_count++;
+
+	imp_evict(max_bytes);
+	return b;
+}
+
+void blob_cache::insert_batch(const void *const *data, const size_t *sizes, size_t count, const blob **result)
+{
+	uint64_t hashes[batch_size];
+	for (size_t base = 0; base < count; base += batch_size) {
+		size_t num = count - base < batch_size ? count - base : batch_size;
+		for (size_t i = 0; i < num; i++) hashes[i] = hash_buffer(data[base + i], sizes[base + i]);
+		if (map.capacity - map.size < num) imp_grow(map.size + num);
+		for (size_t i = 0; i < num; i++) rhmap_prefetch_inline(&map, (uint32_t)hashes[i]);
+		for (size_t i = 0; i < num; i++) {
+			result[base + i] = insert_hashed(data[base + i], sizes[base + i], hashes[i]);
+		}
+	}
+}
+
+const blob *blob_cache::acquire(const void *data, size_t size)
+{
+	uint32_t scan;
+	blob *b = imp_find(data, size, hash_buffer(data, size), &scan);
+	if (b) {
+		imp_ref(b);
+		hit_count++;
+	}
+	return b;
+}
+
+const blob *blob_cache::find_hashed(const void *data, size_t size, uint64_t hash) const
+{
+	uint32_t scan;
+	return imp_find(data, size, hash, &scan);
+}
+
+void blob_cache::retain(const blob *b)
+{
+	imp_ref((blob*)b);
+}
+
+void blob_cache::release(const blob *b)
+{
+	blob *mb = (blob*)b;
+	RHMAP_ASSERT(mb->refs > 0);
+	if (--mb->refs > 0) return;
+
+	mb->lru_prev = lru_tail;
+	mb->lru_next = nullptr;
+	if (lru_tail) lru_tail->lru_next = mb;
+	else lru_head = mb;
+	lru_tail = mb;
+	imp_evict(max_bytes);
+}
+
+void blob_cache::set_max_bytes(size_t bytes)
+{
+	max_bytes = bytes;
+	imp_evict(max_bytes);
+}
+
+void blob_cache::trim()
+{
+	imp_evict(0);
+}
+
+void blob_cache::reset()
+{
+	for (blob *b : blobs) ator->free(ator->user, b, sizeof(blob) + b->size);
+	blobs.reset();
+	void *data = rhmap_reset_inline(&map);
+	if (data) ator->free(ator->user, data, map_alloc_size);
+	map_alloc_size = 0;
+	lru_head = lru_tail = nullptr;
+	cached_bytes = 0;
+}
+
+blob *blob_cache::imp_find(const void *data, size_t size, uint64_t hash, uint32_t *p_scan) const
+{
+	uint32_t scan = 0, index;
+	blob *const *bs = blobs.data();
+	while (rhmap_find_inline(&map, (uint32_t)hash, &scan, &index)) {
+		if (imp_match(bs[index], data, size, hash)) return bs[index];
+	}
+	*p_scan = scan;
+	return nullptr;
+}
+
+void blob_cache::imp_ref(blob *b)
+{
+	if (b->refs++ == 0) imp_lru_unlink(b);
+}
+
+void blob_cache::imp_lru_unlink(blob *b)
+{
+	if (b->lru_prev) b->lru_prev->lru_next = b->lru_next;
+	else lru_head = b->lru_next;
+	if (b->lru_next) b->lru_next->lru_prev = b->lru_prev;
+	else lru_tail = b->lru_prev;
+	b->lru_prev = b->lru_next = nullptr;
+}
+
+void blob_cache::imp_evict(size_t limit)
+{
+	while (cached_bytes > limit && lru_head) {
+		blob *b = lru_head;
+		imp_lru_unlink(b);
+		imp_remove(b);
+	}
+}
+
+void blob_cache::imp_remove(blob *b)
+{
+	uint32_t index = b->index, scan = 0;
+	rhmap_find_value_inline(&map, (uint32_t)b->hash, &scan, index);
+	rhmap_remove_inline(&map, (uint32_t)b->hash, scan);
+
+	// Keep the blob pointers dense by moving the last one into the hole
+	uint32_t last = (uint32_t)blobs.size() - 1;
+	if (index != last) {
+		blob *moved = blobs[last];
+		rhmap_update_value_inline(&map, (uint32_t)moved->hash, last, index);
+		moved->index = index;
+		blobs[index] = moved;
+	}
+	blobs.pop_back();
+
+	cached_bytes -= b->size;
+	ator->free(ator->user, b, sizeof(blob) + b->size);
+}
+
+void blob_cache::imp_grow(size_t min_size)
+{
+	size_t count, alloc_size;
+	rhmap_grow_inline(&map, &count, &alloc_size, min_size, 0.0);
+	void *data = ator->allocate(ator->user, alloc_size);
+	void *old_data = rhmap_rehash_inline(&map, count, alloc_size, data);
+	if (old_data) ator->free(ator->user, old_data, map_alloc_size);
+	map_alloc_size = alloc_size;
+	blobs.reserve(count);
+}
+
+}
@@ -0,0 +1,101 @@
+#ifndef RH_BLOB_H_INCLUDED
+#define RH_BLOB_H_INCLUDED
+
+#include "rh_hash.h"
+
+namespace rh {
+
+// Cached copy of a buffer, the bytes follow the header aligned to 8 bytes.
+struct blob {
+	uint64_t hash; // Content fingerprint, see `blob_cache::hash_buffer()`
+	size_t size;
+	uint32_t refs;
+
+	// Internal bookkeeping of `blob_cache`
+	uint32_t index;
+	blob *lru_prev, *lru_next;
+
+	RHMAP_FORCEINLINE const void *data() const noexcept { return this + 1; }
+};
+
+// Content-addressed cache of byte buffers: identical buffers share a single
+// refcounted copy. Buffers are located by a 64-bit fingerprint whose low bits
+// drive the rhmap index, the full fingerprint and size are compared before
+// falling back to a `memcmp()` so mismatching buffers are almost never read.
+// Each copy lives in one allocation together with its header so `blob`
+// pointers stay valid while referenced. Buffers whose refcount drops to zero
+// stay cached in LRU order and are evicted once the total size of all cached
+// bytes exceeds `max_bytes`, referenced buffers are never evicted.
+struct blob_cache
+{
+	static const size_t batch_size = 64;
+
+	explicit blob_cache(size_t max_bytes=SIZE_MAX, const allocator *ator=&stdlib_allocator)
+		: ator(ator), max_bytes(max_bytes), blobs(ator) { }
+	~blob_cache() { reset(); }
+
+	blob_cache(const blob_cache &) = delete;
+	blob_cache &operator=(const blob_cache &) = delete;
+
+	// 64-bit fingerprint of the buffer contents.
+	static uint64_t hash_buffer(const void *data, size_t size);
+
+	// Return a reference to the cached copy of the buffer, copying it on a miss.
+	const blob *insert(const void *data, size_t size) { return insert_hashed(data, size, hash_buffer(data, size)); }
+	const blob *insert_hashed(const void *data, size_t size, uint64_t hash);
+
+	// Insert `count` buffers with prefetched lookups, writing a reference to each one to `result`.
+	void insert_batch(const void *const *data, const size_t *sizes, size_t count, const blob **result);
+
+	// Return a new reference to a cached copy of the buffer or nullptr, never copies.
+	const blob *acquire(const void *data, size_t size);
+
+	// Look up a cached copy without changing its refcount or recency.
+	const blob *find(const void *data, size_t size) const { return find_hashed(data, size, hash_buffer(data, size)); }
+	const blob *find_hashed(const void *data, size_t size, uint64_t hash) const;
+
+	void retain(const blob *b);
+
+	// Drop a reference, unreferenced buffers become candidates for eviction.
+	void release(const blob *b);
+
+	// Change the size limit and evict unreferenced buffers to fit.
+	void set_max_bytes(size_t bytes);
+
+	// Evict all unreferenced buffers.
+	void trim();
+
+	// Free all buffers, invalidating any outstanding references.
+	void reset();
+
+	size_t size() const noexcept { return map.size; }
+	size_t total_bytes() const noexcept { return cached_bytes; }
+	uint64_t num_hits() const noexcept { return hit_count; }
+	uint64_t num_misses() const noexcept { return miss_count; }
+
+protected:
+	const allocator *ator;
+	size_t max_bytes;
+	rhmap map = { };
+	size_t map_alloc_size = 0;
+	array<blob*> blobs;
+	blob *lru_head = nullptr; // Least recently released
+	blob *lru_tail = nullptr;
+	size_t cached_bytes = 0;
+	uint64_t hit_count = 0, miss_count = 0;
+
+	RHMAP_FORCEINLINE static bool imp_match(const blob *b, const void *data, size_t size, uint64_t hash) {
+		return b->hash == hash && b->size == size && !memcmp(b->data(), data, size);
+	}
+
+	blob *imp_find(const void *data, size_t size, uint64_t hash, uint32_t *p_scan) const;
+	void imp_ref(blob *b);
+	void imp_lru_unlink(blob *b);
+	void imp_evict(size_t limit);
+	void imp_remove(blob *b);
+	void imp_grow(size_t min_size);
+};
+
+}
+
+#endif
@@ -0,0 +1,42 @@
+#include "rh_bloom.h"
+
+namespace rh {
+
+const uint32_t blocked_bloom::salts[blocked_bloom::block_words] = {
+	UINT32_C(0x47b6137b), UINT32_C(0x44974d91), UINT32_C(0x8824ad5b), UINT32_C(0xa2b7289d),
+	UINT32_C(0x705495c7), UINT32_C(0x2df1424b), UINT32_C(0x9efc4947), UINT32_C(0x5c6bfb31),
+};
+
+void blocked_bloom::init(size_t count, uint32_t bits_per_key)
+{
+	size_t block_bits = block_words * 64;
+	size_t new_blocks = (count * bits_per_key + block_bits - 1) / block_bits;
+	if (new_blocks == 0) new_blocks = 1;
+	RHMAP_ASSERT(new_blocks <= UINT32_MAX);
+
+	if (new_blocks != num_blocks) {
+		reset();
+		// Allocators don't guarantee cache line alignment, over-allocate and align manually
+		data_size = new_blocks * block_words * sizeof(uint64_t) + 64;
+		data = ator->allocate(ator->user, data_size);
+		blocks = (uint64_t*)(((uintptr_t)data + 63) & ~(uintptr_t)63);
+		num_blocks = (uint32_t)new_blocks;
+	}
+	clear();
+}
+
+void blocked_bloom::clear()
+{
+	if (num_blocks > 0) memset(blocks, 0, size_in_bytes());
+}
+
+void blocked_bloom::reset()
+{
+	if (data) ator->free(ator->user, data, data_size);
+	data = nullptr;
+	data_size = 0;
+	blocks = nullptr;
+	num_blocks = 0;
+}
+
+}
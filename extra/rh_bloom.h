@@ -0,0 +1,238 @@
+#ifndef RH_BLOOM_H_INCLUDED
+#define RH_BLOOM_H_INCLUDED
+
+#include "rh_hash.h"
+
+namespace rh {
+
+// Bloom filter where every key sets 8 bits inside a single 64-byte block,
+// so both adding and testing a key touch exactly one cache line.
+// Keys are added as the 32-bit hashes used by the hash containers, the block
+// and bit positions are derived from them with extra mixing.
+struct blocked_bloom
+{
+	static const size_t block_words = 8;
+
+	explicit blocked_bloom(const allocator *ator=&stdlib_allocator) : ator(ator) { }
+	~blocked_bloom() { reset(); }
+
+	blocked_bloom(const blocked_bloom &) = delete;
+	blocked_bloom &operator=(const blocked_bloom &) = delete;
+
+	// Size the filter for `count` keys at `bits_per_key` and clear it.
+	void init(size_t count, uint32_t bits_per_key=12);
+
+	void clear();
+	void reset();
+
+	RHMAP_FORCEINLINE void add(uint32_t hash) {
+		RHMAP_ASSERT(num_blocks > 0 && "init() the filter before adding");
+		uint64_t *block = imp_block(hash);
+		uint32_t h = hash * UINT32_C(0x9e3779b9) ^ hash >> 16u;
+		for (size_t i = 0; i < block_words; i++) {
+			block[i] |= UINT64_C(1) << ((h * salts[i]) >> 26u);
+		}
+	}
+
+	// Returns false if the hash was definitely never added.
+	RHMAP_FORCEINLINE bool maybe_contains(uint32_t hash) const {
+		if (num_blocks == 0) return false;
+		const uint64_t *block = imp_block(hash);
+		uint32_t h = hash * UINT32_C(0x9e3779b9) ^ hash >> 16u;
+		uint64_t missing = 0;
+		for (size_t i = 0; i < block_words; i++) {
+			missing |= ~block[i] & (UINT64_C(1) << ((h * salts[i]) >> 26u));
+		}
+		return missing == 0;
+	}
+
+	RHMAP_FORCEINLINE void prefetch(uint32_t hash) const {
+		if (num_blocks > 0) RHMAP_PREFETCH(imp_block(hash));
+	}
+
+	size_t size_in_bytes() const noexcept { return num_blocks * block_words * sizeof(uint64_t); }
+
+protected:
+	static const uint32_t salts[block_words];
+
+	const allocator *ator;
+	void *data = nullptr;
+	size_t data_size = 0;
+	uint64_t *blocks = nullptr;
+	uint32_t num_blocks = 0;
+
+	RHMAP_FORCEINLINE uint64_t *imp_block(uint32_t hash) const {
+		uint32_t mixed = hash ^ hash >> 15u;
+		mixed *= UINT32_C(0x2c1b3c6d);
+		mixed ^= mixed >> 12u;
+		return blocks + (size_t)(((uint64_t)mixed * num_blocks) >> 32u) * block_words;
+	}
+};
+
+// `hash_set` with a `blocked_bloom` prefilter for lookups that mostly miss.
+// A lookup computes the hash once and rejects most absent keys after reading a
+// single filter cache line without touching the rhmap index or the values.
+// The filter is rebuilt from the hashes stored in the index whenever the set
+// changes its capacity, which also drops bits left over by removed keys.
+template <typename T
+	, typename Hash = default_hash<T>
+	, const allocator *Allocator=&stdlib_allocator>
+struct bloom_hash_set
+{
+	using set_type = hash_set<T, Hash, Allocator>;
+	using value_type = T;
+	using const_iterator = const T*;
+
+	explicit bloom_hash_set(uint32_t bits_per_key=12, const Hash &hash_fn=Hash())
+		: items(hash_fn), hash_fn(hash_fn), filter(Allocator), bits_per_key(bits_per_key) { }
+
+	insert_result<T> insert(const T &value) {
+		insert_result<T> result = items.insert(value);
+		if (result.inserted) imp_added(hash_fn(value));
+		return result;
+	}
+
+	const_iterator find(const T &value) const {
+		uint32_t hash = hash_fn(value), scan = 0, index;
+		if (!filter.maybe_contains(hash)) return nullptr;
+		const T *vals = items.begin();
+		while (rhmap_find_inline(&items.raw_map(), hash, &scan, &index)) {
+			if (value == vals[index]) return &vals[index];
+		}
+		return nullptr;
+	}
+
+	bool contains(const T &value) const { return find(value) != nullptr; }
+	bool remove(const T &value) { return items.remove(value); }
+
+	void reserve(size_t count) {
+		items.reserve(count);
+		if (items.capacity() != filter_capacity) imp_rebuild();
+	}
+
+	void clear() {
+		items.clear();
+		filter.clear();
+	}
+
+	size_t size() const noexcept { return items.size(); }
+	bool empty() const noexcept { return items.size() == 0; }
+	const_iterator begin() const noexcept { return items.begin(); }
+	const_iterator end() const noexcept { return items.end(); }
+	const set_type &set() const noexcept { return items; }
+	const blocked_bloom &bloom() const noexcept { return filter; }
+
+protected:
+	set_type items;
+	mutable Hash hash_fn;
+	blocked_bloom filter;
+	uint32_t bits_per_key;
+	size_t filter_capacity = 0;
+
+	void imp_added(uint32_t hash) {
+		if (items.capacity() != filter_capacity) imp_rebuild();
+		else filter.add(hash);
+	}
+
+	void imp_rebuild() {
+		filter_capacity = items.capacity();
+		filter.init(filter_capacity, bits_per_key);
+		uint32_t hash = 0, scan = 0, index;
+		while (rhmap_next_inline(&items.raw_map(), &hash, &scan, &index)) filter.add(hash);
+	}
+};
+
+// `hash_map` with a `blocked_bloom` prefilter, see `bloom_hash_set`.
+template <typename K, typename V
+	, typename Hash = default_hash<K>
+	, const allocator *Allocator=&stdlib_allocator>
+struct bloom_hash_map
+{
+	using map_type = hash_map<K, V, Hash, Allocator>;
+	using value_type = kv_pair<K, V>;
+	using iterator = value_type*;
+	using const_iterator = const value_type*;
+
+	explicit bloom_hash_map(uint32_t bits_per_key=12, const Hash &hash_fn=Hash())
+		: items(hash_fn), hash_fn(hash_fn), filter(Allocator), bits_per_key(bits_per_key) { }
+
+	insert_result<value_type> insert(const value_type &pair) {
+		insert_result<value_type> result = items.insert(pair);
+		if (result.inserted) imp_added(hash_fn(pair.key));
+		return result;
+	}
+
+	template <typename... Args>
+	insert_result<value_type> emplace(const K &key, Args&&... value) {
+		insert_result<value_type> result = items.emplace(key, std::forward<Args>(value)...);
+		if (result.inserted) imp_added(hash_fn(key));
+		return result;
+	}
+
+	V &operator[](const K &key) { return emplace(key).entry->value; }
+
+	iterator find(const K &key) {
+		uint32_t hash = hash_fn(key), scan = 0, index;
+		if (!filter.maybe_contains(hash)) return nullptr;
+		value_type *vals = items.begin();
+		while (rhmap_find_inline(&items.raw_map(), hash, &scan, &index)) {
+			if (key == vals[index].key) return &vals[index];
+		}
+		return nullptr;
+	}
+
+	const_iterator find(const K &key) const {
+		uint32_t hash = hash_fn(key), scan = 0, index;
+		if (!filter.maybe_contains(hash)) return nullptr;
+		const value_type *vals = items.begin();
+		while (rhmap_find_inline(&items.raw_map(), hash, &scan, &index)) {
+			if (key == vals[index].key) return &vals[index];
+		}
+		return nullptr;
+	}
+
+	bool contains(const K &key) const { return find(key) != nullptr; }
+	bool remove(const K &key) { return items.remove(key); }
+
+	void reserve(size_t count) {
+		items.reserve(count);
+		if (items.capacity() != filter_capacity) imp_rebuild();
+	}
+
+	void clear() {
+		items.clear();
+		filter.clear();
+	}
+
+	size_t size() const noexcept { return items.size(); }
+	bool empty() const noexcept { return items.size() == 0; }
+	iterator begin() noexcept { return items.begin(); }
+	iterator end() noexcept { return items.end(); }
+	const_iterator begin() const noexcept { return items.begin(); }
+	const_iterator end() const noexcept { return items.end(); }
+	const map_type &map() const noexcept { return items; }
+	const blocked_bloom &bloom() const noexcept { return filter; }
+
+protected:
+	map_type items;
+	mutable Hash hash_fn;
+	blocked_bloom filter;
+	uint32_t bits_per_key;
+	size_t filter_capacity = 0;
+
+	void imp_added(uint32_t hash) {
+		if (items.capacity() != filter_capacity) imp_rebuild();
+		else filter.add(hash);
+	}
+
+	void imp_rebuild() {
+		filter_capacity = items.capacity();
+		filter.init(filter_capacity, bits_per_key);
+		uint32_t hash = 0, scan = 0, index;
+		while (rhmap_next_inline(&items.raw_map(), &hash, &scan, &index)) filter.add(hash);
+	}
+};
+
+}
+
+#endif
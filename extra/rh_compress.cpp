@@ -0,0 +1,422 @@
+#include "rh_compress.h"
+
+#include <stdlib.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace rh {
+
+static const uint32_t compressed_magic = 0x72686370; // 'rhcp'
+static const uint32_t compressed_version = 1;
+static const uint32_t block_raw_bit = 0x80000000u;
+
+static const size_t min_match = 4;
+static const size_t max_offset = 65535;
+static const uint32_t table_bits = 14;
+
+struct compressed_header {
+	uint32_t magic, version;
+	uint32_t value_size;
+	uint32_t size, capacity, mask;
+	uint32_t block_size;
+	uint32_t reserved;
+};
+
+static RHMAP_FORCEINLINE uint32_t read32(const uint8_t *ptr)
+{
+	uint32_t v;
+	memcpy(&v, ptr, sizeof(uint32_t));
+	return v;
+}
+
+static void shuffle(uint8_t *dst, const uint8_t *src, size_t size, size_t elem_size)
+{
+	size_t count = size / elem_size;
+	for (size_t b = 0; b < elem_size; b++) {
+		const uint8_t *s = src + b;
+		uint8_t *d = dst + b * count;
+		for (size_t i = 0; i < count; i++) {
+			d[i] = *s;
+			s += elem_size;
+		}
+	}
+	memcpy(dst + count * elem_size, src + count * elem_size, size - count * elem_size);
+}
+
+static void unshuffle(uint8_t *dst, const uint8_t *src, size_t size, size_t elem_size)
+{
+	size_t count = size / elem_size;
+	for (size_t b = 0; b < elem_size; b++) {
+		const uint8_t *s = src + b * count;
+		uint8_t *d = dst + b;
+		for (size_t i = 0; i < count; i++) {
+			*d = s[i];
+			d += elem_size;
+		}
+	}
+	memcpy(dst + count * elem_size, src + count * elem_size, size - count * elem_size);
+}
+
+static uint8_t *write_length(uint8_t *dst, size_t length)
+{
+	while (length >= 255) {
+		*dst++ = 255;
+		length -= 255;
+	}
+	*dst++ = (uint8_t)length;
+	return dst;
+}
+
+static uint8_t *write_sequence(uint8_t *dst, const uint8_t *literals, size_t num_literals, size_t offset, size_t match_length)
+{
+	size_t match_code = match_length ? match_length - min_match : 0;
+	uint8_t token = (uint8_t)((num_literals < 15 ? num_literals : 15) << 4u | (match_code < 15 ? match_code : 15));
+	*dst++ = token;
+	if (num_literals >= 15) dst = write_length(dst, num_literals - 15);
+	memcpy(dst, literals, num_literals);
+	dst += num_literals;
+	if (match_length == 0) return dst;
+	*dst++ = (uint8_t)offset;
+	*dst++ = (uint8_t)(offset >> 8u);
+	if (match_code >= 15) dst = write_length(dst, match_code - 15);
+	return dst;
+}
+
+static size_t lz_compress(uint8_t *dst, const uint8_t *src, size_t size)
+{
+	uint32_t *table = (uint32_t*)calloc((size_t)1 << table_bits, sizeof(uint32_t));
+	uint8_t *out = dst;
+	size_t pos = 0, anchor = 0;
+
+	while (pos + min_match <= size) {
+		uint32_t seq = read32(src + pos);
+		uint32_t slot = (seq * UINT32_C(2654435761)) >> (32u - table_bits);
+		size_t ref = table[slot];
+		table[slot] = (uint32_t)pos;
+
+		if (ref < pos && pos - ref <= max_offset && read32(src + ref) == seq) {
+			size_t length = min_match;
+			while (pos + length < size && src[ref + length] == src[pos + length]) length++;
+			out = write_sequence(out, src + anchor, pos - anchor, pos - ref, length);
+			pos += length;
+			anchor = pos;
+		} else {
+			// Skip faster through incompressible data
+			pos += 1 + ((pos - anchor) >> 6u);
+		}
+	}
+
+	out = write_sequence(out, src + anchor, size - anchor, 0, 0);
+	free(table);
+	return (size_t)(out - dst);
+}
+
+static bool read_length(const uint8_t **p_src, const uint8_t *end, size_t *p_length)
+{
+	const uint8_t *src = *p_src;
+	for (;;) {
+		if (src == end) return false;
+		uint8_t b = *src++;
+		*p_length += b;
+		if (b != 255) break;
+	}
+	*p_src = src;
+	return true;
+}
+
+static bool lz_decompress(uint8_t *dst, size_t dst_size, const uint8_t *src, size_t src_size)
+{
+	const uint8_t *end = src + src_size;
+	uint8_t *out = dst, *out_end = dst + dst_size;
+	while (src != end) {
+		uint8_t token = *src++;
+		size_t num_literals = token >> 4u;
+		if (num_literals == 15 && !read_length(&src, end, &num_literals)) return false;
+		if ((size_t)(end - src) < num_literals || (size_t)(out_end - out) < num_literals) return false;
+		memcpy(out, src, num_literals);
+		src += num_literals;
+		out += num_literals;
+
+		// The last sequence contains only literals
+		if (src == end) break;
+
+		if (end - src < 2) return false;
+		size_t offset = (size_t)src[0] | (size_t)src[1] << 8u;
+		src += 2;
+		size_t length = token & 0xf;
+		if (length == 15 && !read_length(&src, end, &length)) return false;
+		length += min_match;
+		if (offset == 0 || offset > (size_t)(out - dst) || (size_t)(out_end - out) < length) return false;
+
+		const uint8_t *ref = out - offset;
+		if (offset >= length) {
+			memcpy(out, ref, length);
+			out += length;
+		} else {
+			for (size_t i = 0; i < length; i++) *out++ = *ref++;
+		}
+	}
+	return out == out_end;
+}
+
+size_t compress_bound(size_t size)
+{
+	return size + size / 255 + 16;
+}
+
+size_t compress(void *dst, const void *src, size_t size, size_t elem_size)
+{
+	if (elem_size <= 1) return lz_compress((uint8_t*)dst, (const uint8_t*)src, size);
+	uint8_t *shuffled = (uint8_t*)malloc(size);
+	shuffle(shuffled, (const uint8_t*)src, size, elem_size);
+	size_t result = lz_compress((uint8_t*)dst, shuffled, size);
+	free(shuffled);
+	return result;
+}
+
+bool decompress(void *dst, size_t dst_size, const void *src, size_t src_size, size_t elem_size)
+{
+	if (elem_size <= 1) return lz_decompress((uint8_t*)dst, dst_size, (const uint8_t*)src, src_size);
+	uint8_t *shuffled = (uint8_t*)malloc(dst_size);
+	bool ok = lz_decompress(shuffled, dst_size, (const uint8_t*)src, src_size);
+	if (ok) unshuffle((uint8_t*)dst, shuffled, dst_size, elem_size);
+	free(shuffled);
+	return ok;
+}
+
+// Threads started once per snapshot and reused for every batch of blocks.
+// `run()` calls `fn(i)` for every `i` below `count` on the workers and the
+// calling thread and returns once all of them are done.
+struct worker_pool {
+	std::mutex mutex;
+	std::condition_variable start_cv, done_cv;
+	std::thread *threads = nullptr;
+	unsigned num_workers = 0;
+	unsigned generation = 0;
+	unsigned num_busy = 0;
+	bool stop = false;
+
+	void (*call)(void *user, size_t index) = nullptr;
+	void *user = nullptr;
+	size_t count = 0;
+	std::atomic<size_t> next { 0 };
+
+	explicit worker_pool(unsigned num_threads) : num_workers(num_threads > 1 ? num_threads - 1 : 0) {
+		if (num_workers > 0) threads = new std::thread[num_workers];
+		for (unsigned i = 0; i < num_workers; i++) threads[i] = std::thread([this]() { imp_worker(); });
+	}
+
+	~worker_pool() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stop = true;
+		}
+		start_cv.notify_all();
+		for (unsigned i = 0; i < num_workers; i++) threads[i].join();
+		delete[] threads;
+	}
+
+	template <typename Fn>
+	void run(size_t num, Fn &&fn) {
+		using fn_type = typename std::remove_reference<Fn>::type;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			call = [](void *user, size_t index) { (*(fn_type*)user)(index); };
+			user = (void*)&fn;
+			count = num;
+			next = 0;
+			num_busy = num_workers;
+			generation++;
+		}
+		start_cv.notify_all();
+		imp_work();
+		std::unique_lock<std::mutex> lock(mutex);
+		done_cv.wait(lock, [&]() { return num_busy == 0; });
+	}
+
+	void imp_work() {
+		for (size_t i; (i = next.fetch_add(1)) < count; ) call(user, i);
+	}
+
+	void imp_worker() {
+		unsigned seen = 0;
+		for (;;) {
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				start_cv.wait(lock, [&]() { return stop || generation != seen; });
+				if (stop) return;
+				seen = generation;
+			}
+			imp_work();
+			std::lock_guard<std::mutex> lock(mutex);
+			if (--num_busy == 0) done_cv.notify_one();
+		}
+	}
+};
+
+// Snapshots are split into the index region and the value region so that both
+// can be shuffled using their own element size.
+struct snapshot_blocks {
+	char *data[2];
+	size_t size[2];
+	size_t elem_size[2];
+	size_t block_size[2];
+	size_t num_blocks[2];
+
+	snapshot_blocks(void *entries, size_t alloc_size, void *values, size_t values_size, size_t value_size, size_t block_size_) {
+		data[0] = (char*)entries;
+		data[1] = (char*)values;
+		size[0] = alloc_size;
+		size[1] = values_size;
+		elem_size[0] = sizeof(uint64_t);
+		elem_size[1] = value_size;
+		for (int i = 0; i < 2; i++) {
+			block_size[i] = block_size_ - block_size_ % elem_size[i];
+			if (block_size[i] == 0) block_size[i] = elem_size[i];
+			num_blocks[i] = (size[i] + block_size[i] - 1) / block_size[i];
+		}
+	}
+
+	size_t count() const { return num_blocks[0] + num_blocks[1]; }
+
+	void get(size_t index, char **p_data, size_t *p_size, size_t *p_elem_size) const {
+		int region = index < num_blocks[0] ? 0 : 1;
+		if (region == 1) index -= num_blocks[0];
+		size_t offset = index * block_size[region];
+		size_t left = size[region] - offset;
+		*p_data = data[region] + offset;
+		*p_size = left < block_size[region] ? left : block_size[region];
+		*p_elem_size = elem_size[region];
+	}
+};
+
+static unsigned resolve_threads(const compress_options &opts)
+{
+	unsigned num_threads = opts.num_threads;
+	if (num_threads == 0) num_threads = std::thread::hardware_concurrency();
+	return num_threads > 0 ? num_threads : 1;
+}
+
+bool imp_save_compressed(writer &w, const hash_base &hash, const compress_options &opts)
+{
+	const rhmap &map = hash.raw_map();
+	size_t value_size = hash.raw_value_size();
+	size_t block_size = opts.block_size ? opts.block_size : 256 * 1024;
+	if (block_size > block_raw_bit - 1) block_size = block_raw_bit - 1;
+	compressed_header header = { compressed_magic, compressed_version, (uint32_t)value_size,
+		map.size, map.capacity, map.mask, (uint32_t)block_size, 0 };
+	if (!w.write(w.user, &header, sizeof(header))) return false;
+
+	snapshot_blocks blocks(map.entries, rhmap_alloc_size_inline(&map),
+		(void*)hash.raw_values(), map.size * value_size, value_size, block_size);
+
+	// Compress a batch of blocks in parallel and write them out in order
+	unsigned num_threads = resolve_threads(opts);
+	size_t batch_size = (size_t)num_threads * 4;
+	size_t bound = compress_bound(block_size);
+	char *buffer = (char*)malloc(batch_size * (bound + sizeof(uint32_t)));
+	bool ok = true;
+	worker_pool pool(blocks.count() < num_threads ? (unsigned)blocks.count() : num_threads);
+
+	for (size_t base = 0; ok && base < blocks.count(); base += batch_size) {
+		size_t num = blocks.count() - base;
+		if (num > batch_size) num = batch_size;
+		pool.run(num, [&](size_t i) {
+			char *data, *dst = buffer + i * (bound + sizeof(uint32_t));
+			size_t size, elem_size;
+			blocks.get(base + i, &data, &size, &elem_size);
+			uint32_t packed = (uint32_t)compress(dst + sizeof(uint32_t), data, size, elem_size);
+			if (packed >= size) {
+				packed = (uint32_t)size | block_raw_bit;
+				memcpy(dst + sizeof(uint32_t), data, size);
+			}
+			memcpy(dst, &packed, sizeof(uint32_t));
+		});
+
+		for (size_t i = 0; ok && i < num; i++) {
+			const char *src = buffer + i * (bound + sizeof(uint32_t));
+			uint32_t packed;
+			memcpy(&packed, src, sizeof(uint32_t));
+			ok = w.write(w.user, src, sizeof(uint32_t) + (packed & ~block_raw_bit));
+		}
+	}
+
+	free(buffer);
+	return ok;
+}
+
+bool imp_load_compressed(reader &r, hash_base &hash, const compress_options &opts)
+{
+	compressed_header header;
+	if (!r.read(r.user, &header, sizeof(header))) return false;
+	if (header.magic != compressed_magic || header.version != compressed_version) return false;
+	if (header.value_size != hash.raw_value_size() || header.size > header.capacity) return false;
+	if ((header.mask & (header.mask + 1)) != 0 || header.block_size == 0) return false;
+	if (header.mask != 0 && header.capacity > (uint64_t)header.mask + 1) return false;
+
+	if (header.mask == 0) {
+		hash.reset();
+		return header.size == 0;
+	}
+
+	uint64_t *entries;
+	void *values;
+	if (!hash.raw_allocate(header.mask, header.capacity, &entries, &values)) return false;
+
+	size_t alloc_size = ((size_t)header.mask + 1) * sizeof(uint64_t);
+	size_t block_size = header.block_size;
+	snapshot_blocks blocks(entries, alloc_size, values, (size_t)header.size * header.value_size, header.value_size, block_size);
+
+	// Read a batch of blocks and decompress them in parallel directly to the map storage
+	unsigned num_threads = resolve_threads(opts);
+	size_t batch_size = (size_t)num_threads * 4;
+	size_t stride = block_size + sizeof(uint32_t);
+	char *buffer = (char*)malloc(batch_size * stride);
+	std::atomic<bool> ok { true };
+	worker_pool pool(blocks.count() < num_threads ? (unsigned)blocks.count() : num_threads);
+
+	for (size_t base = 0; ok && base < blocks.count(); base += batch_size) {
+		size_t num = blocks.count() - base;
+		if (num > batch_size) num = batch_size;
+		for (size_t i = 0; ok && i < num; i++) {
+			char *dst = buffer + i * stride;
+			uint32_t packed;
+			if (!r.read(r.user, &packed, sizeof(uint32_t)) || (packed & ~block_raw_bit) > block_size) {
+				ok = false;
+				break;
+			}
+			memcpy(dst, &packed, sizeof(uint32_t));
+			if (!r.read(r.user, dst + sizeof(uint32_t), packed & ~block_raw_bit)) ok = false;
+		}
+		if (!ok) break;
+
+		pool.run(num, [&](size_t i) {
+			const char *src = buffer + i * stride;
+			char *data;
+			size_t size, elem_size;
+			uint32_t packed;
+			memcpy(&packed, src, sizeof(uint32_t));
+			blocks.get(base + i, &data, &size, &elem_size);
+			size_t src_size = packed & ~block_raw_bit;
+			if (packed & block_raw_bit) {
+				if (src_size == size) memcpy(data, src + sizeof(uint32_t), size);
+				else ok = false;
+			} else if (!decompress(data, size, src + sizeof(uint32_t), src_size, elem_size)) {
+				ok = false;
+			}
+		});
+	}
+
+	free(buffer);
+	if (!ok || !hash.raw_check_index(header.size)) {
+		hash.reset();
+		return false;
+	}
+
+	hash.raw_commit(header.size);
+	return true;
+}
+
+}
@@ -0,0 +1,61 @@
+#ifndef RH_COMPRESS_H_INCLUDED
+#define RH_COMPRESS_H_INCLUDED
+
+#include "rh_hash.h"
+
+namespace rh {
+
+struct compress_options {
+	// Size of the independently compressed blocks, larger blocks compress better
+	// but limit the parallelism available when decompressing.
+	size_t block_size = 256 * 1024;
+
+	// Number of worker threads, zero uses all hardware threads.
+	unsigned num_threads = 0;
+};
+
+// Worst case compressed size of `size` bytes.
+size_t compress_bound(size_t size);
+
+// LZ77 block codec with an LZ4-style sequence format. The data is byte-shuffled by
+// `elem_size` first so that similar bytes of consecutive integers compress together.
+// `dst` must have room for `compress_bound(size)` bytes, returns the compressed size.
+size_t compress(void *dst, const void *src, size_t size, size_t elem_size);
+
+// Decompress exactly `dst_size` bytes, returns false if the data is corrupted.
+bool decompress(void *dst, size_t dst_size, const void *src, size_t src_size, size_t elem_size);
+
+bool imp_save_compressed(writer &w, const hash_base &hash, const compress_options &opts);
+bool imp_load_compressed(reader &r, hash_base &hash, const compress_options &opts);
+
+// Write a compressed snapshot of `map`. The index is stored as-is like in `hash_map::save()`
+// so the map must be loaded using the same hash function.
+template <typename K, typename V, typename Hash, const allocator *Allocator>
+bool save_compressed(writer &w, const hash_map<K, V, Hash, Allocator> &map, const compress_options &opts=compress_options()) {
+	static_assert(std::is_trivially_copyable<kv_pair<K, V>>::value, "Compressed snapshots require trivially copyable values");
+	return imp_save_compressed(w, map, opts);
+}
+
+template <typename T, typename Hash, const allocator *Allocator>
+bool save_compressed(writer &w, const hash_set<T, Hash, Allocator> &set, const compress_options &opts=compress_options()) {
+	static_assert(std::is_trivially_copyable<T>::value, "Compressed snapshots require trivially copyable values");
+	return imp_save_compressed(w, set, opts);
+}
+
+// Replace the contents of `map` with a snapshot written by `save_compressed()`.
+// Blocks are decompressed in parallel directly into the internal storage of `map`.
+template <typename K, typename V, typename Hash, const allocator *Allocator>
+bool load_compressed(reader &r, hash_map<K, V, Hash, Allocator> &map, const compress_options &opts=compress_options()) {
+	static_assert(std::is_trivially_copyable<kv_pair<K, V>>::value, "Compressed snapshots require trivially copyable values");
+	return imp_load_compressed(r, map, opts);
+}
+
+template <typename T, typename Hash, const allocator *Allocator>
+bool load_compressed(reader &r, hash_set<T, Hash, Allocator> &set, const compress_options &opts=compress_options()) {
+	static_assert(std::is_trivially_copyable<T>::value, "Compressed snapshots require trivially copyable values");
+	return imp_load_compressed(r, set, opts);
+}
+
+}
+
+#endif
@@ -0,0 +1,253 @@
+#include "rh_dedup.h"
+
+#include <stdlib.h>
+
+#if defined(_WIN32)
+	#define WIN32_LEAN_AND_MEAN
+	#define NOMINMAX
+	#include <Windows.h>
+#else
+	#include <unistd.h>
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+#endif
+
+namespace rh {
+
+static const size_t output_flush_size = 64 * 1024;
+static const size_t read_chunk_size = 1024 * 1024;
+
+// Partitions still over the memory limit after this many levels, eg. due to
+// records with equal 32-bit hashes, are deduplicated fully in memory.
+static const uint32_t max_spill_depth = 8;
+
+static void append_bytes(array<char> &dst, const char *data, size_t size)
+{
+	size_t begin = dst.size();
+	dst.resize(begin + size);
+	memcpy(dst.data() + begin, data, size);
+}
+
+dedup_stream::dedup_stream(const writer &out, const dedup_options &opts)
+	: out(out), opts(opts)
+{
+	RHMAP_ASSERT(opts.num_partitions > 0);
+}
+
+dedup_stream::~dedup_stream()
+{
+	if (partitions) {
+		for (uint32_t i = 0; i < opts.num_partitions; i++) {
+			if (partitions[i].file) fclose(partitions[i].file);
+		}
+		free(partitions);
+	}
+}
+
+bool dedup_stream::push(const void *data, size_t size)
+{
+	const char *ptr = (const char*)data, *end = ptr + size;
+	char separator = opts.separator;
+
+	// Complete a record left over from the previous call
+	if (pending.size() > 0) {
+		const char *sep = (const char*)memchr(ptr, separator, size);
+		if (!sep) {
+			append_bytes(pending, ptr, size);
+			return !failed;
+		}
+		append_bytes(pending, ptr, sep - ptr);
+		imp_add(pending.data(), pending.size());
+		imp_flush_batch();
+		pending.clear();
+		ptr = sep + 1;
+	}
+
+	// Records are referenced in place so the batch must be flushed before returning
+	while (const char *sep = (const char*)memchr(ptr, separator, end - ptr)) {
+		imp_add(ptr, sep - ptr);
+		ptr = sep + 1;
+	}
+	imp_flush_batch();
+
+	append_bytes(pending, ptr, end - ptr);
+	return !failed;
+}
+
+bool dedup_stream::push_reader(reader &r, uint64_t size)
+{
+	array<char> buffer;
+	buffer.resize(read_chunk_size);
+	while (size > 0) {
+		size_t chunk = size < read_chunk_size ? (size_t)size : read_chunk_size;
+		if (!r.read(r.user, buffer.data(), chunk)) return false;
+		if (!push(buffer.data(), chunk)) return false;
+		size -= chunk;
+	}
+	return !failed;
+}
+
+bool dedup_stream::push_file(const char *path)
+{
+#if defined(_WIN32)
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE) return false;
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size)) { CloseHandle(file); return false; }
+	if (size.QuadPart == 0) { CloseHandle(file); return !failed; }
+	HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (!mapping) { CloseHandle(file); return false; }
+	void *data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	bool ok = data && push(data, (size_t)size.QuadPart);
+	if (data) UnmapViewOfFile(data);
+	CloseHandle(mapping);
+	CloseHandle(file);
+	return ok;
+#else
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) return false;
+	struct stat st;
+	if (fstat(fd, &st) != 0) { close(fd); return false; }
+	size_t size = (size_t)st.st_size;
+	if (size == 0) { close(fd); return !failed; }
+	void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) return false;
+	madvise(data, size, MADV_SEQUENTIAL);
+	bool ok = push(data, size);
+	munmap(data, size);
+	return ok;
+#endif
+}
+
+bool dedup_stream::finish()
+{
+	if (pending.size() > 0) {
+		imp_add(pending.data(), pending.size());
+		imp_flush_batch();
+		pending.clear();
+	}
+
+	if (!imp_finish_partitions()) failed = true;
+
+	seen.reset();
+	if (!imp_flush_output()) failed = true;
+	return !failed;
+}
+
+void dedup_stream::imp_add(const char *data, size_t size)
+{
+	batch[batch_count].data = data;
+	batch[batch_count].size = size;
+	input_count++;
+	if (++batch_count == batch_size) imp_flush_batch();
+}
+
+void dedup_stream::imp_flush_batch()
+{
+	uint32_t hashes[batch_size];
+	size_t count = batch_count;
+	batch_count = 0;
+	for (size_t i = 0; i < count; i++) {
+		hashes[i] = string_interner::hash_string(batch[i].data, batch[i].size);
+	}
+	for (size_t i = 0; i < count; i++) {
+		seen.prefetch(hashes[i]);
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		const record &rec = batch[i];
+		if (!spilling) {
+			size_t prev_size = seen.size();
+			seen.intern_hashed(rec.data, rec.size, hashes[i]);
+			if (seen.size() != prev_size) {
+				imp_emit(rec.data, rec.size);
+				if (seen.memory_usage() > opts.max_memory && spill_depth < max_spill_depth) spilling = true;
+			}
+		} else if (seen.find_hashed(rec.data, rec.size, hashes[i]) == string_interner::invalid_id) {
+			imp_spill(rec.data, rec.size, hashes[i]);
+		}
+	}
+}
+
+void dedup_stream::imp_emit(const char *data, size_t size)
+{
+	append_bytes(out_buffer, data, size);
+	out_buffer.push_back(opts.separator);
+	output_count++;
+	if (out_buffer.size() >= output_flush_size && !imp_flush_output()) failed = true;
+}
+
+void dedup_stream::imp_spill(const char *data, size_t size, uint32_t hash)
+{
+	if (!partitions) {
+		partitions = (partition*)calloc(opts.num_partitions, sizeof(partition));
+		if (!partitions) { failed = true; return; }
+	}
+	// Records of one partition share their top hash bits, re-partition with a seeded hash
+	if (spill_depth > 0) hash = rh::hash(hash ^ spill_depth * UINT32_C(0x9e3779b9));
+	uint32_t index = (uint32_t)(((uint64_t)hash * opts.num_partitions) >> 32u);
+	partition &part = partitions[index];
+	if (!part.file) {
+		part.file = tmpfile();
+		if (!part.file) { failed = true; return; }
+	}
+	if (fwrite(data, 1, size, part.file) != size || fputc(opts.separator, part.file) == EOF) failed = true;
+	part.size += size + 1;
+	spill_count++;
+}
+
+bool dedup_stream::imp_flush_output()
+{
+	if (out_buffer.size() == 0) return true;
+	bool ok = out.write(out.user, out_buffer.data(), out_buffer.size());
+	out_buffer.clear();
+	return ok;
+}
+
+bool dedup_stream::imp_finish_partitions()
+{
+	if (!partitions) return true;
+	partition *parts = partitions;
+	partitions = nullptr;
+	spill_depth++;
+
+	bool ok = true;
+	for (uint32_t i = 0; i < opts.num_partitions; i++) {
+		if (!parts[i].file) continue;
+		if (!imp_finish_partition(parts[i])) ok = false;
+		fclose(parts[i].file);
+
+		// The partition didn't fit in memory and was spilled into a new set of files
+		if (!imp_finish_partitions()) ok = false;
+	}
+	free(parts);
+
+	spill_depth--;
+	return ok;
+}
+
+bool dedup_stream::imp_finish_partition(const partition &part)
+{
+	FILE *file = part.file;
+	if (fflush(file) != 0 || fseek(file, 0, SEEK_SET) != 0) return false;
+	// Release the index too, it's counted against the memory limit
+	seen.reset();
+	spilling = false;
+
+	// Spilled records were already counted as input
+	uint64_t prev_input = input_count;
+	size_t chunk_size = part.size < read_chunk_size ? (size_t)part.size + 1 : read_chunk_size;
+	array<char> buffer;
+	buffer.resize(chunk_size);
+	for (;;) {
+		size_t num = fread(buffer.data(), 1, chunk_size, file);
+		if (num > 0 && !push(buffer.data(), num)) return false;
+		if (num < chunk_size) break;
+	}
+	input_count = prev_input;
+	return !ferror(file) && pending.size() == 0;
+}
+
+}
@@ -0,0 +1,91 @@
+#ifndef RH_DEDUP_H_INCLUDED
+#define RH_DEDUP_H_INCLUDED
+
+#include "rh_intern.h"
+
+namespace rh {
+
+struct dedup_options {
+	// Records are separated by this byte, the separator isn't part of the key.
+	char separator = '\n';
+
+	// Memory used by the in-memory set before new records start spilling to disk.
+	size_t max_memory = (size_t)1 << 30;
+
+	// Number of temporary files spilled records are partitioned into by hash.
+	uint32_t num_partitions = 64;
+};
+
+// Streaming deduplication: emits only the first occurrence of every record.
+// Input is pushed as arbitrary chunks, `push_file()` maps a whole file instead.
+// Records are split, hashed and looked up in batches against a `string_interner`
+// with prefetching. Once the set exceeds `max_memory` it's frozen: records found
+// in it are dropped and new ones are appended to hash-partitioned temporary
+// files which `finish()` deduplicates one partition at a time. A partition that
+// exceeds `max_memory` by itself is spilled again with a differently seeded
+// partitioning. Spilled records are emitted after the in-memory ones, in input
+// order within each partition.
+struct dedup_stream
+{
+	static const size_t batch_size = 256;
+
+	dedup_stream(const writer &out, const dedup_options &opts=dedup_options());
+	~dedup_stream();
+
+	dedup_stream(const dedup_stream &) = delete;
+	dedup_stream &operator=(const dedup_stream &) = delete;
+
+	// Feed input bytes, a record may span multiple calls.
+	bool push(const void *data, size_t size);
+
+	// Feed `size` bytes from `r` in large chunks.
+	bool push_reader(reader &r, uint64_t size);
+
+	// Feed the contents of a file using a read-only memory mapping.
+	bool push_file(const char *path);
+
+	// Process a trailing record without a separator and all spilled partitions.
+	bool finish();
+
+	uint64_t num_input() const noexcept { return input_count; }
+	uint64_t num_output() const noexcept { return output_count; }
+	uint64_t num_spilled() const noexcept { return spill_count; }
+
+protected:
+	struct record {
+		const char *data;
+		size_t size;
+	};
+
+	// Spill file and the number of bytes written to it, `ftell()` is 32-bit on Windows
+	struct partition {
+		FILE *file;
+		uint64_t size;
+	};
+
+	writer out;
+	dedup_options opts;
+	string_interner seen;
+	array<char> pending;
+	array<char> out_buffer;
+	partition *partitions = nullptr;
+	uint32_t spill_depth = 0; // Number of partition levels being read back
+	bool spilling = false;
+	bool failed = false;
+	uint64_t input_count = 0, output_count = 0, spill_count = 0;
+
+	record batch[batch_size];
+	size_t batch_count = 0;
+
+	void imp_add(const char *data, size_t size);
+	void imp_flush_batch();
+	void imp_emit(const char *data, size_t size);
+	void imp_spill(const char *data, size_t size, uint32_t hash);
+	bool imp_flush_output();
+	bool imp_finish_partitions();
+	bool imp_finish_partition(const partition &part);
+};
+
+}
+
+#endif
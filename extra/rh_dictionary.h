@@ -0,0 +1,146 @@
+#ifndef RH_DICTIONARY_H_INCLUDED
+#define RH_DICTIONARY_H_INCLUDED
+
+#include "rh_hash.h"
+
+namespace rh {
+
+// Dictionary encoding of a column: maps values to dense `uint32_t` codes in
+// order of first appearance. Columns are encoded in batches: the values are
+// hashed in bulk, the index is grown once for the whole batch and the home
+// slots are prefetched before resolving. The rhmap value is the code itself.
+// Dictionaries built independently for several chunks are combined with
+// `merge()`, which returns a table remapping the codes of the merged chunk.
+// For raw byte strings `string_interner` provides the same ids backed by an arena.
+template <typename T
+	, typename Hash = default_hash<T>
+	, const allocator *Allocator=&stdlib_allocator>
+struct dictionary_encoder
+{
+	static const size_t batch_size = 256;
+	static const uint32_t invalid_code = UINT32_MAX;
+
+	explicit dictionary_encoder(const Hash &hash_fn=Hash()) : hash_fn(hash_fn) { }
+	~dictionary_encoder() { imp_free(); }
+
+	dictionary_encoder(const dictionary_encoder &) = delete;
+	dictionary_encoder &operator=(const dictionary_encoder &) = delete;
+
+	// Write the code of `values[i]` to `codes[i]`, adding new values to the dictionary.
+	void encode(const T *values, size_t count, uint32_t *codes) {
+		uint32_t hashes[batch_size];
+		for (size_t base = 0; base < count; base += batch_size) {
+			size_t num = count - base < batch_size ? count - base : batch_size;
+			const T *batch = values + base;
+			for (size_t i = 0; i < num; i++) hashes[i] = hash_fn(batch[i]);
+			if (map.capacity - map.size < num) reserve(map.size + num);
+			for (size_t i = 0; i < num; i++) rhmap_prefetch_inline(&map, hashes[i]);
+			for (size_t i = 0; i < num; i++) codes[base + i] = imp_encode(batch[i], hashes[i]);
+		}
+	}
+
+	uint32_t encode(const T &value) {
+		if (map.size == map.capacity) reserve(map.size + 1);
+		return imp_encode(value, hash_fn(value));
+	}
+
+	// Return the code of `value` or `invalid_code` if it's not in the dictionary.
+	uint32_t find(const T &value) const {
+		const T *vals = dict.data();
+		uint32_t hash = const_cast<Hash&>(hash_fn)(value), scan = 0, code;
+		while (rhmap_find_inline(&map, hash, &scan, &code)) {
+			if (vals[code] == value) return code;
+		}
+		return invalid_code;
+	}
+
+	RHMAP_FORCEINLINE const T &decode(uint32_t code) const {
+		RHMAP_ASSERT(code < dict.size());
+		return dict.data()[code];
+	}
+
+	void decode(const uint32_t *codes, size_t count, T *values) const {
+		const T *vals = dict.data();
+		for (size_t i = 0; i < count; i++) {
+			RHMAP_ASSERT(codes[i] < dict.size());
+			values[i] = vals[codes[i]];
+		}
+	}
+
+	// Add the values of `other` to this dictionary and write the new code of
+	// each of its codes to `remap`, which must have room for `other.size()` codes.
+	void merge(const dictionary_encoder &other, uint32_t *remap) {
+		if (&other == this) {
+			// Encoding our own values could reallocate them mid-batch, the codes stay the same
+			for (uint32_t i = 0; i < (uint32_t)dict.size(); i++) remap[i] = i;
+			return;
+		}
+		encode(other.values(), other.size(), remap);
+	}
+
+	// Translate codes in place using a table returned by `merge()`.
+	static void remap_codes(uint32_t *codes, size_t count, const uint32_t *remap) {
+		for (size_t i = 0; i < count; i++) codes[i] = remap[codes[i]];
+	}
+
+	// Distinct values indexed by code.
+	RHMAP_FORCEINLINE const T *values() const noexcept { return dict.data(); }
+	RHMAP_FORCEINLINE size_t size() const noexcept { return dict.size(); }
+	RHMAP_FORCEINLINE bool empty() const noexcept { return dict.size() == 0; }
+
+	void reserve(size_t count) {
+		if (count <= map.capacity) return;
+		size_t num, new_size;
+		rhmap_grow_inline(&map, &num, &new_size, count, 0.0);
+		void *data = Allocator->allocate(Allocator->user, new_size);
+		void *old_data = rhmap_rehash_inline(&map, num, new_size, data);
+		if (old_data) Allocator->free(Allocator->user, old_data, alloc_size);
+		alloc_size = new_size;
+		dict.reserve(num);
+	}
+
+	void clear() {
+		rhmap_clear_inline(&map);
+		dict.clear();
+	}
+
+	void reset() {
+		imp_free();
+		dict.reset();
+	}
+
+	Hash hash_function() const { return hash_fn; }
+
+protected:
+	#if defined(__has_cpp_attribute) && __has_cpp_attribute(no_unique_address)
+		[[no_unique_address]] Hash hash_fn;
+	#else
+		Hash hash_fn;
+	#endif
+
+	rhmap map = { };
+	size_t alloc_size = 0;
+	array<T, Allocator> dict;
+
+	RHMAP_FORCEINLINE uint32_t imp_encode(const T &value, uint32_t hash) {
+		const T *vals = dict.data();
+		uint32_t scan = 0, code;
+		while (rhmap_find_inline(&map, hash, &scan, &code)) {
+			if (vals[code] == value) return code;
+		}
+		code = (uint32_t)dict.size();
+		dict.push_back(value);
+		rhmap_insert_inline(&map, hash, scan, code);
+		return code;
+	}
+
+	void imp_free() {
+		void *data = rhmap_reset_inline(&map);
+		if (data) Allocator->free(Allocator->user, data, alloc_size);
+		alloc_size = 0;
+	}
+};
+
+}
+
+#endif
@@ -0,0 +1,158 @@
+#ifndef RH_DIFF_H_INCLUDED
+#define RH_DIFF_H_INCLUDED
+
+#include "rh_hash.h"
+
+namespace rh {
+
+static const size_t diff_batch_size = 64;
+
+// Set of changes that transforms one `hash_map` into another, see `diff()` and `apply()`.
+template <typename K, typename V>
+struct delta {
+	array<kv_pair<K, V>> inserts;
+	array<kv_pair<K, V>> updates;
+	array<K> removes;
+
+	bool empty() const { return inserts.empty() && updates.empty() && removes.empty(); }
+	size_t size() const { return inserts.size() + updates.size() + removes.size(); }
+
+	void clear() {
+		inserts.clear();
+		updates.clear();
+		removes.clear();
+	}
+
+	bool save(writer &w) const { return inserts.save(w) && updates.save(w) && removes.save(w); }
+	bool load(reader &r) { return inserts.load(r) && updates.load(r) && removes.load(r); }
+};
+
+template <typename K, typename V, typename Hash, const allocator *Allocator>
+void imp_diff_lookup(delta<K, V> &result, const hash_map<K, V, Hash, Allocator> &old_map, const hash_map<K, V, Hash, Allocator> &new_map) {
+	for (const kv_pair<K, V> &pair : new_map) {
+		const kv_pair<K, V> *old_pair = old_map.find(pair.key);
+		if (!old_pair) {
+			result.inserts.push_back(pair);
+		} else if (!(old_pair->value == pair.value)) {
+			result.updates.push_back(pair);
+		}
+	}
+	for (const kv_pair<K, V> &pair : old_map) {
+		if (!new_map.find(pair.key)) result.removes.push_back(pair.key);
+	}
+}
+
+// Compute the changes from `old_map` to `new_map`.
+// If both maps have the same capacity the tables are merged in slot order
+// without doing any lookups, otherwise each key is looked up from the other map.
+template <typename K, typename V, typename Hash, const allocator *Allocator>
+void diff(delta<K, V> &result, const hash_map<K, V, Hash, Allocator> &old_map, const hash_map<K, V, Hash, Allocator> &new_map) {
+	result.clear();
+	const rhmap &old_index = old_map.raw_map(), &new_index = new_map.raw_map();
+	if (old_index.mask != new_index.mask) {
+		imp_diff_lookup(result, old_map, new_map);
+		return;
+	}
+
+	const kv_pair<K, V> *old_vals = old_map.begin(), *new_vals = new_map.begin();
+	slot_order_cursor old_cursor(old_index), new_cursor(new_index);
+	uint32_t old_hash = 0, old_value = 0, old_slot = 0, new_hash = 0, new_value = 0, new_slot = 0;
+	bool has_old = old_cursor.next(&old_hash, &old_value, &old_slot);
+	bool has_new = new_cursor.next(&new_hash, &new_value, &new_slot);
+
+	// Entries sharing a home slot can appear in any order, collect them as (hash, value) pairs
+	array<uint64_t> old_group, new_group;
+	while (has_old || has_new) {
+		if (!has_new || (has_old && old_slot < new_slot)) {
+			result.removes.push_back(old_vals[old_value].key);
+			has_old = old_cursor.next(&old_hash, &old_value, &old_slot);
+			continue;
+		}
+		if (!has_old || new_slot < old_slot) {
+			result.inserts.push_back(new_vals[new_value]);
+			has_new = new_cursor.next(&new_hash, &new_value, &new_slot);
+			continue;
+		}
+
+		uint32_t slot = old_slot;
+		old_group.clear();
+		new_group.clear();
+		while (has_old && old_slot == slot) {
+			old_group.push_back((uint64_t)old_hash << 32u | old_value);
+			has_old = old_cursor.next(&old_hash, &old_value, &old_slot);
+		}
+		while (has_new && new_slot == slot) {
+			new_group.push_back((uint64_t)new_hash << 32u | new_value);
+			has_new = new_cursor.next(&new_hash, &new_value, &new_slot);
+		}
+
+		for (uint64_t new_ref : new_group) {
+			const kv_pair<K, V> &pair = new_vals[(uint32_t)new_ref];
+			bool found = false;
+			for (uint64_t &old_ref : old_group) {
+				if (old_ref == UINT64_MAX || (old_ref >> 32u) != (new_ref >> 32u)) continue;
+				const kv_pair<K, V> &old_pair = old_vals[(uint32_t)old_ref];
+				if (!(old_pair.key == pair.key)) continue;
+				if (!(old_pair.value == pair.value)) result.updates.push_back(pair);
+				old_ref = UINT64_MAX;
+				found = true;
+				break;
+			}
+			if (!found) result.inserts.push_back(pair);
+		}
+		for (uint64_t old_ref : old_group) {
+			if (old_ref != UINT64_MAX) result.removes.push_back(old_vals[(uint32_t)old_ref].key);
+		}
+	}
+}
+
+template <typename K, typename V, typename Hash, const allocator *Allocator>
+delta<K, V> diff(const hash_map<K, V, Hash, Allocator> &old_map, const hash_map<K, V, Hash, Allocator> &new_map) {
+	delta<K, V> result;
+	diff(result, old_map, new_map);
+	return result;
+}
+
+// Insert or overwrite `pairs` in batches: hash the whole batch, prefetch the
+// home slots and then insert with the precomputed hashes.
+template <typename K, typename V, typename Hash, const allocator *Allocator>
+void imp_apply_pairs(hash_map<K, V, Hash, Allocator> &map, const kv_pair<K, V> *pairs, size_t count) {
+	uint32_t hashes[diff_batch_size];
+	Hash hash_fn = map.hash_function();
+	const rhmap &index = map.raw_map();
+	for (size_t base = 0; base < count; base += diff_batch_size) {
+		size_t num = count - base < diff_batch_size ? count - base : diff_batch_size;
+		const kv_pair<K, V> *batch = pairs + base;
+		for (size_t i = 0; i < num; i++) hashes[i] = hash_fn(batch[i].key);
+		for (size_t i = 0; i < num; i++) rhmap_prefetch_inline(&index, hashes[i]);
+		for (size_t i = 0; i < num; i++) {
+			auto result = map.emplace_hashed(batch[i].key, hashes[i], batch[i].value);
+			if (!result.inserted) result.entry->value = batch[i].value;
+		}
+	}
+}
+
+// Apply changes computed by `diff()`, space for all the inserts is reserved up front.
+// Removes, updates and inserts are each looked up in prefetched batches.
+template <typename K, typename V, typename Hash, const allocator *Allocator>
+void apply(hash_map<K, V, Hash, Allocator> &map, const delta<K, V> &changes) {
+	uint32_t hashes[diff_batch_size];
+	Hash hash_fn = map.hash_function();
+	const rhmap &index = map.raw_map();
+	const K *removes = changes.removes.begin();
+	for (size_t base = 0; base < changes.removes.size(); base += diff_batch_size) {
+		size_t num = changes.removes.size() - base < diff_batch_size ? changes.removes.size() - base : diff_batch_size;
+		const K *batch = removes + base;
+		for (size_t i = 0; i < num; i++) hashes[i] = hash_fn(batch[i]);
+		for (size_t i = 0; i < num; i++) rhmap_prefetch_inline(&index, hashes[i]);
+		for (size_t i = 0; i < num; i++) {
+			if (auto pos = map.find_hashed(batch[i], hashes[i])) map.remove(pos);
+		}
+	}
+	map.reserve(map.size() + changes.inserts.size());
+	imp_apply_pairs(map, changes.updates.begin(), changes.updates.size());
+	imp_apply_pairs(map, changes.inserts.begin(), changes.inserts.size());
+}
+}
+
+#endif
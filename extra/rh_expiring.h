@@ -0,0 +1,268 @@
+#ifndef RH_EXPIRING_H_INCLUDED
+#define RH_EXPIRING_H_INCLUDED
+
+#include "rh_hash.h"
+
+#if defined(_MSC_VER)
+	#include <intrin.h>
+#endif
+
+namespace rh {
+
+static RHMAP_FORCEINLINE uint32_t bit_scan_forward(uint64_t mask) {
+	RHMAP_ASSERT(mask != 0);
+#if defined(_MSC_VER) && defined(_M_X64)
+	unsigned long index;
+	_BitScanForward64(&index, mask);
+	return (uint32_t)index;
+#elif defined(__GNUC__) || defined(__clang__)
+	return (uint32_t)__builtin_ctzll(mask);
+#else
+	uint32_t index = 0;
+	while (!(mask & 1)) { mask >>= 1; index++; }
+	return index;
+#endif
+}
+
+static RHMAP_FORCEINLINE uint32_t bit_scan_reverse(uint64_t mask) {
+	RHMAP_ASSERT(mask != 0);
+#if defined(_MSC_VER) && defined(_M_X64)
+	unsigned long index;
+	_BitScanReverse64(&index, mask);
+	return (uint32_t)index;
+#elif defined(__GNUC__) || defined(__clang__)
+	return 63u - (uint32_t)__builtin_clzll(mask);
+#else
+	uint32_t index = 0;
+	while (mask >>= 1) index++;
+	return index;
+#endif
+}
+
+// Value stored in the `expiring_map` map, linked into a timer wheel slot.
+template <typename V>
+struct expiring_node {
+	V value;
+	uint64_t deadline;
+	uint32_t prev;
+	uint32_t next;
+	uint32_t slot;
+
+	bool operator==(const expiring_node &rhs) const { return value == rhs.value && deadline == rhs.deadline; }
+	bool operator!=(const expiring_node &rhs) const { return !(*this == rhs); }
+};
+
+// Map where every entry has a deadline, expired entries are removed by `advance()`.
+// Time is an arbitrary monotonic 64-bit tick count (eg. milliseconds) chosen by the user.
+// Deadlines are kept in a hierarchical timer wheel of 64-slot levels, level `L`
+// slots span 64^L ticks. Slots are intrusive lists through the dense values array
+// and every level has an occupancy bitmask, so `advance()` jumps directly to the
+// next occupied slot and only touches entries that expire or cascade to a finer level.
+// Entries past their deadline are hidden from `find()` even before `advance()`.
+template <typename K, typename V
+	, typename Hash = default_hash<K>
+	, const allocator *Allocator=&stdlib_allocator>
+struct expiring_map
+{
+	using map_type = hash_map<K, expiring_node<V>, Hash, Allocator>;
+	static const uint32_t nil = UINT32_MAX;
+	static const uint32_t num_levels = 11; // 11 * 6 bits covers the whole 64-bit range
+
+	explicit expiring_map(uint64_t now=0, const Hash &hash_fn=Hash())
+		: entries(hash_fn), current(now) {
+		for (uint32_t &head : heads) head = nil;
+		for (uint64_t &mask : masks) mask = 0;
+	}
+
+	// Insert or overwrite an entry expiring at `deadline`.
+	V &put(const K &key, const V &value, uint64_t deadline) {
+		auto result = entries.emplace(key, expiring_node<V>{ value, deadline, nil, nil, nil });
+		uint32_t index = (uint32_t)(result.entry - entries.begin());
+		if (!result.inserted) {
+			result.entry->value.value = value;
+			result.entry->value.deadline = deadline;
+			imp_unlink(index);
+		}
+		imp_link(index);
+		return result.entry->value.value;
+	}
+
+	// Find or insert the entry of `key` with a single lookup and update it in place.
+	// `fn(V &value, bool inserted)` returns the new deadline, expired entries are
+	// reset to a value-initialized `V` and passed as inserted.
+	template <typename Fn>
+	V &update(const K &key, Fn &&fn) {
+		return imp_update(entries.emplace(key, expiring_node<V>{ V(), current, nil, nil, nil }), fn);
+	}
+
+	// Same as `update()` with a precomputed `hash`, which must equal `map().hash_function()(key)`.
+	template <typename Fn>
+	V &update_hashed(const K &key, uint32_t hash, Fn &&fn) {
+		return imp_update(entries.emplace_hashed(key, hash, expiring_node<V>{ V(), current, nil, nil, nil }), fn);
+	}
+
+	// Change the deadline of an existing entry, returns false if not found or expired.
+	bool expire_at(const K &key, uint64_t deadline) {
+		auto *pair = entries.find(key);
+		if (!pair || pair->value.deadline <= current) return false;
+		uint32_t index = (uint32_t)(pair - entries.begin());
+		imp_unlink(index);
+		pair->value.deadline = deadline;
+		imp_link(index);
+		return true;
+	}
+
+	V *find(const K &key) {
+		auto *pair = entries.find(key);
+		return pair && pair->value.deadline > current ? &pair->value.value : nullptr;
+	}
+
+	const V *find(const K &key) const {
+		auto *pair = entries.find(key);
+		return pair && pair->value.deadline > current ? &pair->value.value : nullptr;
+	}
+
+	bool remove(const K &key) {
+		auto *pair = entries.find(key);
+		if (!pair) return false;
+		imp_remove((uint32_t)(pair - entries.begin()));
+		return true;
+	}
+
+	// Advance the time to `now` removing every entry with `deadline <= now`.
+	// `on_expire(const K &key, V &value)` is called for each entry before it's removed.
+	// Returns the number of removed entries.
+	template <typename Fn>
+	size_t advance(uint64_t now, Fn &&on_expire) {
+		size_t removed = 0;
+		if (now < current) return 0;
+		for (;;) {
+			// Level 0 slots are single ticks of the current 64-tick window
+			uint64_t window_end = current | 63u;
+			uint64_t limit = now < window_end ? now : window_end;
+			uint64_t range = (~(uint64_t)0 >> (63u - (uint32_t)(limit & 63u))) & (~(uint64_t)0 << (current & 63u));
+			uint64_t expired = masks[0] & range;
+			while (expired) {
+				uint32_t slot = bit_scan_forward(expired);
+				expired &= expired - 1;
+				while (heads[slot] != nil) {
+					uint32_t index = heads[slot];
+					kv_pair<K, expiring_node<V>> &pair = entries.begin()[index];
+					on_expire((const K&)pair.key, pair.value.value);
+					imp_remove(index);
+					removed++;
+				}
+			}
+			if (now <= window_end) break;
+
+			// Level 0 is empty now, find the next occupied slot from the coarser levels
+			uint32_t level = 1;
+			while (level < num_levels && masks[level] == 0) level++;
+			if (level == num_levels) break;
+			uint32_t shift = level * 6;
+			uint64_t base = shift + 6 >= 64 ? 0 : current & ~((UINT64_C(1) << (shift + 6)) - 1);
+			uint32_t slot = bit_scan_forward(masks[level]);
+			uint64_t next = base + ((uint64_t)slot << shift);
+			if (next > now) break;
+
+			// Move to the start of the slot and cascade its entries to finer levels
+			current = next;
+			uint32_t list = level * 64 + slot;
+			while (heads[list] != nil) {
+				uint32_t index = heads[list];
+				imp_unlink(index);
+				imp_link(index);
+			}
+		}
+		current = now;
+		return removed;
+	}
+
+	size_t advance(uint64_t now) {
+		return advance(now, [](const K &, V &) { });
+	}
+
+	uint64_t now() const noexcept { return current; }
+
+	// Number of entries including expired ones not yet removed by `advance()`.
+	size_t size() const noexcept { return entries.size(); }
+	bool empty() const noexcept { return entries.size() == 0; }
+
+	void clear() {
+		entries.clear();
+		for (uint32_t &head : heads) head = nil;
+		for (uint64_t &mask : masks) mask = 0;
+	}
+
+	const map_type &map() const noexcept { return entries; }
+
+protected:
+	map_type entries;
+	uint64_t current;
+	uint32_t heads[num_levels * 64];
+	uint64_t masks[num_levels];
+
+	RHMAP_FORCEINLINE expiring_node<V> &imp_node(uint32_t index) {
+		return entries.begin()[index].value;
+	}
+
+	template <typename Fn>
+	V &imp_update(insert_result<typename map_type::value_type> result, Fn &&fn) {
+		uint32_t index = (uint32_t)(result.entry - entries.begin());
+		expiring_node<V> &node = result.entry->value;
+		bool inserted = result.inserted;
+		if (!inserted && node.deadline <= current) {
+			node.value = V();
+			inserted = true;
+		}
+		uint64_t deadline = fn(node.value, inserted);
+		if (!result.inserted) {
+			if (deadline == node.deadline) return node.value;
+			imp_unlink(index);
+		}
+		node.deadline = deadline;
+		imp_link(index);
+		return node.value;
+	}
+
+	// Place the entry at the finest level where its deadline shares all the higher bits with `current`.
+	void imp_link(uint32_t index) {
+		expiring_node<V> &node = imp_node(index);
+		uint64_t deadline = node.deadline > current ? node.deadline : current;
+		uint64_t diff = deadline ^ current;
+		uint32_t level = diff < 64 ? 0 : bit_scan_reverse(diff) / 6;
+		uint32_t slot = (uint32_t)(deadline >> (level * 6)) & 63u;
+		uint32_t list = level * 64 + slot;
+		node.slot = list;
+		node.prev = nil;
+		node.next = heads[list];
+		if (node.next != nil) imp_node(node.next).prev = index;
+		heads[list] = index;
+		masks[level] |= UINT64_C(1) << slot;
+	}
+
+	void imp_unlink(uint32_t index) {
+		expiring_node<V> &node = imp_node(index);
+		uint32_t list = node.slot;
+		if (node.prev != nil) imp_node(node.prev).next = node.next; else heads[list] = node.next;
+		if (node.next != nil) imp_node(node.next).prev = node.prev;
+		if (heads[list] == nil) masks[list / 64] &= ~(UINT64_C(1) << (list % 64));
+	}
+
+	void imp_remove(uint32_t index) {
+		imp_unlink(index);
+
+		// The last entry is swapped into `index`, redirect its neighbors
+		uint32_t last = (uint32_t)entries.size() - 1;
+		if (index != last) {
+			expiring_node<V> &moved = imp_node(last);
+			if (moved.prev != nil) imp_node(moved.prev).next = index; else heads[moved.slot] = index;
+			if (moved.next != nil) imp_node(moved.next).prev = index;
+		}
+		entries.remove(entries.begin() + index);
+	}
+};
+
+}
+
+#endif
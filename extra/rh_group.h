@@ -0,0 +1,207 @@
+#ifndef RH_GROUP_H_INCLUDED
+#define RH_GROUP_H_INCLUDED
+
+#include "rh_hash.h"
+
+#include <tuple>
+#include <limits>
+
+namespace rh {
+
+// Aggregates for `group_by`, each one defines its input column type, per-group
+// state and a batch update applied to a column using the resolved group ids.
+
+template <typename T>
+struct agg_sum {
+	using input_type = T;
+	using state_type = T;
+	static state_type init() { return T(); }
+	static void update(state_type *states, const uint32_t *ids, const input_type *values, size_t count) {
+		for (size_t i = 0; i < count; i++) states[ids[i]] += values[i];
+	}
+};
+
+// Counts rows, takes no input column (pass `nullptr`).
+struct agg_count {
+	using input_type = void;
+	using state_type = uint64_t;
+	static state_type init() { return 0; }
+	static void update(state_type *states, const uint32_t *ids, const void *, size_t count) {
+		for (size_t i = 0; i < count; i++) states[ids[i]]++;
+	}
+};
+
+template <typename T>
+struct agg_min {
+	using input_type = T;
+	using state_type = T;
+	static state_type init() { return std::numeric_limits<T>::max(); }
+	static void update(state_type *states, const uint32_t *ids, const input_type *values, size_t count) {
+		for (size_t i = 0; i < count; i++) {
+			state_type &s = states[ids[i]];
+			if (values[i] < s) s = values[i];
+		}
+	}
+};
+
+template <typename T>
+struct agg_max {
+	using input_type = T;
+	using state_type = T;
+	static state_type init() { return std::numeric_limits<T>::lowest(); }
+	static void update(state_type *states, const uint32_t *ids, const input_type *values, size_t count) {
+		for (size_t i = 0; i < count; i++) {
+			state_type &s = states[ids[i]];
+			if (s < values[i]) s = values[i];
+		}
+	}
+};
+
+// Columnar hash aggregation. Each `add()` call processes rows in batches: the keys
+// are hashed in bulk, resolved to dense group ids with prefetched lookups into
+// an rhmap whose values are the group ids, and every aggregate then runs one
+// tight loop over its input column updating a dense state array.
+//   rh::group_by<uint32_t, rh::agg_sum<double>, rh::agg_count> g;
+//   g.add(user_ids, num_rows, amounts, nullptr);
+//   for (size_t i = 0; i < g.size(); i++) use(g.keys()[i], g.result<0>()[i], g.result<1>()[i]);
+// `basic_group_by` takes the key hash function before the aggregates.
+template <typename Key, typename Hash, typename... Aggs>
+struct basic_group_by
+{
+	static const size_t batch_size = 256;
+
+	explicit basic_group_by(const allocator *ator=&stdlib_allocator, const Hash &hash_fn=Hash())
+		: hash_fn(hash_fn), ator(ator) { }
+	~basic_group_by() { reset(); }
+
+	basic_group_by(const basic_group_by &) = delete;
+	basic_group_by &operator=(const basic_group_by &) = delete;
+
+	// Aggregate `count` rows, one input column per aggregate in order.
+	void add(const Key *keys, size_t count, const typename Aggs::input_type *... columns) {
+		uint32_t ids[batch_size];
+		for (size_t base = 0; base < count; base += batch_size) {
+			size_t num = count - base < batch_size ? count - base : batch_size;
+			imp_resolve(ids, keys + base, num);
+			imp_update(ids, base, num, std::index_sequence_for<Aggs...>(), columns...);
+		}
+	}
+
+	RHMAP_FORCEINLINE size_t size() const noexcept { return group_keys.size(); }
+	RHMAP_FORCEINLINE bool empty() const noexcept { return group_keys.empty(); }
+
+	// Group keys in order of first appearance, indexed by group id.
+	RHMAP_FORCEINLINE const Key *keys() const noexcept { return group_keys.data(); }
+
+	// Aggregate states of the `I`th aggregate, indexed by group id.
+	template <size_t I>
+	const typename std::tuple_element<I, std::tuple<Aggs...>>::type::state_type *result() const noexcept {
+		return std::get<I>(states).data();
+	}
+
+	// Return the group id of `key` or `UINT32_MAX` if there is no such group.
+	uint32_t find(const Key &key) const {
+		uint32_t hash = const_cast<Hash&>(hash_fn)(key), scan = 0, id;
+		while (rhmap_find_inline(&map, hash, &scan, &id)) {
+			if (group_keys[id] == key) return id;
+		}
+		return UINT32_MAX;
+	}
+
+	void reserve(size_t count) {
+		if (count <= map.capacity) return;
+		size_t num, alloc_size;
+		rhmap_grow_inline(&map, &num, &alloc_size, count, 0.0);
+		void *old_data = rhmap_rehash_inline(&map, num, alloc_size, ator->allocate(ator->user, alloc_size));
+		if (old_data) ator->free(ator->user, old_data, imp_alloc_size);
+		imp_alloc_size = alloc_size;
+		group_keys.reserve(num);
+	}
+
+	void clear() {
+		rhmap_clear_inline(&map);
+		group_keys.clear();
+		imp_clear_states(std::index_sequence_for<Aggs...>());
+	}
+
+	void reset() {
+		void *data = rhmap_reset_inline(&map);
+		if (imp_alloc_size) ator->free(ator->user, data, imp_alloc_size);
+		imp_alloc_size = 0;
+		group_keys.reset();
+		imp_clear_states(std::index_sequence_for<Aggs...>());
+	}
+
+	Hash hash_function() const { return hash_fn; }
+
+protected:
+	#if defined(__has_cpp_attribute) && __has_cpp_attribute(no_unique_address)
+		[[no_unique_address]] Hash hash_fn;
+	#else
+		Hash hash_fn;
+	#endif
+
+	const allocator *ator;
+	rhmap map = { };
+	size_t imp_alloc_size = 0;
+	array<Key> group_keys;
+	std::tuple<array<typename Aggs::state_type>...> states;
+
+	void imp_resolve(uint32_t *ids, const Key *keys, size_t count) {
+		uint32_t hashes[batch_size];
+		for (size_t i = 0; i < count; i++) hashes[i] = hash_fn(keys[i]);
+
+		// Make room for the whole batch so that the index can't move while resolving
+		if (map.capacity - map.size < count) reserve(map.size + count);
+		for (size_t i = 0; i < count; i++) rhmap_prefetch_inline(&map, hashes[i]);
+
+		const Key *group = group_keys.data();
+		for (size_t i = 0; i < count; i++) {
+			uint32_t hash = hashes[i], scan = 0, id;
+			bool found = false;
+			while (rhmap_find_inline(&map, hash, &scan, &id)) {
+				if (group[id] == keys[i]) {
+					found = true;
+					break;
+				}
+			}
+			if (!found) {
+				id = map.size;
+				rhmap_insert_inline(&map, hash, scan, id);
+				group_keys.push_back(keys[i]);
+				group = group_keys.data();
+				imp_push_states(std::index_sequence_for<Aggs...>());
+			}
+			ids[i] = id;
+		}
+	}
+
+	template <typename T>
+	static RHMAP_FORCEINLINE const T *imp_offset(const T *column, size_t base) { return column ? column + base : nullptr; }
+	static RHMAP_FORCEINLINE const void *imp_offset(const void *column, size_t) { return column; }
+
+	template <size_t... Is>
+	void imp_push_states(std::index_sequence<Is...>) {
+		int dummy[] = { 0, (std::get<Is>(states).push_back(Aggs::init()), 0)... };
+		(void)dummy;
+	}
+
+	template <size_t... Is>
+	void imp_clear_states(std::index_sequence<Is...>) {
+		int dummy[] = { 0, (std::get<Is>(states).clear(), 0)... };
+		(void)dummy;
+	}
+
+	template <size_t... Is>
+	void imp_update(const uint32_t *ids, size_t base, size_t count, std::index_sequence<Is...>, const typename Aggs::input_type *... columns) {
+		int dummy[] = { 0, (Aggs::update(std::get<Is>(states).data(), ids, imp_offset(columns, base), count), 0)... };
+		(void)dummy;
+	}
+};
+
+template <typename Key, typename... Aggs>
+using group_by = basic_group_by<Key, default_hash<Key>, Aggs...>;
+
+}
+
+#endif
@@ -0,0 +1,218 @@
+#ifndef RH_GROUPED_H_INCLUDED
+#define RH_GROUPED_H_INCLUDED
+
+#include "rh_hash.h"
+
+namespace rh {
+
+template <typename V>
+struct grouped_range {
+	const V *first = nullptr;
+	const V *last = nullptr;
+
+	RHMAP_FORCEINLINE const V *begin() const noexcept { return first; }
+	RHMAP_FORCEINLINE const V *end() const noexcept { return last; }
+	RHMAP_FORCEINLINE size_t size() const noexcept { return (size_t)(last - first); }
+	RHMAP_FORCEINLINE bool empty() const noexcept { return first == last; }
+	RHMAP_FORCEINLINE const V &operator[](size_t index) const { RHMAP_ASSERT(index < size()); return first[index]; }
+};
+
+struct grouped_group {
+	uint32_t head = UINT32_MAX;
+	uint32_t tail = UINT32_MAX;
+	uint32_t count = 0;
+	uint32_t end = 0;  // Offset of the next value in the tail chunk
+	uint32_t left = 0; // Free values in the tail chunk
+
+	bool operator==(const grouped_group &rhs) const { return head == rhs.head && tail == rhs.tail && count == rhs.count && end == rhs.end && left == rhs.left; }
+	bool operator!=(const grouped_group &rhs) const { return !(*this == rhs); }
+};
+
+// Chunks other than the tail of their group are always full.
+struct grouped_chunk {
+	uint32_t next;
+	uint32_t offset;
+	uint32_t capacity;
+
+	bool operator==(const grouped_chunk &rhs) const { return next == rhs.next && offset == rhs.offset && capacity == rhs.capacity; }
+	bool operator!=(const grouped_chunk &rhs) const { return !(*this == rhs); }
+};
+
+// Map from keys to multiple values without a separate allocation per key.
+// Values are appended into one shared arena in chunks chained per key, the
+// chunk capacity doubling per key from `min_chunk` up to `max_chunk` values.
+// `freeze()` compacts the arena so that each key owns a single contiguous
+// range in key order (CSR layout), after which `find()` returns the values
+// as one contiguous span. Adding values after freezing is allowed and starts
+// new chunks, reading ranges requires freezing again.
+template <typename K, typename V
+	, typename Hash = default_hash<K>
+	, const allocator *Allocator=&stdlib_allocator>
+struct grouped_map
+{
+	static const uint32_t min_chunk = sizeof(V) >= 16 ? 4 : (uint32_t)(64 / sizeof(V));
+	static const uint32_t max_chunk = 256;
+
+	explicit grouped_map(const Hash &hash_fn=Hash()) : groups(hash_fn) { }
+
+	void add(const K &key, const V &value) {
+		grouped_group &group = groups[key];
+		if (group.left == 0) imp_new_chunk(group);
+		values.data()[group.end++] = value;
+		group.left--;
+		group.count++;
+		value_count++;
+		is_frozen = false;
+	}
+
+	void add(const K &key, const V *data, size_t count) {
+		if (count == 0) return;
+		grouped_group &group = groups[key];
+		while (count > 0) {
+			if (group.left == 0) imp_new_chunk(group);
+			uint32_t num = group.left < count ? group.left : (uint32_t)count;
+			V *dst = values.data() + group.end;
+			for (uint32_t i = 0; i < num; i++) dst[i] = data[i];
+			group.end += num;
+			group.left -= num;
+			group.count += num;
+			value_count += num;
+			data += num;
+			count -= num;
+		}
+		is_frozen = false;
+	}
+
+	// Compact the values into one contiguous range per key, ordered like the keys.
+	void freeze() {
+		if (is_frozen) return;
+		array<V, Allocator> packed;
+		array<grouped_chunk, Allocator> packed_chunks;
+		packed.resize(value_count);
+		packed_chunks.reserve(groups.size());
+
+		const grouped_chunk *cs = chunks.data();
+		V *src = values.data(), *dst = packed.data();
+		uint32_t offset = 0;
+		for (auto &pair : groups) {
+			grouped_group &group = pair.value;
+			for (uint32_t ix = group.head; ix != UINT32_MAX; ix = cs[ix].next) {
+				uint32_t size = imp_chunk_size(group, ix);
+				V *chunk = src + cs[ix].offset;
+				for (uint32_t i = 0; i < size; i++) *dst++ = std::move(chunk[i]);
+			}
+			group.head = group.tail = (uint32_t)packed_chunks.size();
+			packed_chunks.push_back(grouped_chunk{ UINT32_MAX, offset, group.count });
+			offset += group.count;
+			group.end = offset;
+			group.left = 0;
+		}
+
+		values = std::move(packed);
+		chunks = std::move(packed_chunks);
+		is_frozen = true;
+	}
+
+	bool frozen() const noexcept { return is_frozen; }
+
+	// Values of `key` as a contiguous range, empty if not found. Requires `freeze()`.
+	grouped_range<V> find(const K &key) const {
+		RHMAP_ASSERT(is_frozen);
+		grouped_range<V> result;
+		if (auto pair = groups.find(key)) result = imp_range(pair->value);
+		return result;
+	}
+
+	// Call `fn(const V&)` for every value of `key` in insertion order, works without freezing.
+	template <typename Fn>
+	void for_each(const K &key, Fn &&fn) const {
+		auto pair = groups.find(key);
+		if (!pair) return;
+		const grouped_group &group = pair->value;
+		const grouped_chunk *cs = chunks.data();
+		const V *vals = values.data();
+		for (uint32_t ix = group.head; ix != UINT32_MAX; ix = cs[ix].next) {
+			uint32_t size = imp_chunk_size(group, ix);
+			const V *chunk = vals + cs[ix].offset;
+			for (uint32_t i = 0; i < size; i++) fn(chunk[i]);
+		}
+	}
+
+	bool contains(const K &key) const { return groups.find(key) != nullptr; }
+
+	// Keys in a dense array, `values_at(index)` requires `freeze()`.
+	const K &key_at(size_t index) const { RHMAP_ASSERT(index < groups.size()); return groups.begin()[index].key; }
+	grouped_range<V> values_at(size_t index) const {
+		RHMAP_ASSERT(is_frozen && index < groups.size());
+		return imp_range(groups.begin()[index].value);
+	}
+
+	void reserve(size_t num_keys, size_t num_values) {
+		groups.reserve(num_keys);
+		values.reserve(num_values);
+	}
+
+	void clear() {
+		groups.clear();
+		chunks.clear();
+		values.clear();
+		value_count = 0;
+		is_frozen = true;
+	}
+
+	void reset() {
+		groups.reset();
+		chunks.reset();
+		values.reset();
+		value_count = 0;
+		is_frozen = true;
+	}
+
+	size_t size() const noexcept { return groups.size(); }
+	size_t num_values() const noexcept { return value_count; }
+	const hash_map<K, grouped_group, Hash, Allocator> &map() const noexcept { return groups; }
+
+protected:
+	hash_map<K, grouped_group, Hash, Allocator> groups;
+	array<grouped_chunk, Allocator> chunks;
+	array<V, Allocator> values;
+	size_t value_count = 0;
+	bool is_frozen = true;
+
+	RHMAP_FORCEINLINE uint32_t imp_chunk_size(const grouped_group &group, uint32_t index) const {
+		const grouped_chunk &chunk = chunks.data()[index];
+		return index == group.tail ? chunk.capacity - group.left : chunk.capacity;
+	}
+
+	grouped_range<V> imp_range(const grouped_group &group) const {
+		grouped_range<V> result;
+		result.first = values.data() + chunks.data()[group.head].offset;
+		result.last = result.first + group.count;
+		return result;
+	}
+
+	// Append a new tail chunk to `group`, the previous tail must be full.
+	void imp_new_chunk(grouped_group &group) {
+		uint32_t capacity = min_chunk;
+		if (group.tail != UINT32_MAX) {
+			capacity = chunks.data()[group.tail].capacity * 2;
+			if (capacity > max_chunk) capacity = max_chunk;
+			if (capacity < min_chunk) capacity = min_chunk;
+		}
+
+		uint32_t index = (uint32_t)chunks.size();
+		uint32_t offset = (uint32_t)values.size();
+		RHMAP_ASSERT((uint64_t)offset + capacity < UINT32_MAX);
+		values.resize(offset + capacity);
+		chunks.push_back(grouped_chunk{ UINT32_MAX, offset, capacity });
+		if (group.tail != UINT32_MAX) chunks.data()[group.tail].next = index;
+		else group.head = index;
+		group.tail = index;
+		group.end = offset;
+		group.left = capacity;
+	}
+};
+
+}
+
+#endif
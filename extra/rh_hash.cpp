@@ -10,6 +10,42 @@ const allocator stdlib_allocator = {
 	[](void *user, void *ptr, size_t size) { ::free(ptr); },
 };
 
+writer file_writer(FILE *file)
+{
+	writer w;
+	w.user = file;
+	w.write = [](void *user, const void *data, size_t size) {
+		return fwrite(data, 1, size, (FILE*)user) == size;
+	};
+	return w;
+}
+
+reader file_reader(FILE *file)
+{
+	reader r;
+	r.user = file;
+	r.read = [](void *user, void *data, size_t size) {
+		return fread(data, 1, size, (FILE*)user) == size;
+	};
+	return r;
+}
+
+static const uint32_t array_magic = 0x72617272; // 'rarr'
+static const uint32_t hash_magic = 0x72686d70; // 'rhmp'
+static const uint32_t serialize_version = 1;
+
+struct array_header {
+	uint32_t magic, version;
+	uint32_t value_size;
+	uint32_t size;
+};
+
+struct hash_header {
+	uint32_t magic, version;
+	uint32_t value_size;
+	uint32_t size, capacity, mask;
+};
+
 uint32_t hash_buffer(const void *data, size_t size)
 {
 	uint32_t hash = 0;
@@ -48,6 +84,32 @@ uint32_t hash_buffer_align4(const void *data, size_t size)
 	return (uint32_t)hash;
 }
 
+uint32_t hash_buffer_unaligned(const void *data, size_t size)
+{
+	uint32_t hash = 0;
+
+	const uint32_t seed = UINT32_C(0x9e3779b9);
+	const uint8_t *byte = (const uint8_t*)data;
+	while (size >= 4) {
+		uint32_t word;
+		memcpy(&word, byte, sizeof(word));
+		hash = ((hash << 5u | hash >> 27u) ^ word) * seed;
+		byte += 4;
+		size -= 4;
+	}
+
+	if (size > 0) {
+		uint32_t w = 0;
+		while (size > 0) {
+			w = w << 8 | *byte++;
+			size--;
+		}
+		hash = ((hash << 5u | hash >> 27u) ^ w) * seed;
+	}
+
+	return (uint32_t)hash;
+}
+
 uint32_t hash(uint32_t v)
 {
 	v ^= v >> 16;
@@ -70,12 +132,12 @@ uint32_t hash(uint64_t v)
 
 void trivial_copy_range(void *dst, const void *src, size_t count, size_t size)
 {
-	memcpy(dst, src, count * size);
+	if (count > 0) memcpy(dst, src, count * size);
 }
 
 void trivial_move_range(void *dst, void *src, size_t count, size_t size)
 {
-	memcpy(dst, src, count * size);
+	if (count > 0) memcpy(dst, src, count * size);
 }
 
 void trivial_destruct_range(void *data, size_t count)
@@ -178,6 +240,27 @@ void array_base::imp_grow(size_t min_size)
 	imp_capacity = (uint32_t)new_capacity;
 }
 
+bool array_base::imp_save(writer &w, save_range_fn *save_fn) const
+{
+	array_header header = { array_magic, serialize_version, (uint32_t)type.size, imp_size };
+	if (!w.write(w.user, &header, sizeof(header))) return false;
+	return save_fn(w, values, imp_size);
+}
+
+bool array_base::imp_load(reader &r, load_range_fn *load_fn)
+{
+	array_header header;
+	if (!r.read(r.user, &header, sizeof(header))) return false;
+	if (header.magic != array_magic || header.version != serialize_version) return false;
+	if (header.value_size != type.size) return false;
+
+	clear();
+	reserve(header.size);
+	if (!load_fn(r, values, header.size)) return false;
+	imp_size = header.size;
+	return true;
+}
+
 hash_base::hash_base(const hash_base &rhs) : type(rhs.type), ator(rhs.ator)
 {
 	imp_copy(rhs);
@@ -208,9 +291,9 @@ hash_base &hash_base::operator=(hash_base &&rhs) noexcept
 	return *this;
 }
 
-void hash_base::reserve(size_t count)
+bool hash_base::reserve(size_t count)
 {
-	if (count > map.capacity) imp_grow(count);
+	return count <= map.capacity || imp_grow(count);
 }
 
 void hash_base::shrink_to_fit()
@@ -229,9 +312,49 @@ void hash_base::clear() noexcept
 void hash_base::reset()
 {
 	if (map.size > 0) type.destruct_range(values, map.size);
-	size_t old_size = rhmap_alloc_size_inline(&map) + map.capacity * type.size;
+	size_t alloc_size = rhmap_alloc_size_inline(&map);
+	size_t values_size = map.capacity * type.size;
 	void *old_data = rhmap_reset_inline(&map);
-	if (old_size) ator->free(ator->user, old_data, old_size);
+	if (ator->reallocate) {
+		if (alloc_size) ator->free(ator->user, old_data, alloc_size);
+		if (values_size) ator->free(ator->user, values, values_size);
+	} else {
+		if (alloc_size + values_size) ator->free(ator->user, old_data, alloc_size + values_size);
+	}
+	values = nullptr;
+}
+
+bool hash_base::raw_allocate(uint32_t mask, uint32_t capacity, uint64_t **p_entries, void **p_values)
+{
+	reset();
+	void *data, *new_values;
+	if (!imp_allocate_storage(((size_t)mask + 1) * sizeof(uint64_t), capacity, &data, &new_values)) return false;
+	values = new_values;
+	map.entries = (uint64_t*)data;
+	map.mask = mask;
+	map.capacity = capacity;
+	map.size = 0;
+	*p_entries = map.entries;
+	*p_values = values;
+	return true;
+}
+
+void hash_base::raw_commit(uint32_t size)
+{
+	RHMAP_ASSERT(size <= map.capacity);
+	map.size = size;
+}
+
+bool hash_base::raw_check_index(uint32_t size) const
+{
+	uint32_t mask = map.mask, count = 0;
+	for (uint32_t i = 0; i <= mask && mask != 0; i++) {
+		uint64_t entry = map.entries[i];
+		if (entry == 0) continue;
+		if ((entry & mask) == 0 || (uint32_t)(entry >> 32u) >= size) return false;
+		count++;
+	}
+	return count == size;
 }
 
 bool hash_base::operator==(const hash_base &rhs) const
@@ -241,22 +364,77 @@ bool hash_base::operator==(const hash_base &rhs) const
 	return type.equal_range(values, rhs.values, map.size);
 }
 
-void hash_base::imp_grow(size_t min_size) {
+bool hash_base::imp_grow(size_t min_size) {
 	size_t count, alloc_size;
 	if ((map.size | min_size) == 0) min_size = 64 / type.size;
 	rhmap_grow_inline(&map, &count, &alloc_size, min_size, 0);
-	imp_rehash(count, alloc_size);
+	return imp_rehash(count, alloc_size);
+}
+
+bool hash_base::imp_allocate_storage(size_t alloc_size, size_t count, void **p_data, void **p_values)
+{
+	size_t values_size = type.size * count;
+	if (ator->reallocate) {
+		*p_data = ator->allocate(ator->user, alloc_size);
+		if (!*p_data) return false;
+		*p_values = ator->allocate(ator->user, values_size);
+		if (!*p_values) {
+			ator->free(ator->user, *p_data, alloc_size);
+			return false;
+		}
+	} else {
+		*p_data = ator->allocate(ator->user, alloc_size + values_size);
+		if (!*p_data) return false;
+		*p_values = (char*)*p_data + alloc_size;
+	}
+	return true;
 }
 
-void hash_base::imp_rehash(size_t count, size_t alloc_size)
+bool hash_base::imp_rehash(size_t count, size_t alloc_size)
 {
+	if (ator->reallocate) return imp_rehash_split(count, alloc_size);
+
 	void *new_data = ator->allocate(ator->user, alloc_size + type.size * count);
+	if (!new_data) return false;
 	void *new_values = (char*)new_data + alloc_size;
 	type.move_range(new_values, values, map.size, type.size);
 	values = new_values;
 	size_t old_size = rhmap_alloc_size_inline(&map) + map.capacity * type.size;
 	void *old_data = rhmap_rehash_inline(&map, count, alloc_size, new_data);
 	if (old_size) ator->free(ator->user, old_data, old_size);
+	return true;
+}
+
+bool hash_base::imp_rehash_split(size_t count, size_t alloc_size)
+{
+	// Values are stored separately from the index so that they can be resized in place,
+	// eg. by extending a file mapping, instead of copying them to a new allocation.
+	// Both allocations are made before touching anything so a failure leaves the map intact.
+	void *new_data = ator->allocate(ator->user, alloc_size);
+	if (!new_data) return false;
+
+	size_t old_values_size = map.capacity * type.size;
+	size_t new_values_size = count * type.size;
+	void *new_values;
+	if (type.move_range == &trivial_move_range) {
+		new_values = ator->reallocate(ator->user, values, old_values_size, new_values_size);
+	} else {
+		new_values = ator->allocate(ator->user, new_values_size);
+		if (new_values) {
+			type.move_range(new_values, values, map.size, type.size);
+			if (old_values_size) ator->free(ator->user, values, old_values_size);
+		}
+	}
+	if (!new_values) {
+		ator->free(ator->user, new_data, alloc_size);
+		return false;
+	}
+	values = new_values;
+
+	size_t old_alloc_size = rhmap_alloc_size_inline(&map);
+	void *old_data = rhmap_rehash_inline(&map, count, alloc_size, new_data);
+	if (old_alloc_size) ator->free(ator->user, old_data, old_alloc_size);
+	return true;
 }
 
 void hash_base::imp_remove_last(uint32_t hash, uint32_t index)
@@ -276,12 +454,47 @@ void hash_base::imp_remove_swap(uint32_t hash, uint32_t index, uint32_t swap_has
 
 void hash_base::imp_copy(const hash_base &rhs)
 {
-	reserve(rhs.map.size);
+	// On allocation failure the destination is left empty
+	if (!reserve(rhs.map.size)) return;
 	type.copy_range(values, rhs.values, rhs.map.size, type.size);
-	uint32_t hash, scan, index;
-	while (rhmap_next_inline(&map, &hash, &scan, &index)) {
-		rhmap_insert_inline(&map, hash, scan, index);
+	uint32_t hash = 0, scan = 0, index;
+	while (rhmap_next_inline(&rhs.map, &hash, &scan, &index)) {
+		rhmap_insert_inline(&map, hash, 0, index);
+	}
+}
+
+bool hash_base::imp_save(writer &w, save_range_fn *save_fn) const
+{
+	hash_header header = { hash_magic, serialize_version, (uint32_t)type.size, map.size, map.capacity, map.mask };
+	if (!w.write(w.user, &header, sizeof(header))) return false;
+	if (!w.write(w.user, map.entries, rhmap_alloc_size_inline(&map))) return false;
+	return save_fn(w, values, map.size);
+}
+
+bool hash_base::imp_load(reader &r, load_range_fn *load_fn)
+{
+	hash_header header;
+	if (!r.read(r.user, &header, sizeof(header))) return false;
+	if (header.magic != hash_magic || header.version != serialize_version) return false;
+	if (header.value_size != type.size || header.size > header.capacity) return false;
+	if ((header.mask & (header.mask + 1)) != 0) return false;
+	if (header.mask != 0 && header.capacity > (uint64_t)header.mask + 1) return false;
+
+	reset();
+	if (header.mask == 0) return header.size == 0;
+
+	// Read the index directly to the new allocation, no need to re-insert anything
+	uint64_t *entries;
+	void *new_values;
+	if (!raw_allocate(header.mask, header.capacity, &entries, &new_values)) return false;
+	size_t alloc_size = ((size_t)header.mask + 1) * sizeof(uint64_t);
+	if (!r.read(r.user, entries, alloc_size) || !raw_check_index(header.size) || !load_fn(r, new_values, header.size)) {
+		reset();
+		return false;
 	}
+
+	raw_commit(header.size);
+	return true;
 }
 
 }
@@ -6,14 +6,19 @@
 
 #include <new>
 #include <utility>
+#include <functional>
 #include <type_traits>
 #include <string.h>
+#include <stdio.h>
 
 namespace rh {
 
 uint32_t hash_buffer(const void *data, size_t size);
 uint32_t hash_buffer_align4(const void *data, size_t size);
 
+// Same result as `hash_buffer_align4()` for data at any address.
+uint32_t hash_buffer_unaligned(const void *data, size_t size);
+
 uint32_t hash(uint32_t v);
 uint32_t hash(uint64_t v);
 
@@ -56,10 +61,32 @@ struct allocator {
 	void *user;
 	void *(*allocate)(void *user, size_t size) = 0;
 	void (*free)(void *user, void *ptr, size_t size) = 0;
+
+	// Optional: Resize an allocation preserving its contents, `ptr` may be NULL.
+	// If provided hash containers store their values in a separate allocation
+	// that is resized with this, see `mapped_allocator` in "rh_mapped.h".
+	// Returns NULL on failure leaving `ptr` intact. If any allocation fails while
+	// growing a hash container it's left unchanged, inserting returns a null entry,
+	// `reserve()` returns false and `operator[]` asserts.
+	void *(*reallocate)(void *user, void *ptr, size_t old_size, size_t new_size) = 0;
 };
 
 extern const allocator stdlib_allocator;
 
+struct writer {
+	void *user;
+	bool (*write)(void *user, const void *data, size_t size) = 0;
+};
+
+struct reader {
+	void *user;
+	// Must read exactly `size` bytes, return false on failure or end of stream.
+	bool (*read)(void *user, void *data, size_t size) = 0;
+};
+
+writer file_writer(FILE *file);
+reader file_reader(FILE *file);
+
 struct type_info {
 	size_t size;
 	void (*copy_range)(void *dst, const void *src, size_t count, size_t size);
@@ -116,6 +143,114 @@ type_info type_info_for<T>::info = {
 	&template_equal_range<T>,
 };
 
+// Serialization hook used by `save()` and `load()`. Trivially copyable types are
+// written as raw memory, other types need to specialize `serializer<T>` with:
+//   static bool save(writer &w, const T &value);
+//   static bool load(reader &r, T *dst); // Construct `dst` in place, leave it unconstructed on failure
+template <typename T, typename Enable=void>
+struct serializer;
+
+template <typename T>
+struct serializer<T, typename std::enable_if<std::is_trivially_copyable<T>::value>::type> {
+	static bool save(writer &w, const T &value) { return w.write(w.user, &value, sizeof(T)); }
+	static bool load(reader &r, T *dst) { return r.read(r.user, dst, sizeof(T)); }
+};
+
+template <typename T>
+inline bool imp_save_range(writer &w, const T *data, size_t count, std::true_type) {
+	return w.write(w.user, data, count * sizeof(T));
+}
+
+template <typename T>
+inline bool imp_save_range(writer &w, const T *data, size_t count, std::false_type) {
+	for (const T *ptr = data, *end = ptr + count; ptr != end; ptr++) {
+		if (!serializer<T>::save(w, *ptr)) return false;
+	}
+	return true;
+}
+
+template <typename T>
+inline bool imp_load_range(reader &r, T *data, size_t count, std::true_type) {
+	return r.read(r.user, data, count * sizeof(T));
+}
+
+template <typename T>
+inline bool imp_load_range(reader &r, T *data, size_t count, std::false_type) {
+	for (size_t i = 0; i < count; i++) {
+		if (!serializer<T>::load(r, data + i)) {
+			template_destruct_range<T>(data, i);
+			return false;
+		}
+	}
+	return true;
+}
+
+// Write `count` values, trivially copyable types are written in a single call.
+template <typename T>
+inline bool save_range(writer &w, const T *data, size_t count) {
+	return imp_save_range(w, data, count, std::is_trivially_copyable<T>());
+}
+
+// Construct `count` values in uninitialized `data`, on failure nothing is left constructed.
+template <typename T>
+inline bool load_range(reader &r, T *data, size_t count) {
+	return imp_load_range(r, data, count, std::is_trivially_copyable<T>());
+}
+
+template <typename T>
+bool save_range_untyped(writer &w, const void *data, size_t count) {
+	return save_range(w, (const T*)data, count);
+}
+
+template <typename T>
+bool load_range_untyped(reader &r, void *data, size_t count) {
+	return load_range(r, (T*)data, count);
+}
+
+typedef bool save_range_fn(writer &w, const void *data, size_t count);
+typedef bool load_range_fn(reader &r, void *data, size_t count);
+
+// Iterate the entries of an `rhmap` ordered by their home slot `hash & mask`.
+// Two maps with the same mask and hash function visit equal keys in the same
+// order, so they can be merged in a single pass without any lookups.
+struct slot_order_cursor
+{
+	explicit slot_order_cursor(const rhmap &map) : entries(map.entries), mask(map.mask) { }
+
+	// Returns the next entry, `*p_slot` receives the home slot of the entry.
+	bool next(uint32_t *p_hash, uint32_t *p_value, uint32_t *p_slot) {
+		if (!mask) return false;
+		for (;;) {
+			if (pos > mask) {
+				// Entries wrapped around from the end of the table come last
+				if (wrapped) return false;
+				wrapped = true;
+				pos = 0;
+			}
+			uint32_t slot = pos++;
+			uint64_t entry = entries[slot];
+			uint32_t scan = (uint32_t)entry & mask;
+			bool entry_wrapped = scan - 1 > slot;
+			if (wrapped && (entry == 0 || !entry_wrapped)) {
+				pos = mask + 1;
+				return false;
+			}
+			if (entry == 0 || entry_wrapped != wrapped) continue;
+			uint32_t home = (slot - (scan - 1)) & mask;
+			*p_hash = ((uint32_t)entry & ~mask) | home;
+			*p_value = (uint32_t)(entry >> 32u);
+			*p_slot = home;
+			return true;
+		}
+	}
+
+protected:
+	const uint64_t *entries;
+	uint32_t mask;
+	uint32_t pos = 0;
+	bool wrapped = false;
+};
+
 struct array_base
 {
 	array_base(type_info &type, const allocator *ator) : type(type), ator(ator) { }
@@ -153,6 +288,8 @@ protected:
 	const allocator *ator;
 
 	void imp_grow(size_t min_size);
+	bool imp_save(writer &w, save_range_fn *save_fn) const;
+	bool imp_load(reader &r, load_range_fn *load_fn);
 };
 
 template <typename T
@@ -189,6 +326,14 @@ struct array : array_base
 		new (&((value_type*)values)[imp_size++]) T(std::move(t));
 	}
 
+	void resize(size_t count) {
+		if (count > imp_capacity) imp_grow(count);
+		value_type *vals = (value_type*)values;
+		for (size_t i = count; i < imp_size; i++) vals[i].~T();
+		for (size_t i = imp_size; i < count; i++) new (&vals[i]) T();
+		imp_size = (uint32_t)count;
+	}
+
 	void pop_back() {
 		RHMAP_ASSERT(imp_size > 0);
 		((value_type*)values)[--imp_size].~T();
@@ -223,6 +368,12 @@ struct array : array_base
 	void remove(const_iterator pos) {
 		remove_at(pos - (value_type*)values);
 	}
+
+	// Write the array to `w`, see `serializer<T>` for non-trivially copyable types.
+	bool save(writer &w) const { return imp_save(w, &save_range_untyped<T>); }
+
+	// Replace the contents with an array written by `save()`, returns false on failure.
+	bool load(reader &r) { return imp_load(r, &load_range_untyped<T>); }
 };
 
 struct hash_base
@@ -244,7 +395,7 @@ struct hash_base
 	hash_base &operator=(const hash_base &rhs);
 	hash_base &operator=(hash_base &&rhs) noexcept;
 
-	void reserve(size_t count);
+	bool reserve(size_t count);
 	void shrink_to_fit();
 
 	void clear() noexcept;
@@ -253,17 +404,37 @@ struct hash_base
 	bool operator==(const hash_base &rhs) const;
 	RHMAP_FORCEINLINE bool operator!=(const hash_base &rhs) const { return !(*this == rhs); }
 
+	// Low-level access to the internal `rhmap`, the index values are positions in the value array.
+	RHMAP_FORCEINLINE const rhmap &raw_map() const noexcept { return map; }
+	RHMAP_FORCEINLINE const void *raw_values() const noexcept { return values; }
+	RHMAP_FORCEINLINE size_t raw_value_size() const noexcept { return type.size; }
+
+	// Low-level: Discard the contents and allocate uninitialized storage for an index of `mask + 1`
+	// entries and `capacity` values. Fill in the index and construct the values through the returned
+	// pointers, then call `raw_commit()` with the number of values or `reset()` to abandon it.
+	// Returns false if the allocation fails, leaving the container empty.
+	bool raw_allocate(uint32_t mask, uint32_t capacity, uint64_t **p_entries, void **p_values);
+	void raw_commit(uint32_t size);
+
+	// Low-level: Check that the index filled in after `raw_allocate()` has exactly `size`
+	// entries that all refer to values below `size`, so lookups stay in bounds.
+	bool raw_check_index(uint32_t size) const;
+
 protected:
 	rhmap map = { };
 	void *values = nullptr;
 	type_info &type;
 	const allocator *ator;
 
-	void imp_grow(size_t min_size);
-	void imp_rehash(size_t count, size_t alloc_size);
+	bool imp_grow(size_t min_size);
+	bool imp_rehash(size_t count, size_t alloc_size);
+	bool imp_rehash_split(size_t count, size_t alloc_size);
+	bool imp_allocate_storage(size_t alloc_size, size_t count, void **p_data, void **p_values);
 	void imp_remove_last(uint32_t hash, uint32_t index);
 	void imp_remove_swap(uint32_t hash, uint32_t index, uint32_t swap_hash);
 	void imp_copy(const hash_base &rhs);
+	bool imp_save(writer &w, save_range_fn *save_fn) const;
+	bool imp_load(reader &r, load_range_fn *load_fn);
 };
 
 template <typename K, typename V>
@@ -275,6 +446,34 @@ struct kv_pair {
 	bool operator!=(const kv_pair &rhs) const { return !(*this == rhs); }
 };
 
+template <typename K, typename V>
+struct serializer<kv_pair<K, V>, typename std::enable_if<!std::is_trivially_copyable<kv_pair<K, V>>::value>::type> {
+	static bool save(writer &w, const kv_pair<K, V> &pair) {
+		return serializer<K>::save(w, pair.key) && serializer<V>::save(w, pair.value);
+	}
+	static bool load(reader &r, kv_pair<K, V> *dst) {
+		if (!serializer<K>::load(r, &dst->key)) return false;
+		if (!serializer<V>::load(r, &dst->value)) {
+			dst->key.~K();
+			return false;
+		}
+		return true;
+	}
+};
+
+template <typename T, const allocator *Allocator>
+struct serializer<array<T, Allocator>> {
+	static bool save(writer &w, const array<T, Allocator> &arr) { return arr.save(w); }
+	static bool load(reader &r, array<T, Allocator> *dst) {
+		new (dst) array<T, Allocator>();
+		if (!dst->load(r)) {
+			dst->~array();
+			return false;
+		}
+		return true;
+	}
+};
+
 template <typename T>
 struct insert_result {
 	T *entry;
@@ -330,9 +529,29 @@ struct hash_map : hash_base
 		return { it, inserted };
 	}
 
-	iterator find(const key_type &key) {
+	// Same as `emplace()` with a precomputed `hash`, which must equal `hash_function()(key)`.
+	template <typename... Args> insert_result<value_type> emplace_hashed(const key_type &key, uint32_t hash, Args&&... value) {
+		bool inserted = false;
+		iterator it = imp_insert_hashed(&inserted, hash, key, std::forward<Args>(value)...);
+		return { it, inserted };
+	}
+	template <typename... Args> insert_result<value_type> emplace_hashed(key_type &&key, uint32_t hash, Args&&... value) {
+		bool inserted = false;
+		iterator it = imp_insert_hashed(&inserted, hash, std::move(key), std::forward<Args>(value)...);
+		return { it, inserted };
+	}
+
+	RHMAP_FORCEINLINE iterator find(const key_type &key) {
+		return find_hashed(key, hash_fn(key));
+	}
+	RHMAP_FORCEINLINE const_iterator find(const key_type &key) const {
+		return find_hashed(key, const_cast<Hash&>(hash_fn)(key));
+	}
+
+	// Same as `find()` with a precomputed `hash`, which must equal `hash_function()(key)`.
+	iterator find_hashed(const key_type &key, uint32_t hash) {
 		value_type *vals = (value_type*)values;
-		uint32_t hash = hash_fn(key), scan = 0, index;
+		uint32_t scan = 0, index;
 		while (rhmap_find_inline(&map, hash, &scan, &index)) {
 			if (key == vals[index].key) {
 				return &vals[index];
@@ -340,8 +559,15 @@ struct hash_map : hash_base
 		}
 		return nullptr;
 	}
-	const_iterator find(const key_type &key) const {
-		return const_cast<hash_map*>(this)->find(key);
+	const_iterator find_hashed(const key_type &key, uint32_t hash) const {
+		const value_type *vals = (const value_type*)values;
+		uint32_t scan = 0, index;
+		while (rhmap_find_inline(&map, hash, &scan, &index)) {
+			if (key == vals[index].key) {
+				return &vals[index];
+			}
+		}
+		return nullptr;
 	}
 
 	iterator remove(const_iterator pos) {
@@ -364,11 +590,24 @@ struct hash_map : hash_base
 		if (iterator pos = find(key)) { remove(pos); return true; } else { return false; }
 	}
 
+	hasher hash_function() const { return hash_fn; }
+
 	mapped_type &operator[](const key_type &key) {
 		bool ignored;
-		return imp_insert(&ignored, key)->value;
+		iterator it = imp_insert(&ignored, key);
+		RHMAP_ASSERT(it != nullptr);
+		return it->value;
 	}
 
+	// Write the map to `w`, see `serializer<T>` for non-trivially copyable types.
+	// The index is written as-is so the map must be loaded using the same hash function.
+	bool save(writer &w) const { return imp_save(w, &save_range_untyped<value_type>); }
+
+	// Replace the contents with a map written by `save()`, returns false on failure.
+	// Corrupted headers and index entries pointing outside the values are rejected,
+	// otherwise the input is trusted to come from `save()` with the same hash function.
+	bool load(reader &r) { return imp_load(r, &load_range_untyped<value_type>); }
+
 protected:
 	#if defined(__has_cpp_attribute) && __has_cpp_attribute(no_unique_address)
 		[[no_unique_address]] Hash hash_fn;
@@ -377,11 +616,17 @@ protected:
 	#endif
 
 	template <typename KT, typename... Args>
-	iterator imp_insert(bool *p_inserted, KT &&key, Args&&... value) {
-		if (map.size == map.capacity) imp_grow(0);
+	RHMAP_FORCEINLINE iterator imp_insert(bool *p_inserted, KT &&key, Args&&... value) {
+		uint32_t hash = hash_fn(key);
+		return imp_insert_hashed(p_inserted, hash, std::forward<KT>(key), std::forward<Args>(value)...);
+	}
+
+	template <typename KT, typename... Args>
+	iterator imp_insert_hashed(bool *p_inserted, uint32_t hash, KT &&key, Args&&... value) {
+		if (map.size == map.capacity && !imp_grow(0)) return nullptr;
 		value_type *vals = (value_type*)values;
 
-		uint32_t hash = hash_fn(key), scan = 0, index;
+		uint32_t scan = 0, index;
 		while (rhmap_find_inline(&map, hash, &scan, &index)) {
 			if (key == vals[index].key) {
 				return &vals[index];
@@ -436,6 +681,13 @@ struct hash_set : hash_base
 		return { it, inserted };
 	}
 
+	// Same as `insert()` with a precomputed `hash`, which must equal `hash_function()(value)`.
+	insert_result<value_type> insert_hashed(const value_type &value, uint32_t hash) {
+		bool inserted = false;
+		iterator it = imp_insert_hashed(&inserted, hash, value);
+		return { it, inserted };
+	}
+
 	iterator find(const value_type &value) {
 		value_type *vals = (value_type*)values;
 		uint32_t hash = hash_fn(value), scan = 0, index;
@@ -447,7 +699,14 @@ struct hash_set : hash_base
 		return nullptr;
 	}
 	const_iterator find(const value_type &value) const {
-		return const_cast<hash_set*>(this)->find(value);
+		const value_type *vals = (const value_type*)values;
+		uint32_t hash = const_cast<Hash&>(hash_fn)(value), scan = 0, index;
+		while (rhmap_find_inline(&map, hash, &scan, &index)) {
+			if (value == vals[index]) {
+				return &vals[index];
+			}
+		}
+		return nullptr;
 	}
 
 	iterator remove(const_iterator pos) {
@@ -471,6 +730,17 @@ struct hash_set : hash_base
 		if (iterator pos = find(value)) { remove(pos); return true; } else { return false; }
 	}
 
+	hasher hash_function() const { return hash_fn; }
+
+	// Write the set to `w`, see `serializer<T>` for non-trivially copyable types.
+	// The index is written as-is so the set must be loaded using the same hash function.
+	bool save(writer &w) const { return imp_save(w, &save_range_untyped<value_type>); }
+
+	// Replace the contents with a set written by `save()`, returns false on failure.
+	// Corrupted headers and index entries pointing outside the values are rejected,
+	// otherwise the input is trusted to come from `save()` with the same hash function.
+	bool load(reader &r) { return imp_load(r, &load_range_untyped<value_type>); }
+
 protected:
 	#if defined(__has_cpp_attribute) && __has_cpp_attribute(no_unique_address)
 		[[no_unique_address]] Hash hash_fn;
@@ -479,11 +749,17 @@ protected:
 	#endif
 
 	template <typename KT>
-	iterator imp_insert(bool *p_inserted, KT &&value) {
-		if (map.size == map.capacity) imp_grow(0);
+	RHMAP_FORCEINLINE iterator imp_insert(bool *p_inserted, KT &&value) {
+		uint32_t hash = hash_fn(value);
+		return imp_insert_hashed(p_inserted, hash, std::forward<KT>(value));
+	}
+
+	template <typename KT>
+	iterator imp_insert_hashed(bool *p_inserted, uint32_t hash, KT &&value) {
+		if (map.size == map.capacity && !imp_grow(0)) return nullptr;
 		value_type *vals = (value_type*)values;
 
-		uint32_t hash = hash_fn(value), scan = 0, index;
+		uint32_t scan = 0, index;
 		while (rhmap_find_inline(&map, hash, &scan, &index)) {
 			if (value == vals[index]) {
 				return &vals[index];
@@ -0,0 +1,171 @@
+#include "rh_intern.h"
+
+namespace rh {
+
+static const size_t min_chunk_size = 64 * 1024;
+static const size_t max_chunk_size = 16 * 1024 * 1024;
+
+uint32_t string_interner::hash_string(const char *data, size_t size)
+{
+	return hash(hash_buffer_unaligned(data, size) ^ (uint32_t)size);
+}
+
+string_interner::string_interner(string_interner &&rhs) noexcept
+	: ator(rhs.ator), map(rhs.map), strings(rhs.strings), chunks(rhs.chunks)
+	, arena_pos(rhs.arena_pos), arena_end(rhs.arena_end), arena_used(rhs.arena_used)
+	, arena_allocated(rhs.arena_allocated)
+{
+	rhs.map = { };
+	rhs.strings = nullptr;
+	rhs.chunks = nullptr;
+	rhs.arena_pos = rhs.arena_end = nullptr;
+	rhs.arena_used = 0;
+	rhs.arena_allocated = 0;
+}
+
+string_interner &string_interner::operator=(string_interner &&rhs) noexcept
+{
+	if (&rhs == this) return *this;
+	reset();
+	new (this) string_interner(std::move(rhs));
+	return *this;
+}
+
+uint32_t string_interner::intern(const char *data, size_t size)
+{
+	return intern_hashed(data, size, hash_string(data, size));
+}
+
+uint32_t string_interner::intern_hashed(const char *data, size_t size, uint32_t hash)
+{
+	RHMAP_ASSERT(size <= UINT32_MAX);
+	uint32_t scan = 0, id;
+	while (rhmap_find_inline(&map, hash, &scan, &id)) {
+		const interned_str &str = strings[id];
+		if (str.size == size && !memcmp(str.data, data, size)) return id;
+	}
+
+	if (map.size == map.capacity) {
+		imp_grow();
+		scan = 0;
+		while (rhmap_find_inline(&map, hash, &scan, &id)) { }
+	}
+
+	id = map.size;
+	RHMAP_ASSERT(id != invalid_id);
+	interned_str &str = strings[id];
+	str.data = imp_push_bytes(data, size);
+	str.size = (uint32_t)size;
+	str.hash = hash;
+	rhmap_insert_inline(&map, hash, scan, id);
+	return id;
+}
+
+uint32_t string_interner::find(const char *data, size_t size) const
+{
+	return find_hashed(data, size, hash_string(data, size));
+}
+
+uint32_t string_interner::find_hashed(const char *data, size_t size, uint32_t hash) const
+{
+	uint32_t scan = 0, id;
+	while (rhmap_find_inline(&map, hash, &scan, &id)) {
+		const interned_str &str = strings[id];
+		if (str.size == size && !memcmp(str.data, data, size)) return id;
+	}
+	return invalid_id;
+}
+
+void string_interner::reserve(size_t count)
+{
+	if (count <= map.capacity) return;
+	size_t num, alloc_size;
+	rhmap_grow_inline(&map, &num, &alloc_size, count, 0.0);
+	imp_rehash(num, alloc_size);
+}
+
+void string_interner::clear()
+{
+	rhmap_clear_inline(&map);
+	imp_free_chunks();
+}
+
+void string_interner::reset()
+{
+	size_t alloc_size = rhmap_alloc_size_inline(&map) + map.capacity * sizeof(interned_str);
+	void *data = rhmap_reset_inline(&map);
+	if (alloc_size) ator->free(ator->user, data, alloc_size);
+	strings = nullptr;
+	imp_free_chunks();
+}
+
+char *string_interner::imp_push_bytes(const char *data, size_t size)
+{
+	size_t total = size + 1;
+	if ((size_t)(arena_end - arena_pos) < total) {
+		// Chunks grow with the arena, huge strings get a dedicated chunk
+		size_t chunk_size = arena_used < min_chunk_size ? min_chunk_size : arena_used;
+		if (chunk_size > max_chunk_size) chunk_size = max_chunk_size;
+		if (chunk_size < total) chunk_size = total;
+
+		chunk *c = (chunk*)ator->allocate(ator->user, sizeof(chunk) + chunk_size);
+		c->size = chunk_size;
+		arena_allocated += chunk_size;
+		if (chunk_size - total > (size_t)(arena_end - arena_pos) || !chunks) {
+			c->prev = chunks;
+			chunks = c;
+			arena_pos = (char*)(c + 1);
+			arena_end = arena_pos + chunk_size;
+		} else {
+			// Keep filling the current chunk, link the new one behind it
+			c->prev = chunks->prev;
+			chunks->prev = c;
+			char *dst = (char*)(c + 1);
+			memcpy(dst, data, size);
+			dst[size] = '\0';
+			arena_used += total;
+			return dst;
+		}
+	}
+
+	char *dst = arena_pos;
+	memcpy(dst, data, size);
+	dst[size] = '\0';
+	arena_pos += total;
+	arena_used += total;
+	return dst;
+}
+
+void string_interner::imp_free_chunks()
+{
+	chunk *c = chunks;
+	while (c) {
+		chunk *prev = c->prev;
+		ator->free(ator->user, c, sizeof(chunk) + c->size);
+		c = prev;
+	}
+	chunks = nullptr;
+	arena_pos = arena_end = nullptr;
+	arena_used = 0;
+	arena_allocated = 0;
+}
+
+void string_interner::imp_rehash(size_t count, size_t alloc_size)
+{
+	void *new_data = ator->allocate(ator->user, alloc_size + count * sizeof(interned_str));
+	interned_str *new_strings = (interned_str*)((char*)new_data + alloc_size);
+	if (map.size > 0) memcpy(new_strings, strings, map.size * sizeof(interned_str));
+	size_t old_size = rhmap_alloc_size_inline(&map) + map.capacity * sizeof(interned_str);
+	void *old_data = rhmap_rehash_inline(&map, count, alloc_size, new_data);
+	if (old_size) ator->free(ator->user, old_data, old_size);
+	strings = new_strings;
+}
+
+void string_interner::imp_grow()
+{
+	size_t count, alloc_size;
+	rhmap_grow_inline(&map, &count, &alloc_size, 16, 0.0);
+	imp_rehash(count, alloc_size);
+}
+
+}
@@ -0,0 +1,105 @@
+#ifndef RH_INTERN_H_INCLUDED
+#define RH_INTERN_H_INCLUDED
+
+#include "rh_hash.h"
+
+namespace rh {
+
+struct interned_str {
+	const char *data; // Always null-terminated
+	uint32_t size;
+	uint32_t hash; // Hash used by the index, eg. for partitioning
+};
+
+// Maps byte strings to dense `uint32_t` ids in insertion order.
+// The string bytes are stored back-to-back in an arena of large chunks that are
+// never moved so pointers returned by `data()` stay valid until `clear()`.
+// The rhmap value is the id itself so a lookup compares the stored hash bits
+// first and does a single `memcmp()` against the arena for a likely match.
+// Lookups take any type with `data()` and `size()` (eg. `std::string_view`)
+// or a raw pointer and length and never allocate.
+struct string_interner
+{
+	static const uint32_t invalid_id = UINT32_MAX;
+
+	explicit string_interner(const allocator *ator=&stdlib_allocator) : ator(ator) { }
+	~string_interner() { reset(); }
+
+	string_interner(string_interner &&rhs) noexcept;
+	string_interner &operator=(string_interner &&rhs) noexcept;
+
+	string_interner(const string_interner &) = delete;
+	string_interner &operator=(const string_interner &) = delete;
+
+	// Return the id of the string, inserting it if necessary.
+	uint32_t intern(const char *data, size_t size);
+	uint32_t intern(const char *str) { return intern(str, strlen(str)); }
+	template <typename S>
+	auto intern(const S &s) -> decltype((void)s.data(), (void)s.size(), uint32_t()) {
+		return intern((const char*)s.data(), (size_t)s.size());
+	}
+
+	// Hash function used for the index.
+	static uint32_t hash_string(const char *data, size_t size);
+
+	// Variants of `intern()` and `find()` taking a precomputed `hash_string()` for batched use.
+	uint32_t intern_hashed(const char *data, size_t size, uint32_t hash);
+	uint32_t find_hashed(const char *data, size_t size, uint32_t hash) const;
+	RHMAP_FORCEINLINE void prefetch(uint32_t hash) const { rhmap_prefetch_inline(&map, hash); }
+
+	// Return the id of the string or `invalid_id` if it hasn't been interned.
+	uint32_t find(const char *data, size_t size) const;
+	uint32_t find(const char *str) const { return find(str, strlen(str)); }
+	template <typename S>
+	auto find(const S &s) const -> decltype((void)s.data(), (void)s.size(), uint32_t()) {
+		return find((const char*)s.data(), (size_t)s.size());
+	}
+
+	RHMAP_FORCEINLINE const interned_str &get(uint32_t id) const {
+		RHMAP_ASSERT(id < map.size);
+		return strings[id];
+	}
+	RHMAP_FORCEINLINE const char *data(uint32_t id) const { return get(id).data; }
+	RHMAP_FORCEINLINE size_t length(uint32_t id) const { return get(id).size; }
+
+	RHMAP_FORCEINLINE size_t size() const noexcept { return map.size; }
+	RHMAP_FORCEINLINE bool empty() const noexcept { return map.size == 0; }
+	RHMAP_FORCEINLINE const interned_str *begin() const noexcept { return strings; }
+	RHMAP_FORCEINLINE const interned_str *end() const noexcept { return strings + map.size; }
+
+	// Total bytes used by the string data including null terminators.
+	size_t arena_size() const noexcept { return arena_used; }
+
+	// Approximate total memory used including the index and unused arena space.
+	size_t memory_usage() const noexcept {
+		return arena_allocated + rhmap_alloc_size_inline(&map) + map.capacity * sizeof(interned_str);
+	}
+
+	void reserve(size_t count);
+	void clear();
+	void reset();
+
+protected:
+	struct chunk {
+		chunk *prev;
+		size_t size;
+	};
+
+	const allocator *ator;
+	rhmap map = { };
+	interned_str *strings = nullptr;
+	chunk *chunks = nullptr;
+	char *arena_pos = nullptr;
+	char *arena_end = nullptr;
+	size_t arena_used = 0;
+	size_t arena_allocated = 0;
+
+	char *imp_push_bytes(const char *data, size_t size);
+	void imp_free_chunks();
+	void imp_rehash(size_t count, size_t alloc_size);
+	void imp_grow();
+};
+
+}
+
+#endif
@@ -0,0 +1,195 @@
+#ifndef RH_JOIN_H_INCLUDED
+#define RH_JOIN_H_INCLUDED
+
+#include "rh_hash.h"
+
+namespace rh {
+
+struct join_pair {
+	uint32_t build_row;
+	uint32_t probe_row;
+
+	bool operator==(const join_pair &rhs) const { return build_row == rhs.build_row && probe_row == rhs.probe_row; }
+	bool operator!=(const join_pair &rhs) const { return !(*this == rhs); }
+};
+
+struct join_options {
+	// Build sides with more rows than this are radix partitioned on the high hash
+	// bits so that each partition's index and keys stay in cache during probing.
+	size_t partition_rows = 64 * 1024;
+
+	// Upper limit for the number of partitions as a power of two.
+	uint32_t max_partition_bits = 10;
+
+	// How many rows ahead the probe loop prefetches index slots.
+	uint32_t prefetch_distance = 16;
+};
+
+// Equi-join of two key columns. `build()` indexes the build side with duplicate
+// keys stored as separate rhmap entries and `probe()` emits a `join_pair` for
+// every matching (build row, probe row) combination.
+// Unpartitioned probes emit pairs in probe row order, partitioned probes are
+// grouped by partition.
+template <typename K
+	, typename Hash = default_hash<K>
+	, const allocator *Allocator=&stdlib_allocator>
+struct hash_join
+{
+	explicit hash_join(const join_options &opts=join_options(), const Hash &hash_fn=Hash())
+		: opts(opts), hash_fn(hash_fn) { }
+	~hash_join() { reset(); }
+
+	hash_join(const hash_join &) = delete;
+	hash_join &operator=(const hash_join &) = delete;
+
+	// Index `count` keys, row ids are `row_offset + i`. Replaces any previous build side.
+	void build(const K *keys, size_t count, uint32_t row_offset=0) {
+		reset();
+
+		uint32_t bits = 0;
+		while (bits < opts.max_partition_bits && ((size_t)1 << bits) * opts.partition_rows < count) bits++;
+		partition_bits = bits;
+		uint32_t num_partitions = 1u << bits;
+
+		imp_hash(keys, count);
+		partitions.resize(num_partitions);
+		array<uint32_t> fill;
+		fill.resize(num_partitions + 1);
+		for (size_t i = 0; i < count; i++) fill[imp_partition(hashes[i]) + 1]++;
+		for (uint32_t i = 0; i < num_partitions; i++) fill[i + 1] += fill[i];
+
+		// Scatter the rows so that each partition's keys are contiguous
+		entries.resize(count);
+		array<uint32_t> entry_hashes;
+		entry_hashes.resize(count);
+		for (uint32_t i = 0; i < num_partitions; i++) partitions[i].begin = fill[i];
+		for (size_t i = 0; i < count; i++) {
+			uint32_t hash = hashes[i];
+			uint32_t dst = fill[imp_partition(hash)]++;
+			entries[dst].key = keys[i];
+			entries[dst].row = row_offset + (uint32_t)i;
+			entry_hashes[dst] = hash;
+		}
+
+		for (uint32_t i = 0; i < num_partitions; i++) {
+			partition &part = partitions[i];
+			uint32_t begin = part.begin, end = fill[i];
+			size_t num, alloc_size;
+			rhmap_grow_inline(&part.map, &num, &alloc_size, end - begin, 0.0);
+			rhmap_rehash_inline(&part.map, num, alloc_size, Allocator->allocate(Allocator->user, alloc_size));
+			for (uint32_t ix = begin; ix < end; ix++) {
+				rhmap_insert_inline(&part.map, entry_hashes[ix], 0, ix);
+			}
+		}
+	}
+
+	// Append all matches for `count` probe keys to `out`, row ids are `row_offset + i`.
+	void probe(array<join_pair> &out, const K *keys, size_t count, uint32_t row_offset=0) {
+		imp_hash(keys, count);
+		if (partitions.empty()) return;
+
+		const uint32_t *probe_hashes = hashes.data();
+		uint32_t dist = opts.prefetch_distance;
+		if (partition_bits == 0) {
+			const rhmap &map = partitions[0].map;
+			for (size_t i = 0; i < count; i++) {
+				if (i + dist < count) rhmap_prefetch_inline(&map, probe_hashes[i + dist]);
+				imp_probe_row(out, map, keys[i], probe_hashes[i], row_offset + (uint32_t)i);
+			}
+			return;
+		}
+
+		// Group the probe rows by partition to probe one cache-sized index at a time
+		uint32_t num_partitions = 1u << partition_bits;
+		array<uint32_t> fill;
+		fill.resize(num_partitions + 1);
+		for (size_t i = 0; i < count; i++) fill[imp_partition(probe_hashes[i]) + 1]++;
+		for (uint32_t i = 0; i < num_partitions; i++) fill[i + 1] += fill[i];
+		order.resize(count);
+		for (size_t i = 0; i < count; i++) {
+			order[fill[imp_partition(probe_hashes[i])]++] = (uint32_t)i;
+		}
+
+		uint32_t begin = 0;
+		for (uint32_t part = 0; part < num_partitions; part++) {
+			uint32_t end = fill[part];
+			const rhmap &map = partitions[part].map;
+			for (uint32_t ix = begin; ix < end; ix++) {
+				if (ix + dist < end) rhmap_prefetch_inline(&map, probe_hashes[order[ix + dist]]);
+				uint32_t i = order[ix];
+				imp_probe_row(out, map, keys[i], probe_hashes[i], row_offset + i);
+			}
+			begin = end;
+		}
+	}
+
+	array<join_pair> probe(const K *keys, size_t count, uint32_t row_offset=0) {
+		array<join_pair> out;
+		probe(out, keys, count, row_offset);
+		return out;
+	}
+
+	size_t build_size() const noexcept { return entries.size(); }
+	uint32_t num_partitions() const noexcept { return (uint32_t)partitions.size(); }
+
+	void reset() {
+		for (partition &part : partitions) {
+			size_t alloc_size = rhmap_alloc_size_inline(&part.map);
+			void *data = rhmap_reset_inline(&part.map);
+			if (alloc_size) Allocator->free(Allocator->user, data, alloc_size);
+		}
+		partitions.clear();
+		entries.clear();
+		partition_bits = 0;
+	}
+
+protected:
+	struct build_entry {
+		K key;
+		uint32_t row;
+
+		bool operator==(const build_entry &rhs) const { return key == rhs.key && row == rhs.row; }
+	};
+
+	struct partition {
+		rhmap map = { };
+		uint32_t begin = 0;
+
+		bool operator==(const partition &rhs) const { return map.entries == rhs.map.entries && begin == rhs.begin; }
+	};
+
+	join_options opts;
+	#if defined(__has_cpp_attribute) && __has_cpp_attribute(no_unique_address)
+		[[no_unique_address]] Hash hash_fn;
+	#else
+		Hash hash_fn;
+	#endif
+
+	uint32_t partition_bits = 0;
+	array<partition, Allocator> partitions;
+	array<build_entry, Allocator> entries;
+	array<uint32_t, Allocator> hashes;
+	array<uint32_t, Allocator> order;
+
+	RHMAP_FORCEINLINE uint32_t imp_partition(uint32_t hash) const {
+		return partition_bits ? hash >> (32u - partition_bits) : 0;
+	}
+
+	void imp_hash(const K *keys, size_t count) {
+		hashes.resize(count);
+		uint32_t *dst = hashes.data();
+		for (size_t i = 0; i < count; i++) dst[i] = hash_fn(keys[i]);
+	}
+
+	RHMAP_FORCEINLINE void imp_probe_row(array<join_pair> &out, const rhmap &map, const K &key, uint32_t hash, uint32_t probe_row) const {
+		const build_entry *build = entries.data();
+		uint32_t scan = 0, ix;
+		while (rhmap_find_inline(&map, hash, &scan, &ix)) {
+			if (build[ix].key == key) out.push_back(join_pair{ build[ix].row, probe_row });
+		}
+	}
+};
+
+}
+
+#endif
@@ -0,0 +1,297 @@
+#include "rh_journal.h"
+
+#include <stdlib.h>
+
+#if defined(_WIN32)
+	#define WIN32_LEAN_AND_MEAN
+	#define NOMINMAX
+	#include <Windows.h>
+	#include <io.h>
+#else
+	#include <unistd.h>
+	#include <fcntl.h>
+#endif
+
+namespace rh {
+
+struct record_header {
+	uint32_t size;
+	uint32_t check;
+};
+
+static uint32_t record_check(const void *data, size_t size)
+{
+	return hash(hash_buffer_unaligned(data, size) ^ (uint32_t)size);
+}
+
+static bool sync_file(FILE *file, const journal_options &opts)
+{
+	if (fflush(file) != 0) return false;
+	if (opts.sync == fsync_policy::none) return true;
+#if defined(_WIN32)
+	return _commit(_fileno(file)) == 0;
+#else
+	return fsync(fileno(file)) == 0;
+#endif
+}
+
+static bool truncate_file(FILE *file, size_t size)
+{
+#if defined(_WIN32)
+	return _chsize_s(_fileno(file), (__int64)size) == 0;
+#else
+	return ftruncate(fileno(file), (off_t)size) == 0;
+#endif
+}
+
+static bool replace_file(const char *src, const char *dst, const journal_options &opts)
+{
+#if defined(_WIN32)
+	return MoveFileExA(src, dst, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+	if (rename(src, dst) != 0) return false;
+	if (opts.sync == fsync_policy::none) return true;
+
+	// Sync the containing directory to make the rename durable
+	const char *slash = strrchr(dst, '/');
+	size_t len = slash ? (size_t)(slash - dst) : 0;
+	char *dir = (char*)malloc(len + 2);
+	if (len > 0) memcpy(dir, dst, len); else dir[len++] = '.';
+	dir[len] = '\0';
+	int fd = ::open(dir, O_RDONLY);
+	free(dir);
+	if (fd < 0) return false;
+	bool ok = fsync(fd) == 0;
+	::close(fd);
+	return ok;
+#endif
+}
+
+bool journal::open(const char *path_, const journal_options &opts_)
+{
+	close();
+	opts = opts_;
+	path_len = strlen(path_);
+	path = (char*)malloc(path_len + 16);
+	memcpy(path, path_, path_len);
+	return true;
+}
+
+void journal::close()
+{
+	if (log) fclose(log);
+	free(path);
+	free(buffer);
+	free(replay_buffer);
+	log = nullptr;
+	path = nullptr;
+	buffer = replay_buffer = nullptr;
+	log_size = path_len = buffer_size = buffer_capacity = 0;
+	replay_size = replay_capacity = 0;
+}
+
+writer journal::begin_record(journal_op op)
+{
+	record_begin = buffer_size;
+	imp_reserve(sizeof(record_header) + 1);
+	buffer_size += sizeof(record_header);
+	buffer[buffer_size++] = (char)op;
+
+	writer w;
+	w.user = this;
+	w.write = [](void *user, const void *data, size_t size) {
+		journal *j = (journal*)user;
+		j->imp_reserve(size);
+		memcpy(j->buffer + j->buffer_size, data, size);
+		j->buffer_size += size;
+		return true;
+	};
+	return w;
+}
+
+bool journal::end_record()
+{
+	record_header header;
+	const char *payload = buffer + record_begin + sizeof(record_header);
+	header.size = (uint32_t)(buffer_size - record_begin - sizeof(record_header));
+	header.check = record_check(payload, header.size);
+	memcpy(buffer + record_begin, &header, sizeof(record_header));
+
+	if (opts.sync == fsync_policy::always || buffer_size >= opts.group_commit_size) {
+		if (!commit()) {
+			buffer_size = record_begin;
+			return false;
+		}
+	}
+	return true;
+}
+
+bool journal::commit()
+{
+	if (buffer_size == 0) return true;
+	if (!log) {
+		log = fopen(imp_path(".log"), "ab");
+		if (!log) return false;
+		if (fseek(log, 0, SEEK_END) != 0) {
+			fclose(log);
+			log = nullptr;
+			return false;
+		}
+		log_size = (size_t)ftell(log);
+	}
+	if (fwrite(buffer, 1, buffer_size, log) != buffer_size || !sync_file(log, opts)) {
+		imp_rollback();
+		return false;
+	}
+	log_size += buffer_size;
+	buffer_size = 0;
+	return true;
+}
+
+bool journal::read_snapshot(snapshot_load_fn *fn, void *user)
+{
+	FILE *file = fopen(imp_path(".snap"), "rb");
+	if (!file) return true;
+	reader r = file_reader(file);
+	bool ok = fn(user, r);
+	fclose(file);
+	return ok;
+}
+
+bool journal::write_snapshot(snapshot_save_fn *fn, void *user)
+{
+	FILE *file = fopen(imp_path(".snap.tmp"), "wb");
+	if (!file) return false;
+	writer w = file_writer(file);
+	bool ok = fn(user, w) && sync_file(file, opts);
+	if (fclose(file) != 0) ok = false;
+	if (!ok) return false;
+
+	size_t len = path_len + 10;
+	char *tmp_path = (char*)malloc(len);
+	memcpy(tmp_path, imp_path(".snap.tmp"), len);
+	ok = replace_file(tmp_path, imp_path(".snap"), opts);
+	free(tmp_path);
+	if (!ok) return false;
+
+	// The snapshot contains everything in the log: start from an empty one
+	if (log) fclose(log);
+	log = fopen(imp_path(".log"), "wb");
+	log_size = 0;
+	return log && sync_file(log, opts);
+}
+
+bool journal::read_log(size_t *p_num_inserts)
+{
+	*p_num_inserts = 0;
+	if (log) {
+		fclose(log);
+		log = nullptr;
+	}
+
+	FILE *file = fopen(imp_path(".log"), "r+b");
+	if (!file) return true;
+
+	// Read the whole log in large chunks
+	size_t file_size = 0;
+	for (;;) {
+		const size_t chunk_size = 1024 * 1024;
+		if (replay_capacity - file_size < chunk_size) {
+			size_t capacity = replay_capacity * 2 + chunk_size;
+			char *new_buffer = (char*)realloc(replay_buffer, capacity);
+			if (!new_buffer) {
+				fclose(file);
+				return false;
+			}
+			replay_buffer = new_buffer;
+			replay_capacity = capacity;
+		}
+		size_t num_read = fread(replay_buffer + file_size, 1, chunk_size, file);
+		file_size += num_read;
+		if (num_read < chunk_size) break;
+	}
+
+	// Validate the records, a crash may leave a partially written record at the end
+	size_t pos = 0;
+	for (;;) {
+		record_header header;
+		if (file_size - pos < sizeof(record_header)) break;
+		memcpy(&header, replay_buffer + pos, sizeof(record_header));
+		const char *payload = replay_buffer + pos + sizeof(record_header);
+		if (header.size == 0 || file_size - pos - sizeof(record_header) < header.size) break;
+		if (record_check(payload, header.size) != header.check) break;
+		if (payload[0] == (char)journal_op::insert) *p_num_inserts += 1;
+		pos += sizeof(record_header) + header.size;
+	}
+	replay_size = pos;
+
+	bool ok = true;
+	if (pos < file_size) ok = truncate_file(file, pos);
+	fclose(file);
+	return ok;
+}
+
+bool journal::replay(replay_fn *fn, void *user)
+{
+	struct replay_reader {
+		const char *ptr, *end;
+	};
+
+	bool ok = true;
+	size_t pos = 0;
+	while (pos < replay_size) {
+		record_header header;
+		memcpy(&header, replay_buffer + pos, sizeof(record_header));
+		const char *payload = replay_buffer + pos + sizeof(record_header);
+		pos += sizeof(record_header) + header.size;
+
+		replay_reader rr = { payload + 1, payload + header.size };
+		reader r;
+		r.user = &rr;
+		r.read = [](void *user, void *data, size_t size) {
+			replay_reader *rr = (replay_reader*)user;
+			if ((size_t)(rr->end - rr->ptr) < size) return false;
+			memcpy(data, rr->ptr, size);
+			rr->ptr += size;
+			return true;
+		};
+		if (!fn(user, (journal_op)payload[0], r)) {
+			ok = false;
+			break;
+		}
+	}
+
+	free(replay_buffer);
+	replay_buffer = nullptr;
+	replay_size = replay_capacity = 0;
+	return ok;
+}
+
+void journal::imp_reserve(size_t size)
+{
+	if (buffer_capacity - buffer_size >= size) return;
+	size_t capacity = buffer_capacity * 2;
+	if (capacity < buffer_size + size) capacity = buffer_size + size;
+	if (capacity < 4096) capacity = 4096;
+	buffer = (char*)realloc(buffer, capacity);
+	buffer_capacity = capacity;
+}
+
+void journal::imp_rollback()
+{
+	// Cut off anything a failed commit may have written, the next commit reopens the log
+	fclose(log);
+	log = nullptr;
+	FILE *file = fopen(imp_path(".log"), "r+b");
+	if (!file) return;
+	truncate_file(file, log_size);
+	fclose(file);
+}
+
+const char *journal::imp_path(const char *suffix)
+{
+	strcpy(path + path_len, suffix);
+	return path;
+}
+
+}
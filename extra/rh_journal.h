@@ -0,0 +1,231 @@
+#ifndef RH_JOURNAL_H_INCLUDED
+#define RH_JOURNAL_H_INCLUDED
+
+#include "rh_hash.h"
+
+namespace rh {
+
+enum class fsync_policy {
+	none,   // Never fsync(), leave flushing to the OS
+	commit, // fsync() the log on every commit
+	always, // Commit and fsync() after every operation
+};
+
+struct journal_options {
+	fsync_policy sync = fsync_policy::commit;
+
+	// Pending records are committed automatically when they exceed this many bytes.
+	size_t group_commit_size = 64 * 1024;
+};
+
+enum class journal_op : uint8_t {
+	insert = 1,
+	update = 2,
+	remove = 3,
+};
+
+// Append-only log file `<path>.log` combined with a snapshot file `<path>.snap`.
+// Records are buffered in memory and written as a group by `commit()`.
+// Replaying a log is idempotent so a crash during `write_snapshot()` is safe.
+struct journal
+{
+	typedef bool snapshot_save_fn(void *user, writer &w);
+	typedef bool snapshot_load_fn(void *user, reader &r);
+	typedef bool replay_fn(void *user, journal_op op, reader &r);
+
+	journal() { }
+	~journal() { close(); }
+
+	journal(const journal &) = delete;
+	journal &operator=(const journal &) = delete;
+
+	bool open(const char *path, const journal_options &opts);
+	void close();
+
+	// Start a new record, write the payload to the returned writer and finish with `end_record()`.
+	writer begin_record(journal_op op);
+
+	// Returns false if the record triggered a commit that failed, the record
+	// is then discarded while the earlier pending ones stay buffered.
+	bool end_record();
+
+	// Write all pending records to the log and fsync() depending on the policy.
+	// On failure the log is truncated back to the last commit and the records
+	// stay pending so the commit can be retried.
+	bool commit();
+
+	// Load the snapshot if one exists, returns false only on a corrupted snapshot.
+	bool read_snapshot(snapshot_load_fn *fn, void *user);
+
+	// Atomically replace the snapshot and truncate the log.
+	bool write_snapshot(snapshot_save_fn *fn, void *user);
+
+	// Read and validate the log, discarding a torn tail from an interrupted write.
+	// `p_num_inserts` receives the number of insert records for reserving space.
+	bool read_log(size_t *p_num_inserts);
+
+	// Call `fn` for each record loaded by `read_log()`.
+	bool replay(replay_fn *fn, void *user);
+
+protected:
+	journal_options opts;
+	FILE *log = nullptr;
+	size_t log_size = 0;
+	char *path = nullptr;
+	size_t path_len = 0;
+	char *buffer = nullptr;
+	size_t buffer_size = 0, buffer_capacity = 0;
+	size_t record_begin = 0;
+	char *replay_buffer = nullptr;
+	size_t replay_size = 0, replay_capacity = 0;
+
+	void imp_reserve(size_t size);
+	void imp_rollback();
+	const char *imp_path(const char *suffix);
+};
+
+// `hash_map` that journals every modification to a log file for crash durability.
+// Keys and values are written with `serializer<T>`.
+template <typename K, typename V
+	, typename Hash = default_hash<K>
+	, const allocator *Allocator=&stdlib_allocator>
+struct journaled_hash_map
+{
+	using map_type = hash_map<K, V, Hash, Allocator>;
+	using value_type = typename map_type::value_type;
+
+	// Restore the state from the latest snapshot and log at `path`, or start empty.
+	bool open(const char *path, const journal_options &opts=journal_options()) {
+		imp_map.clear();
+		if (!imp_journal.open(path, opts)) return false;
+		if (!imp_journal.read_snapshot(&imp_load_snapshot, this)) return false;
+		size_t num_inserts;
+		if (!imp_journal.read_log(&num_inserts)) return false;
+		imp_map.reserve(imp_map.size() + num_inserts);
+		imp_replay_batch batch(&imp_map);
+		bool ok = imp_journal.replay(&imp_replay, &batch);
+		imp_flush_replay(batch);
+		return ok;
+	}
+
+	// Commit pending records and close the log.
+	bool close() {
+		bool ok = imp_journal.commit();
+		imp_journal.close();
+		return ok;
+	}
+
+	const map_type &map() const { return imp_map; }
+	const value_type *find(const K &key) const { return imp_map.find(key); }
+	size_t size() const { return imp_map.size(); }
+
+	// Insert or update `key`. The record is added to the journal before the map
+	// is modified, if that fails both are left unchanged and false is returned.
+	// Unless the policy is `fsync_policy::always` a successful return only means
+	// the record is buffered, it's durable once `commit()` returns true.
+	bool set(const K &key, const V &value) {
+		value_type *pair = imp_map.find(key);
+		writer w = imp_journal.begin_record(pair ? journal_op::update : journal_op::insert);
+		serializer<K>::save(w, key);
+		serializer<V>::save(w, value);
+		if (!imp_journal.end_record()) return false;
+		if (pair) pair->value = value; else imp_map.emplace(key, value);
+		return true;
+	}
+
+	// Remove `key` if it exists, journaled the same way as `set()`.
+	bool remove(const K &key) {
+		value_type *pair = imp_map.find(key);
+		if (!pair) return true;
+		writer w = imp_journal.begin_record(journal_op::remove);
+		serializer<K>::save(w, key);
+		if (!imp_journal.end_record()) return false;
+		imp_map.remove(pair);
+		return true;
+	}
+
+	bool commit() { return imp_journal.commit(); }
+
+	// Write a full snapshot of the map and start a new empty log.
+	bool checkpoint() {
+		if (!imp_journal.commit()) return false;
+		return imp_journal.write_snapshot(&imp_save_snapshot, this);
+	}
+
+protected:
+	static const size_t replay_batch_size = 64;
+
+	// Decoded records waiting to be applied, `values` has one entry per non-remove op
+	struct imp_replay_batch {
+		explicit imp_replay_batch(map_type *map) : map(map) { }
+
+		map_type *map;
+		array<journal_op> ops;
+		array<K> keys;
+		array<V> values;
+	};
+
+	map_type imp_map;
+	journal imp_journal;
+
+	static bool imp_save_snapshot(void *user, writer &w) {
+		return ((journaled_hash_map*)user)->imp_map.save(w);
+	}
+
+	static bool imp_load_snapshot(void *user, reader &r) {
+		return ((journaled_hash_map*)user)->imp_map.load(r);
+	}
+
+	static bool imp_replay(void *user, journal_op op, reader &r) {
+		imp_replay_batch &batch = *(imp_replay_batch*)user;
+		typename std::aligned_storage<sizeof(K), alignof(K)>::type key_data;
+		typename std::aligned_storage<sizeof(V), alignof(V)>::type value_data;
+		K *key = (K*)&key_data;
+		V *value = (V*)&value_data;
+		if (!serializer<K>::load(r, key)) return false;
+		bool ok = true;
+		if (op == journal_op::remove) {
+			batch.ops.push_back(op);
+			batch.keys.push_back(std::move(*key));
+		} else if (serializer<V>::load(r, value)) {
+			batch.ops.push_back(op);
+			batch.keys.push_back(std::move(*key));
+			batch.values.push_back(std::move(*value));
+			value->~V();
+		} else {
+			ok = false;
+		}
+		key->~K();
+		if (batch.ops.size() == replay_batch_size) imp_flush_replay(batch);
+		return ok;
+	}
+
+	// Apply the batched records in order: hash all the keys, prefetch their home slots
+	// and then insert or remove with the precomputed hashes.
+	static void imp_flush_replay(imp_replay_batch &batch) {
+		map_type &map = *batch.map;
+		uint32_t hashes[replay_batch_size];
+		Hash hash_fn = map.hash_function();
+		size_t num = batch.ops.size();
+		K *keys = batch.keys.data();
+		V *values = batch.values.data();
+		for (size_t i = 0; i < num; i++) hashes[i] = hash_fn(keys[i]);
+		for (size_t i = 0; i < num; i++) rhmap_prefetch_inline(&map.raw_map(), hashes[i]);
+		for (size_t i = 0; i < num; i++) {
+			if (batch.ops[i] == journal_op::remove) {
+				if (value_type *pair = map.find_hashed(keys[i], hashes[i])) map.remove(pair);
+			} else {
+				auto result = map.emplace_hashed(std::move(keys[i]), hashes[i], std::move(*values));
+				if (!result.inserted) result.entry->value = std::move(*values);
+				values++;
+			}
+		}
+		batch.ops.clear();
+		batch.keys.clear();
+		batch.values.clear();
+	}
+};
+
+}
+
+#endif
@@ -0,0 +1,153 @@
+#ifndef RH_LRU_H_INCLUDED
+#define RH_LRU_H_INCLUDED
+
+#include "rh_hash.h"
+
+namespace rh {
+
+// Value stored in the `lru_cache` map: the recency list is threaded through
+// the dense values array using 32-bit indices.
+template <typename V>
+struct lru_node {
+	V value;
+	uint32_t prev;
+	uint32_t next;
+
+	bool operator==(const lru_node &rhs) const { return value == rhs.value; }
+	bool operator!=(const lru_node &rhs) const { return !(*this == rhs); }
+};
+
+// Fixed capacity cache evicting the least recently used entry.
+// Entries live in a `hash_map<K, lru_node<V>>` so there are no per-entry allocations,
+// removing an entry uses the map's swap-remove and patches the links of the
+// entry that was moved into the hole.
+// Pointers returned by `get()` and `put()` are valid until the next modification.
+template <typename K, typename V
+	, typename Hash = default_hash<K>
+	, const allocator *Allocator=&stdlib_allocator>
+struct lru_cache
+{
+	using map_type = hash_map<K, lru_node<V>, Hash, Allocator>;
+	static const uint32_t nil = UINT32_MAX;
+
+	explicit lru_cache(size_t capacity, const Hash &hash_fn=Hash())
+		: entries(hash_fn), max_size(capacity) {
+		RHMAP_ASSERT(capacity > 0 && capacity < nil);
+		entries.reserve(capacity);
+	}
+
+	// Find an entry and mark it as the most recently used.
+	V *get(const K &key) {
+		kv_pair<K, lru_node<V>> *pair = entries.find(key);
+		if (!pair) return nullptr;
+		uint32_t index = (uint32_t)(pair - entries.begin());
+		if (index != head) {
+			imp_unlink(index);
+			imp_push_front(index);
+		}
+		return &pair->value.value;
+	}
+
+	// Find an entry without updating the recency.
+	const V *peek(const K &key) const {
+		const kv_pair<K, lru_node<V>> *pair = entries.find(key);
+		return pair ? &pair->value.value : nullptr;
+	}
+
+	bool contains(const K &key) const { return entries.find(key) != nullptr; }
+
+	// Insert or overwrite an entry making it the most recently used one.
+	// Evicts the least recently used entry if the cache is full.
+	V &put(const K &key, const V &value) {
+		if (V *existing = get(key)) {
+			*existing = value;
+			return *existing;
+		}
+		if (entries.size() >= max_size) evict();
+		auto result = entries.emplace(key, lru_node<V>{ value, nil, nil });
+		uint32_t index = (uint32_t)(result.entry - entries.begin());
+		imp_push_front(index);
+		return result.entry->value.value;
+	}
+
+	bool remove(const K &key) {
+		kv_pair<K, lru_node<V>> *pair = entries.find(key);
+		if (!pair) return false;
+		imp_remove((uint32_t)(pair - entries.begin()));
+		return true;
+	}
+
+	// Remove the least recently used entry, optionally returning it.
+	bool evict(K *p_key=nullptr, V *p_value=nullptr) {
+		if (tail == nil) return false;
+		kv_pair<K, lru_node<V>> &pair = entries.begin()[tail];
+		// The key is copied as removing the entry hashes it again
+		if (p_key) *p_key = pair.key;
+		if (p_value) *p_value = std::move(pair.value.value);
+		imp_remove(tail);
+		return true;
+	}
+
+	// Change the capacity evicting entries if necessary.
+	void set_capacity(size_t capacity) {
+		RHMAP_ASSERT(capacity > 0 && capacity < nil);
+		max_size = capacity;
+		while (entries.size() > max_size) evict();
+		entries.reserve(capacity);
+	}
+
+	void clear() {
+		entries.clear();
+		head = tail = nil;
+	}
+
+	size_t size() const noexcept { return entries.size(); }
+	bool empty() const noexcept { return entries.size() == 0; }
+	size_t capacity() const noexcept { return max_size; }
+
+	// Entries in no particular order, use `lru_node::prev` and `next` to walk the recency list.
+	const map_type &map() const noexcept { return entries; }
+	uint32_t most_recent() const noexcept { return head; }
+	uint32_t least_recent() const noexcept { return tail; }
+
+protected:
+	map_type entries;
+	size_t max_size;
+	uint32_t head = nil;
+	uint32_t tail = nil;
+
+	RHMAP_FORCEINLINE lru_node<V> &imp_node(uint32_t index) {
+		return entries.begin()[index].value;
+	}
+
+	void imp_unlink(uint32_t index) {
+		lru_node<V> &node = imp_node(index);
+		if (node.prev != nil) imp_node(node.prev).next = node.next; else head = node.next;
+		if (node.next != nil) imp_node(node.next).prev = node.prev; else tail = node.prev;
+	}
+
+	void imp_push_front(uint32_t index) {
+		lru_node<V> &node = imp_node(index);
+		node.prev = nil;
+		node.next = head;
+		if (head != nil) imp_node(head).prev = index; else tail = index;
+		head = index;
+	}
+
+	void imp_remove(uint32_t index) {
+		imp_unlink(index);
+
+		// The last entry is swapped into `index`, redirect its neighbors
+		uint32_t last = (uint32_t)entries.size() - 1;
+		if (index != last) {
+			lru_node<V> &moved = imp_node(last);
+			if (moved.prev != nil) imp_node(moved.prev).next = index; else head = index;
+			if (moved.next != nil) imp_node(moved.next).prev = index; else tail = index;
+		}
+		entries.remove(entries.begin() + index);
+	}
+};
+
+}
+
+#endif
@@ -0,0 +1,236 @@
+#if !defined(_WIN32) && !defined(_GNU_SOURCE)
+	#define _GNU_SOURCE // For mremap()
+#endif
+
+#include "rh_mapped.h"
+
+#include <stdlib.h>
+
+#if defined(_WIN32)
+	#define WIN32_LEAN_AND_MEAN
+	#define NOMINMAX
+	#include <Windows.h>
+#else
+	#include <unistd.h>
+	#include <fcntl.h>
+	#include <sys/mman.h>
+#endif
+
+namespace rh {
+
+// Every mapping starts with a page containing the file handle, the data begins
+// at the next page so it can be passed directly to `madvise()`.
+struct mapping_header {
+#if defined(_WIN32)
+	HANDLE file;
+	HANDLE mapping;
+#else
+	int fd;
+#endif
+	size_t size;
+};
+
+static size_t page_size()
+{
+#if defined(_WIN32)
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwAllocationGranularity;
+#else
+	return (size_t)sysconf(_SC_PAGESIZE);
+#endif
+}
+
+#if defined(_WIN32)
+
+static void *map_view(HANDLE file, HANDLE *p_mapping, size_t size)
+{
+	*p_mapping = CreateFileMappingA(file, NULL, PAGE_READWRITE, (DWORD)((uint64_t)size >> 32u), (DWORD)size, NULL);
+	if (!*p_mapping) return nullptr;
+	void *ptr = MapViewOfFile(*p_mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+	if (!ptr) CloseHandle(*p_mapping);
+	return ptr;
+}
+
+static mapping_header *create_mapping(const char *directory, size_t size, mapped_access access)
+{
+	char path[MAX_PATH];
+	if (!GetTempFileNameA(directory, "rh", 0, path)) return nullptr;
+	DWORD flags = FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE;
+	if (access == mapped_access::random) flags |= FILE_FLAG_RANDOM_ACCESS;
+	if (access == mapped_access::sequential) flags |= FILE_FLAG_SEQUENTIAL_SCAN;
+	HANDLE file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, flags, NULL);
+	if (file == INVALID_HANDLE_VALUE) return nullptr;
+
+	HANDLE mapping;
+	mapping_header *header = (mapping_header*)map_view(file, &mapping, size);
+	if (!header) {
+		CloseHandle(file);
+		return nullptr;
+	}
+	header->file = file;
+	header->mapping = mapping;
+	return header;
+}
+
+static void destroy_mapping(mapping_header *header)
+{
+	HANDLE file = header->file, mapping = header->mapping;
+	UnmapViewOfFile(header);
+	CloseHandle(mapping);
+	CloseHandle(file);
+}
+
+static mapping_header *resize_mapping(mapping_header *header, size_t size, mapped_access access)
+{
+	// Views keep the file at least as large as the mapping so shrinking would need to
+	// unmap it first, keep the current view instead so that nothing can be lost
+	if (size <= header->size) return header;
+
+	// Map the grown file before closing the old view so that it stays intact on failure
+	HANDLE file = header->file, old_mapping = header->mapping, mapping;
+	mapping_header *new_header = (mapping_header*)map_view(file, &mapping, size);
+	if (!new_header) return nullptr;
+	UnmapViewOfFile(header);
+	CloseHandle(old_mapping);
+	new_header->mapping = mapping;
+	return new_header;
+}
+
+#else
+
+static void advise(void *ptr, size_t size, mapped_access access)
+{
+	int advice = MADV_NORMAL;
+	if (access == mapped_access::random) advice = MADV_RANDOM;
+	if (access == mapped_access::sequential) advice = MADV_SEQUENTIAL;
+	if (advice != MADV_NORMAL) madvise(ptr, size, advice);
+}
+
+static mapping_header *create_mapping(const char *directory, size_t size, mapped_access access)
+{
+	size_t dir_len = strlen(directory);
+	char *path = (char*)malloc(dir_len + 16);
+	memcpy(path, directory, dir_len);
+	strcpy(path + dir_len, "/rhmap-XXXXXX");
+	int fd = mkstemp(path);
+	if (fd >= 0) unlink(path);
+	free(path);
+	if (fd < 0) return nullptr;
+
+	if (ftruncate(fd, (off_t)size) != 0) {
+		close(fd);
+		return nullptr;
+	}
+
+	void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (ptr == MAP_FAILED) {
+		close(fd);
+		return nullptr;
+	}
+	advise(ptr, size, access);
+
+	mapping_header *header = (mapping_header*)ptr;
+	header->fd = fd;
+	return header;
+}
+
+static void destroy_mapping(mapping_header *header)
+{
+	int fd = header->fd;
+	munmap(header, header->size);
+	close(fd);
+}
+
+static mapping_header *resize_mapping(mapping_header *header, size_t size, mapped_access access)
+{
+	// On failure the old mapping and file are left intact
+	int fd = header->fd;
+	size_t old_size = header->size;
+	if (size > old_size && ftruncate(fd, (off_t)size) != 0) return nullptr;
+
+#if defined(__linux__)
+	void *ptr = mremap(header, old_size, size, MREMAP_MAYMOVE);
+#else
+	void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (ptr != MAP_FAILED) munmap(header, old_size);
+#endif
+	if (ptr == MAP_FAILED) {
+		if (size > old_size) (void)ftruncate(fd, (off_t)old_size);
+		return nullptr;
+	}
+	if (size < old_size) (void)ftruncate(fd, (off_t)size);
+	advise(ptr, size, access);
+	return (mapping_header*)ptr;
+}
+
+#endif
+
+mapped_allocator::mapped_allocator(const char *directory_, mapped_access access)
+	: access(access)
+{
+	if (!directory_) {
+#if defined(_WIN32)
+		static char temp_path[MAX_PATH + 1];
+		if (GetTempPathA(sizeof(temp_path), temp_path)) directory_ = temp_path;
+		else directory_ = ".";
+#else
+		directory_ = getenv("TMPDIR");
+		if (!directory_ || !*directory_) directory_ = "/tmp";
+#endif
+	}
+
+	size_t len = strlen(directory_);
+	directory = (char*)malloc(len + 1);
+	memcpy(directory, directory_, len + 1);
+
+	user = this;
+	allocate = &imp_allocate;
+	free = &imp_free;
+	reallocate = &imp_reallocate;
+}
+
+mapped_allocator::~mapped_allocator()
+{
+	::free(directory);
+}
+
+void *mapped_allocator::imp_allocate(void *user, size_t size)
+{
+	mapped_allocator *self = (mapped_allocator*)user;
+	size_t header_size = page_size();
+	mapping_header *header = create_mapping(self->directory, header_size + size, self->access);
+	if (!header) return nullptr;
+	header->size = header_size + size;
+	self->total_size += size;
+	return (char*)header + header_size;
+}
+
+void mapped_allocator::imp_free(void *user, void *ptr, size_t size)
+{
+	mapped_allocator *self = (mapped_allocator*)user;
+	if (!ptr) return;
+	mapping_header *header = (mapping_header*)((char*)ptr - page_size());
+	self->total_size -= size;
+	destroy_mapping(header);
+}
+
+void *mapped_allocator::imp_reallocate(void *user, void *ptr, size_t old_size, size_t new_size)
+{
+	mapped_allocator *self = (mapped_allocator*)user;
+	if (!ptr) return new_size ? imp_allocate(user, new_size) : nullptr;
+	if (new_size == 0) {
+		imp_free(user, ptr, old_size);
+		return nullptr;
+	}
+
+	size_t header_size = page_size();
+	mapping_header *header = (mapping_header*)((char*)ptr - header_size);
+	header = resize_mapping(header, header_size + new_size, self->access);
+	if (!header) return nullptr;
+	header->size = header_size + new_size;
+	self->total_size += new_size - old_size;
+	return (char*)header + header_size;
+}
+
+}
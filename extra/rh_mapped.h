@@ -0,0 +1,46 @@
+#ifndef RH_MAPPED_H_INCLUDED
+#define RH_MAPPED_H_INCLUDED
+
+#include "rh_hash.h"
+
+namespace rh {
+
+// Expected access pattern of mapped memory, passed to `madvise()`.
+enum class mapped_access {
+	normal,
+	random,
+	sequential,
+};
+
+// Allocator that places every allocation in its own temporary file mapped to memory,
+// letting the OS page data in and out so containers can grow larger than RAM.
+// Growing an allocation extends the file and remaps it without copying the contents.
+// Hash containers using this store the index and values in separate mappings.
+//
+//   rh::mapped_allocator ator("/mnt/scratch");
+//   rh::hash_set<uint64_t> set(&ator);
+struct mapped_allocator : allocator
+{
+	// `directory` is used for the temporary files, default: $TMPDIR or "/tmp".
+	explicit mapped_allocator(const char *directory=nullptr, mapped_access access=mapped_access::random);
+	~mapped_allocator();
+
+	mapped_allocator(const mapped_allocator &) = delete;
+	mapped_allocator &operator=(const mapped_allocator &) = delete;
+
+	// Total size of the currently mapped allocations in bytes.
+	size_t mapped_size() const { return total_size; }
+
+protected:
+	char *directory;
+	mapped_access access;
+	size_t total_size = 0;
+
+	static void *imp_allocate(void *user, size_t size);
+	static void imp_free(void *user, void *ptr, size_t size);
+	static void *imp_reallocate(void *user, void *ptr, size_t old_size, size_t new_size);
+};
+
+}
+
+#endif
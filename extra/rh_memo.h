@@ -0,0 +1,134 @@
+#ifndef RH_MEMO_H_INCLUDED
+#define RH_MEMO_H_INCLUDED
+
+#include "rh_hash.h"
+
+#include <tuple>
+
+namespace rh {
+
+// Hash of a tuple combining `default_hash` of every element the same way as
+// `hash()` combines the elements of the containers.
+template <typename... Ts>
+struct tuple_hash {
+	RHMAP_FORCEINLINE uint32_t operator()(const std::tuple<Ts...> &t) {
+		return imp_hash(t, std::index_sequence_for<Ts...>());
+	}
+
+	template <size_t... Is>
+	static RHMAP_FORCEINLINE uint32_t imp_hash(const std::tuple<Ts...> &t, std::index_sequence<Is...>) {
+		const uint32_t seed = UINT32_C(0x9e3779b9);
+		uint32_t h = 0;
+		int dummy[] = { 0, (h = ((h << 5u | h >> 27u) ^ default_hash<Ts>()(std::get<Is>(t))) * seed, 0)... };
+		(void)dummy;
+		return h;
+	}
+};
+
+template <typename R>
+struct memo_entry {
+	R result;
+	bool referenced;
+
+	bool operator==(const memo_entry &rhs) const { return result == rhs.result && referenced == rhs.referenced; }
+	bool operator!=(const memo_entry &rhs) const { return !(*this == rhs); }
+};
+
+template <typename Signature, const allocator *Allocator=&stdlib_allocator>
+struct memo_cache;
+
+// Bounded cache of the results of a pure function `R(Args...)`. Argument tuples
+// are hashed with `tuple_hash` and stored in a `hash_map` that is reserved for
+// the full capacity up front so it never grows. When full, entries are evicted
+// with CLOCK: a hand sweeps the dense values array clearing reference bits set
+// by hits and evicts the first entry that wasn't referenced since the last
+// sweep. `R` must be move constructible.
+template <typename R, typename... Args, const allocator *Allocator>
+struct memo_cache<R(Args...), Allocator>
+{
+	using key_type = std::tuple<typename std::decay<Args>::type...>;
+	using map_type = hash_map<key_type, memo_entry<R>, tuple_hash<typename std::decay<Args>::type...>, Allocator>;
+
+	explicit memo_cache(size_t capacity) : max_size(capacity) {
+		RHMAP_ASSERT(capacity > 0);
+		entries.reserve(capacity + 1);
+	}
+
+	// Return the cached result for `args`, calling `fn(args...)` on a miss.
+	// The arguments are hashed once. A miss probes the index again to insert
+	// the result after `fn` returns, so `fn` may call `get_or_compute()`
+	// recursively, eg. for memoized recursion.
+	// The returned reference is valid until the next modification.
+	template <typename Fn>
+	const R &get_or_compute(const typename std::decay<Args>::type &... args, Fn &&fn) {
+		key_type key(args...);
+		uint32_t hash = entries.hash_function()(key);
+		if (auto pair = entries.find_hashed(key, hash)) {
+			pair->value.referenced = true;
+			hit_count++;
+			return pair->value.result;
+		}
+
+		miss_count++;
+		R result = fn(args...);
+		auto res = entries.emplace_hashed(std::move(key), hash, memo_entry<R>{ std::move(result), false });
+		if (entries.size() <= max_size) return res.entry->value.result;
+
+		// The new entry is last so evicting moves it into the victim's slot,
+		// the hand moves past it to give it a full sweep before it can be evicted
+		uint32_t victim = imp_clock_victim();
+		entries.remove(entries.begin() + victim);
+		hand = victim + 1;
+		return entries.begin()[victim].value.result;
+	}
+
+	// Return the cached result for `args` or nullptr, counts as a use of the entry.
+	const R *find(const typename std::decay<Args>::type &... args) {
+		auto pair = entries.find(key_type(args...));
+		if (!pair) return nullptr;
+		pair->value.referenced = true;
+		return &pair->value.result;
+	}
+
+	bool remove(const typename std::decay<Args>::type &... args) {
+		auto pair = entries.find(key_type(args...));
+		if (!pair) return false;
+		entries.remove(pair);
+		if (hand >= entries.size()) hand = 0;
+		return true;
+	}
+
+	void clear() {
+		entries.clear();
+		hand = 0;
+	}
+
+	size_t size() const noexcept { return entries.size(); }
+	size_t capacity() const noexcept { return max_size; }
+	uint64_t num_hits() const noexcept { return hit_count; }
+	uint64_t num_misses() const noexcept { return miss_count; }
+	const map_type &map() const noexcept { return entries; }
+
+protected:
+	map_type entries;
+	size_t max_size;
+	uint32_t hand = 0;
+	uint64_t hit_count = 0, miss_count = 0;
+
+	// Pick an entry to evict, skipping the last one which was just inserted.
+	uint32_t imp_clock_victim() {
+		auto *vals = entries.begin();
+		uint32_t count = (uint32_t)entries.size() - 1;
+		for (;;) {
+			if (hand >= count) hand = 0;
+			memo_entry<R> &entry = vals[hand].value;
+			if (!entry.referenced) return hand;
+			entry.referenced = false;
+			hand++;
+		}
+	}
+};
+
+}
+
+#endif
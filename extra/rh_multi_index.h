@@ -0,0 +1,274 @@
+#ifndef RH_MULTI_INDEX_H_INCLUDED
+#define RH_MULTI_INDEX_H_INCLUDED
+
+#include "rh_hash.h"
+
+#include <tuple>
+
+namespace rh {
+
+// Index descriptors for `multi_index`: `KeyFn` extracts a key of type `K`
+// from a value and `Hash` hashes it. Unique indices reject values whose key
+// is already present, non-unique ones allow any number of equal keys.
+template <typename K, typename KeyFn, typename Hash = default_hash<K>>
+struct hashed_unique {
+	using key_type = K;
+	static const bool unique = true;
+	KeyFn key_fn;
+	Hash hash_fn;
+};
+
+template <typename K, typename KeyFn, typename Hash = default_hash<K>>
+struct hashed_non_unique {
+	using key_type = K;
+	static const bool unique = false;
+	KeyFn key_fn;
+	Hash hash_fn;
+};
+
+// Dense values array with several rhmap indexes, each keyed differently.
+// The indexes map hashes to positions in the values array and share one
+// allocation, they are updated together on insert and remove. Removal swaps
+// the last value into the hole and renames it in every index using
+// `rhmap_update_value()`, so pointers to values are invalidated like in
+// `hash_map`. Index `I` is addressed by its position in `Indices...`.
+// `basic_multi_index` takes the allocator for the values and indexes before the indices.
+template <typename T, const allocator *Allocator, typename... Indices>
+struct basic_multi_index
+{
+	static const size_t num_indices = sizeof...(Indices);
+	static_assert(num_indices > 0, "multi_index requires at least one index");
+
+	template <size_t I> using index_type = typename std::tuple_element<I, std::tuple<Indices...>>::type;
+	template <size_t I> using key_type = typename index_type<I>::key_type;
+
+	basic_multi_index() { }
+	explicit basic_multi_index(const Indices &... indices) : indices(indices...) { }
+
+	~basic_multi_index() { imp_free(); }
+
+	basic_multi_index(const basic_multi_index &) = delete;
+	basic_multi_index &operator=(const basic_multi_index &) = delete;
+
+	// Insert `value` unless it conflicts with an existing value in any unique index,
+	// in which case the conflicting value is returned with `inserted == false`.
+	insert_result<const T> insert(const T &value) {
+		if (values.size() == maps[0].capacity) imp_grow(0);
+		uint32_t index = (uint32_t)values.size();
+		values.push_back(value);
+		return imp_insert_last(index);
+	}
+
+	insert_result<const T> insert(T &&value) {
+		if (values.size() == maps[0].capacity) imp_grow(0);
+		uint32_t index = (uint32_t)values.size();
+		values.push_back(std::move(value));
+		return imp_insert_last(index);
+	}
+
+	// First value with `key` in index `I`, nullptr if not found.
+	template <size_t I>
+	const T *find(const key_type<I> &key) const {
+		const T *vals = values.data();
+		uint32_t hash = imp_index<I>().hash_fn(key), scan = 0, index;
+		while (rhmap_find_inline(&maps[I], hash, &scan, &index)) {
+			if (imp_index<I>().key_fn(vals[index]) == key) return &vals[index];
+		}
+		return nullptr;
+	}
+
+	// Call `fn(const T&)` for every value with `key` in index `I`.
+	template <size_t I, typename Fn>
+	void find_all(const key_type<I> &key, Fn &&fn) const {
+		const T *vals = values.data();
+		uint32_t hash = imp_index<I>().hash_fn(key), scan = 0, index;
+		while (rhmap_find_inline(&maps[I], hash, &scan, &index)) {
+			if (imp_index<I>().key_fn(vals[index]) == key) fn(vals[index]);
+		}
+	}
+
+	template <size_t I>
+	size_t count(const key_type<I> &key) const {
+		size_t num = 0;
+		find_all<I>(key, [&](const T &) { num++; });
+		return num;
+	}
+
+	// Remove the value at `pos`, the last value is moved into its place.
+	void remove(const T *pos) {
+		uint32_t index = (uint32_t)(pos - values.data());
+		RHMAP_ASSERT(index < values.size());
+		imp_unlink(index, std::index_sequence_for<Indices...>());
+		imp_remove_unlinked(index);
+	}
+
+	// Remove all values with `key` in index `I`, returns the number of removed values.
+	template <size_t I>
+	size_t remove_key(const key_type<I> &key) {
+		size_t num = 0;
+		while (const T *pos = find<I>(key)) {
+			remove(pos);
+			num++;
+		}
+		return num;
+	}
+
+	// Modify the value at `pos` using `fn(T&)` and reindex it. If the modified value
+	// conflicts with another value in a unique index the old value is restored and
+	// false is returned. The old value is kept as a copy while `fn` runs.
+	template <typename Fn>
+	bool modify(const T *pos, Fn &&fn) {
+		uint32_t index = (uint32_t)(pos - values.data());
+		RHMAP_ASSERT(index < values.size());
+		T old_value = values[index];
+		imp_unlink(index, std::index_sequence_for<Indices...>());
+		fn(values[index]);
+		if (imp_link(index, nullptr, std::index_sequence_for<Indices...>())) return true;
+		values[index] = std::move(old_value);
+		bool relinked = imp_link(index, nullptr, std::index_sequence_for<Indices...>());
+		RHMAP_ASSERT(relinked);
+		(void)relinked;
+		return false;
+	}
+
+	void reserve(size_t count) {
+		if (count > maps[0].capacity) imp_grow(count);
+	}
+
+	void clear() {
+		for (rhmap &map : maps) rhmap_clear_inline(&map);
+		values.clear();
+	}
+
+	void reset() {
+		imp_free();
+		values.reset();
+	}
+
+	RHMAP_FORCEINLINE const T *begin() const noexcept { return values.data(); }
+	RHMAP_FORCEINLINE const T *end() const noexcept { return values.data() + values.size(); }
+	RHMAP_FORCEINLINE const T *data() const noexcept { return values.data(); }
+	RHMAP_FORCEINLINE const T &operator[](size_t index) const { return values[index]; }
+	RHMAP_FORCEINLINE size_t size() const noexcept { return values.size(); }
+	RHMAP_FORCEINLINE bool empty() const noexcept { return values.size() == 0; }
+	size_t capacity() const noexcept { return maps[0].capacity; }
+
+	template <size_t I>
+	const rhmap &raw_map() const noexcept { return maps[I]; }
+
+protected:
+	std::tuple<Indices...> indices;
+	rhmap maps[num_indices] = { };
+	size_t alloc_size = 0;
+	array<T, Allocator> values;
+
+	template <size_t I>
+	RHMAP_FORCEINLINE index_type<I> &imp_index() const {
+		return const_cast<index_type<I>&>(std::get<I>(indices));
+	}
+
+	template <size_t I>
+	RHMAP_FORCEINLINE uint32_t imp_hash(uint32_t index) const {
+		return imp_index<I>().hash_fn(imp_index<I>().key_fn(values.data()[index]));
+	}
+
+	// Find the insertion scan for the value at `index` in index `I`, fails on a unique key conflict.
+	template <size_t I>
+	bool imp_probe(uint32_t index, uint32_t *p_hash, uint32_t *p_scan, uint32_t *p_conflict) const {
+		const T *vals = values.data();
+		const auto &key = imp_index<I>().key_fn(vals[index]);
+		uint32_t hash = imp_index<I>().hash_fn(key), scan = 0, other;
+		while (rhmap_find_inline(&maps[I], hash, &scan, &other)) {
+			if (index_type<I>::unique && imp_index<I>().key_fn(vals[other]) == key) {
+				if (p_conflict) *p_conflict = other;
+				return false;
+			}
+		}
+		*p_hash = hash;
+		*p_scan = scan;
+		return true;
+	}
+
+	// Insert the value at `index` into every index, or none of them on a conflict.
+	template <size_t... Is>
+	bool imp_link(uint32_t index, uint32_t *p_conflict, std::index_sequence<Is...>) {
+		uint32_t hashes[num_indices], scans[num_indices];
+		bool ok = true;
+		int probe[] = { 0, (ok = ok && imp_probe<Is>(index, &hashes[Is], &scans[Is], p_conflict), 0)... };
+		(void)probe;
+		if (!ok) return false;
+		int insert[] = { 0, (rhmap_insert_inline(&maps[Is], hashes[Is], scans[Is], index), 0)... };
+		(void)insert;
+		return true;
+	}
+
+	template <size_t I>
+	void imp_unlink_one(uint32_t index) {
+		uint32_t hash = imp_hash<I>(index), scan = 0;
+		rhmap_find_value_inline(&maps[I], hash, &scan, index);
+		rhmap_remove_inline(&maps[I], hash, scan);
+	}
+
+	template <size_t... Is>
+	void imp_unlink(uint32_t index, std::index_sequence<Is...>) {
+		int dummy[] = { 0, (imp_unlink_one<Is>(index), 0)... };
+		(void)dummy;
+	}
+
+	template <size_t... Is>
+	void imp_rename(uint32_t old_index, uint32_t new_index, std::index_sequence<Is...>) {
+		int dummy[] = { 0, (rhmap_update_value_inline(&maps[Is], imp_hash<Is>(old_index), old_index, new_index), 0)... };
+		(void)dummy;
+	}
+
+	// Remove the value at `index` which must not be present in any index.
+	void imp_remove_unlinked(uint32_t index) {
+		uint32_t last = (uint32_t)values.size() - 1;
+		if (index != last) {
+			imp_rename(last, index, std::index_sequence_for<Indices...>());
+			values[index] = std::move(values[last]);
+		}
+		values.pop_back();
+	}
+
+	insert_result<const T> imp_insert_last(uint32_t index) {
+		uint32_t conflict = 0;
+		if (imp_link(index, &conflict, std::index_sequence_for<Indices...>())) {
+			return { &values.data()[index], true };
+		}
+		values.pop_back();
+		return { &values.data()[conflict], false };
+	}
+
+	// All indexes have the same capacity and live in one allocation.
+	void imp_grow(size_t min_size) {
+		size_t count, map_size;
+		if ((maps[0].size | min_size) == 0) min_size = 64 / sizeof(T);
+		rhmap_grow_inline(&maps[0], &count, &map_size, min_size, 0.0);
+		char *data = (char*)Allocator->allocate(Allocator->user, map_size * num_indices);
+		void *old_data = maps[0].entries;
+		size_t old_size = alloc_size;
+		for (size_t i = 0; i < num_indices; i++) {
+			rhmap_rehash_inline(&maps[i], count, map_size, data + i * map_size);
+		}
+		if (old_data) Allocator->free(Allocator->user, old_data, old_size * num_indices);
+		alloc_size = map_size;
+		values.reserve(count);
+	}
+
+	void imp_free() {
+		if (maps[0].entries) {
+			void *data = maps[0].entries;
+			for (rhmap &map : maps) rhmap_reset_inline(&map);
+			Allocator->free(Allocator->user, data, alloc_size * num_indices);
+		}
+		alloc_size = 0;
+	}
+};
+
+template <typename T, typename... Indices>
+using multi_index = basic_multi_index<T, &stdlib_allocator, Indices...>;
+
+}
+
+#endif
@@ -0,0 +1,214 @@
+#ifndef RH_PERFECT_H_INCLUDED
+#define RH_PERFECT_H_INCLUDED
+
+#include "rh_hash.h"
+
+#include <algorithm>
+
+namespace rh {
+
+static RHMAP_FORCEINLINE uint32_t perfect_mix(uint32_t v) {
+	v ^= v >> 16;
+	v *= UINT32_C(0x7feb352d);
+	v ^= v >> 15;
+	v *= UINT32_C(0x846ca68b);
+	v ^= v >> 16;
+	return v;
+}
+
+static RHMAP_FORCEINLINE uint32_t perfect_range(uint32_t v, uint32_t range) {
+	return (uint32_t)(((uint64_t)v * range) >> 32u);
+}
+
+// Static minimal perfect hash map built from an existing `hash_map`.
+// Uses "hash and displace" with a 16-bit pilot per bucket of ~5 keys: a lookup
+// reads one pilot, one slot and compares a single key without any probing.
+// The table is filled to 99% and the remaining positions are remapped to the
+// free slots so the values array is exactly as large as the number of keys.
+// Keys that share a full 32-bit hash can't be separated by pilots so those
+// are stored in a small fallback `hash_map`.
+template <typename K, typename V
+	, typename Hash = default_hash<K>>
+struct perfect_map
+{
+	using key_type = K;
+	using mapped_type = V;
+	using value_type = kv_pair<K, V>;
+	using const_iterator = const value_type*;
+
+	explicit perfect_map(const Hash &hash_fn=Hash()) : hash_fn(hash_fn), overflow(hash_fn) { }
+
+	// The hash function of `map` is used for lookups as its index already contains the hashes.
+	template <const allocator *Allocator>
+	static perfect_map build(const hash_map<K, V, Hash, Allocator> &map) {
+		perfect_map result(map.hash_function());
+		const value_type *vals = map.begin();
+
+		array<uint64_t> refs;
+		refs.reserve(map.size());
+		uint32_t hash = 0, scan = 0, index;
+		while (rhmap_next_inline(&map.raw_map(), &hash, &scan, &index)) {
+			refs.push_back((uint64_t)hash << 32u | index);
+		}
+		std::sort(refs.begin(), refs.end());
+
+		array<uint64_t> unique;
+		unique.reserve(refs.size());
+		for (size_t i = 0; i < refs.size(); i++) {
+			uint32_t h = (uint32_t)(refs[i] >> 32u);
+			bool dup = (i > 0 && (uint32_t)(refs[i - 1] >> 32u) == h)
+				|| (i + 1 < refs.size() && (uint32_t)(refs[i + 1] >> 32u) == h);
+			if (dup) {
+				result.overflow.insert(vals[(uint32_t)refs[i]]);
+			} else {
+				unique.push_back(refs[i]);
+			}
+		}
+
+		for (uint32_t attempt = 0; attempt < 64; attempt++) {
+			if (result.imp_build(unique, vals, perfect_mix(attempt + 1))) return result;
+		}
+
+		// Practically unreachable, keep everything in the fallback map
+		for (uint64_t ref : unique) result.overflow.insert(vals[(uint32_t)ref]);
+		return result;
+	}
+
+	RHMAP_FORCEINLINE size_t size() const noexcept { return values.size() + overflow.size(); }
+	RHMAP_FORCEINLINE bool empty() const noexcept { return size() == 0; }
+
+	// Iterates only the perfectly hashed entries, see `overflow_map()` for the rest.
+	RHMAP_FORCEINLINE const_iterator begin() const noexcept { return values.begin(); }
+	RHMAP_FORCEINLINE const_iterator end() const noexcept { return values.end(); }
+	const hash_map<K, V, Hash> &overflow_map() const { return overflow; }
+
+	const_iterator find(const key_type &key) const {
+		uint32_t hash = const_cast<Hash&>(hash_fn)(key);
+		uint32_t num_keys = (uint32_t)values.size();
+		if (num_keys > 0) {
+			uint32_t h1 = perfect_mix(hash ^ seed);
+			uint32_t pilot = pilots.data()[perfect_range(h1, num_buckets)];
+			uint32_t pos = perfect_range(perfect_mix(h1 + UINT32_C(0x9e3779b9)) ^ perfect_mix(pilot + 1), table_size);
+			if (pos >= num_keys) pos = remap.data()[pos - num_keys];
+			const value_type *pair = &values.data()[pos];
+			if (pair->key == key) return pair;
+		}
+		return overflow.empty() ? nullptr : overflow.find(key);
+	}
+
+protected:
+	#if defined(__has_cpp_attribute) && __has_cpp_attribute(no_unique_address)
+		[[no_unique_address]] Hash hash_fn;
+	#else
+		Hash hash_fn;
+	#endif
+
+	uint32_t seed = 0;
+	uint32_t num_buckets = 0;
+	uint32_t table_size = 0;
+	array<uint16_t> pilots;
+	array<uint32_t> remap;
+	array<value_type> values;
+	hash_map<K, V, Hash> overflow;
+
+	bool imp_build(const array<uint64_t> &refs, const value_type *vals, uint32_t new_seed) {
+		uint32_t num_keys = (uint32_t)refs.size();
+		if (num_keys == 0) return true;
+		seed = new_seed;
+		table_size = num_keys + num_keys / 100 + 1;
+		num_buckets = (num_keys + 4) / 5;
+
+		// Sort the keys by bucket, then the buckets by descending size
+		array<uint32_t> bucket_begin, bucket_order, key_order, key_pos;
+		for (uint32_t i = 0; i <= num_buckets; i++) bucket_begin.push_back(0);
+		for (uint64_t ref : refs) {
+			bucket_begin[perfect_range(perfect_mix((uint32_t)(ref >> 32u) ^ seed), num_buckets) + 1]++;
+		}
+		uint32_t max_bucket_size = 0;
+		for (uint32_t i = 0; i < num_buckets; i++) {
+			if (bucket_begin[i + 1] > max_bucket_size) max_bucket_size = bucket_begin[i + 1];
+			bucket_begin[i + 1] += bucket_begin[i];
+		}
+		array<uint32_t> fill;
+		for (uint32_t i = 0; i < num_buckets; i++) fill.push_back(bucket_begin[i]);
+		for (uint32_t i = 0; i < num_keys; i++) key_order.push_back(0);
+		for (uint32_t i = 0; i < num_keys; i++) {
+			uint32_t bucket = perfect_range(perfect_mix((uint32_t)(refs[i] >> 32u) ^ seed), num_buckets);
+			key_order[fill[bucket]++] = i;
+		}
+		for (uint32_t size = max_bucket_size; size > 0; size--) {
+			for (uint32_t i = 0; i < num_buckets; i++) {
+				if (bucket_begin[i + 1] - bucket_begin[i] == size) bucket_order.push_back(i);
+			}
+		}
+
+		// Search a pilot for each bucket that maps all its keys to free slots,
+		// `key_pos` holds the pilot-independent part of the position until placed
+		array<uint64_t> taken;
+		for (uint32_t i = 0; i < (table_size + 63) / 64; i++) taken.push_back(0);
+		for (uint32_t i = 0; i < num_keys; i++) {
+			key_pos.push_back(perfect_mix(perfect_mix((uint32_t)(refs[i] >> 32u) ^ seed) + UINT32_C(0x9e3779b9)));
+		}
+		pilots.clear();
+		for (uint32_t i = 0; i < num_buckets; i++) pilots.push_back(0);
+
+		for (uint32_t bucket : bucket_order) {
+			uint32_t begin = bucket_begin[bucket], end = bucket_begin[bucket + 1];
+			bool found = false;
+			for (uint32_t pilot = 0; pilot <= UINT16_MAX && !found; pilot++) {
+				uint32_t pilot_hash = perfect_mix(pilot + 1);
+				uint32_t i = begin;
+				for (; i < end; i++) {
+					uint32_t pos = perfect_range(key_pos[key_order[i]] ^ pilot_hash, table_size);
+					uint64_t bit = (uint64_t)1 << (pos % 64);
+					if (taken[pos / 64] & bit) break;
+					taken[pos / 64] |= bit;
+				}
+				if (i == end) {
+					pilots[bucket] = (uint16_t)pilot;
+					for (uint32_t j = begin; j < end; j++) {
+						uint32_t key = key_order[j];
+						key_pos[key] = perfect_range(key_pos[key] ^ pilot_hash, table_size);
+					}
+					found = true;
+				} else {
+					for (uint32_t j = begin; j < i; j++) {
+						uint32_t pos = perfect_range(key_pos[key_order[j]] ^ pilot_hash, table_size);
+						taken[pos / 64] &= ~((uint64_t)1 << (pos % 64));
+					}
+				}
+			}
+			if (!found) return false;
+		}
+
+		// Positions past `num_keys` are remapped to the unused slots below it
+		remap.clear();
+		uint32_t free_slot = 0;
+		for (uint32_t pos = num_keys; pos < table_size; pos++) {
+			if (taken[pos / 64] & ((uint64_t)1 << (pos % 64))) {
+				while (taken[free_slot / 64] & ((uint64_t)1 << (free_slot % 64))) free_slot++;
+				remap.push_back(free_slot++);
+			} else {
+				remap.push_back(0);
+			}
+		}
+
+		array<uint32_t> slot_key;
+		for (uint32_t i = 0; i < num_keys; i++) slot_key.push_back(0);
+		for (uint32_t i = 0; i < num_keys; i++) {
+			uint32_t pos = key_pos[i];
+			if (pos >= num_keys) pos = remap[pos - num_keys];
+			slot_key[pos] = i;
+		}
+		values.clear();
+		values.reserve(num_keys);
+		for (uint32_t i = 0; i < num_keys; i++) {
+			values.push_back(vals[(uint32_t)refs[slot_key[i]]]);
+		}
+		return true;
+	}
+};
+
+}
+
+#endif
@@ -0,0 +1,101 @@
+#ifndef RH_RATE_LIMIT_H_INCLUDED
+#define RH_RATE_LIMIT_H_INCLUDED
+
+#include "rh_expiring.h"
+
+namespace rh {
+
+// Per-key token buckets refilling one token every `interval` ticks up to `burst`
+// tokens. Each bucket is a single theoretical arrival time (GCRA): refilling is
+// implicit in comparing it with the current time, so a check is one lookup and
+// a few integer operations with no per-key timers. A bucket is full again once
+// `now` passes its arrival time, at which point it's indistinguishable from an
+// absent key, so buckets are kept in an `expiring_map` with that deadline (plus
+// `idle_ttl`, rounded up to a power of two at least the burst window) and
+// `evict_idle()` drops all of them in bulk using the timer wheel.
+// Time is the same arbitrary monotonic tick count used by `expiring_map`.
+template <typename K
+	, typename Hash = default_hash<K>
+	, const allocator *Allocator=&stdlib_allocator>
+struct rate_limiter
+{
+	using map_type = expiring_map<K, uint64_t, Hash, Allocator>;
+	static const size_t batch_size = 64;
+
+	rate_limiter(uint64_t interval, uint32_t burst, uint64_t now=0, uint64_t idle_ttl=0, const Hash &hash_fn=Hash())
+		: buckets(now, hash_fn), interval(interval), window(interval * burst), idle_ttl(idle_ttl) {
+		RHMAP_ASSERT(interval > 0 && burst > 0);
+		while (slack < window - 1) slack = slack << 1u | 1u;
+	}
+
+	// Take `cost` tokens from the bucket of `key` if available.
+	bool allow(const K &key, uint64_t now, uint32_t cost=1) {
+		bool allowed = false;
+		buckets.update(key, [&](uint64_t &tat, bool inserted) {
+			return imp_take(tat, inserted, now, cost, &allowed);
+		});
+		return allowed;
+	}
+
+	// Check one token for each of `keys`, looking up the buckets in prefetched batches.
+	void allow(const K *keys, size_t count, uint64_t now, bool *result) {
+		uint32_t hashes[batch_size];
+		const rhmap &map = buckets.map().raw_map();
+		Hash hash_fn = buckets.map().hash_function();
+		for (size_t base = 0; base < count; base += batch_size) {
+			size_t num = count - base < batch_size ? count - base : batch_size;
+			const K *batch = keys + base;
+			for (size_t i = 0; i < num; i++) hashes[i] = hash_fn(batch[i]);
+			for (size_t i = 0; i < num; i++) rhmap_prefetch_inline(&map, hashes[i]);
+			for (size_t i = 0; i < num; i++) {
+				bool allowed = false;
+				buckets.update_hashed(batch[i], hashes[i], [&](uint64_t &tat, bool inserted) {
+					return imp_take(tat, inserted, now, 1, &allowed);
+				});
+				result[base + i] = allowed;
+			}
+		}
+	}
+
+	// Number of whole tokens currently available to `key`.
+	uint32_t tokens(const K &key, uint64_t now) const {
+		const uint64_t *tat = buckets.find(key);
+		uint64_t start = tat && *tat > now ? *tat : now;
+		return (uint32_t)((now + window - start) / interval);
+	}
+
+	// Drop the buckets that have been full for `idle_ttl` ticks by `now`.
+	size_t evict_idle(uint64_t now) {
+		return buckets.advance(now);
+	}
+
+	size_t size() const noexcept { return buckets.size(); }
+	void clear() { buckets.clear(); }
+	const map_type &map() const noexcept { return buckets; }
+
+protected:
+	map_type buckets;
+	uint64_t interval;
+	uint64_t window;
+	uint64_t idle_ttl;
+	uint64_t slack = 0;
+
+	// Advance the arrival time `tat` by `cost` tokens if that stays within the burst window.
+	// Returns the deadline of the bucket.
+	RHMAP_FORCEINLINE uint64_t imp_take(uint64_t &tat, bool inserted, uint64_t now, uint32_t cost, bool *p_allowed) {
+		uint64_t start = inserted || tat < now ? now : tat;
+		uint64_t next = start + interval * cost;
+		if (next - now <= window) {
+			tat = next;
+			*p_allowed = true;
+		} else if (inserted) {
+			tat = now;
+		}
+		// Round the deadline up so that the timer wheel is only relinked about once per `burst` requests
+		return (tat + idle_ttl) | slack;
+	}
+};
+
+}
+
+#endif
@@ -0,0 +1,241 @@
+#ifndef RH_SET_OPS_H_INCLUDED
+#define RH_SET_OPS_H_INCLUDED
+
+#include "rh_hash.h"
+
+namespace rh {
+
+static const size_t set_ops_batch_size = 64;
+
+// Look up every value of `values` from `set` in batches: hash the whole batch,
+// prefetch the home slots and then resolve. Calls `fn(value, hash, found)` in order,
+// stops early if it returns false.
+template <typename T, typename Hash, const allocator *Allocator, typename Fn>
+void imp_find_batched(const hash_set<T, Hash, Allocator> &set, const T *values, size_t count, Fn &&fn)
+{
+	uint32_t hashes[set_ops_batch_size];
+	Hash hash_fn = set.hash_function();
+	const rhmap &map = set.raw_map();
+	const T *set_values = set.begin();
+	for (size_t base = 0; base < count; base += set_ops_batch_size) {
+		size_t num = count - base < set_ops_batch_size ? count - base : set_ops_batch_size;
+		const T *batch = values + base;
+		for (size_t i = 0; i < num; i++) hashes[i] = hash_fn(batch[i]);
+		for (size_t i = 0; i < num; i++) rhmap_prefetch_inline(&map, hashes[i]);
+		for (size_t i = 0; i < num; i++) {
+			uint32_t scan = 0, index;
+			bool found = false;
+			while (rhmap_find_inline(&map, hashes[i], &scan, &index)) {
+				if (batch[i] == set_values[index]) {
+					found = true;
+					break;
+				}
+			}
+			if (!fn(batch[i], hashes[i], found)) return;
+		}
+	}
+}
+
+// Look up every value of `values` from `set` in batches, see `imp_find_batched()`.
+// Calls `fn(value, found)` in order, stops early if it returns false.
+template <typename T, typename Hash, const allocator *Allocator, typename Fn>
+void find_batched(const hash_set<T, Hash, Allocator> &set, const T *values, size_t count, Fn &&fn)
+{
+	imp_find_batched(set, values, count, [&](const T &value, uint32_t, bool found) {
+		return fn(value, found);
+	});
+}
+
+// Merge two sets with the same mask in slot order, see `slot_order_cursor`.
+// Calls `fn(value, hash, in_a, in_b)` once for every distinct value, stops early if it returns false.
+template <typename T, typename Hash, const allocator *Allocator, typename Fn>
+void imp_merge_sets(const hash_set<T, Hash, Allocator> &a, const hash_set<T, Hash, Allocator> &b, Fn &&fn)
+{
+	const T *a_vals = a.begin(), *b_vals = b.begin();
+	slot_order_cursor a_cursor(a.raw_map()), b_cursor(b.raw_map());
+	uint32_t a_hash = 0, a_value = 0, a_slot = 0, b_hash = 0, b_value = 0, b_slot = 0;
+	bool has_a = a_cursor.next(&a_hash, &a_value, &a_slot);
+	bool has_b = b_cursor.next(&b_hash, &b_value, &b_slot);
+
+	// Entries sharing a home slot can appear in any order, match them as (hash, value) pairs
+	uint64_t a_group[64], b_group[64];
+	while (has_a || has_b) {
+		if (!has_b || (has_a && a_slot < b_slot)) {
+			if (!fn(a_vals[a_value], a_hash, true, false)) return;
+			has_a = a_cursor.next(&a_hash, &a_value, &a_slot);
+			continue;
+		}
+		if (!has_a || b_slot < a_slot) {
+			if (!fn(b_vals[b_value], b_hash, false, true)) return;
+			has_b = b_cursor.next(&b_hash, &b_value, &b_slot);
+			continue;
+		}
+
+		uint32_t slot = a_slot, num_a = 0, num_b = 0;
+		while (has_a && a_slot == slot) {
+			a_group[num_a++] = (uint64_t)a_hash << 32u | a_value;
+			has_a = a_cursor.next(&a_hash, &a_value, &a_slot);
+			if (num_a == 64) break;
+		}
+		while (has_b && b_slot == slot) {
+			b_group[num_b++] = (uint64_t)b_hash << 32u | b_value;
+			has_b = b_cursor.next(&b_hash, &b_value, &b_slot);
+			if (num_b == 64) break;
+		}
+
+		// Pathologically large groups fall back to lookups
+		bool overflow = (has_a && a_slot == slot) || (has_b && b_slot == slot);
+		while (has_a && a_slot == slot) {
+			if (!fn(a_vals[a_value], a_hash, true, b.find(a_vals[a_value]) != nullptr)) return;
+			has_a = a_cursor.next(&a_hash, &a_value, &a_slot);
+		}
+		while (has_b && b_slot == slot) {
+			if (!a.find(b_vals[b_value]) && !fn(b_vals[b_value], b_hash, false, true)) return;
+			has_b = b_cursor.next(&b_hash, &b_value, &b_slot);
+		}
+
+		for (uint32_t ai = 0; ai < num_a; ai++) {
+			const T &value = a_vals[(uint32_t)a_group[ai]];
+			bool in_b = false;
+			for (uint32_t bi = 0; bi < num_b; bi++) {
+				if (b_group[bi] == UINT64_MAX || (b_group[bi] >> 32u) != (a_group[ai] >> 32u)) continue;
+				if (!(b_vals[(uint32_t)b_group[bi]] == value)) continue;
+				b_group[bi] = UINT64_MAX;
+				in_b = true;
+				break;
+			}
+			if (!in_b && overflow) in_b = b.find(value) != nullptr;
+			if (!fn(value, (uint32_t)(a_group[ai] >> 32u), true, in_b)) return;
+		}
+		for (uint32_t bi = 0; bi < num_b; bi++) {
+			if (b_group[bi] == UINT64_MAX) continue;
+			const T &value = b_vals[(uint32_t)b_group[bi]];
+			if (overflow && a.find(value)) continue;
+			if (!fn(value, (uint32_t)(b_group[bi] >> 32u), false, true)) return;
+		}
+	}
+}
+
+template <typename T, typename Hash, const allocator *Allocator>
+RHMAP_FORCEINLINE bool imp_can_merge(const hash_set<T, Hash, Allocator> &a, const hash_set<T, Hash, Allocator> &b)
+{
+	return a.raw_map().mask == b.raw_map().mask && a.size() > 0 && b.size() > 0;
+}
+
+// Elements present in both `a` and `b`. Iterates the smaller set and looks up
+// the larger one in batches, or merges in slot order if the capacities match.
+// Results are inserted with the hashes computed for the inputs, so `result`
+// must use the same hash function and can't be either of the inputs.
+template <typename T, typename Hash, const allocator *Allocator>
+void set_intersection(hash_set<T, Hash, Allocator> &result, const hash_set<T, Hash, Allocator> &a, const hash_set<T, Hash, Allocator> &b)
+{
+	RHMAP_ASSERT(&result != &a && &result != &b);
+	result.clear();
+	const hash_set<T, Hash, Allocator> &small = a.size() <= b.size() ? a : b;
+	const hash_set<T, Hash, Allocator> &large = a.size() <= b.size() ? b : a;
+	result.reserve(small.size());
+	if (imp_can_merge(a, b)) {
+		imp_merge_sets(a, b, [&](const T &value, uint32_t hash, bool in_a, bool in_b) {
+			if (in_a && in_b) result.insert_hashed(value, hash);
+			return true;
+		});
+	} else {
+		imp_find_batched(large, small.begin(), small.size(), [&](const T &value, uint32_t hash, bool found) {
+			if (found) result.insert_hashed(value, hash);
+			return true;
+		});
+	}
+}
+
+// Elements present in either `a` or `b`. Without a slot order merge `result`
+// starts as a copy of the larger set, which copies its index as-is.
+template <typename T, typename Hash, const allocator *Allocator>
+void set_union(hash_set<T, Hash, Allocator> &result, const hash_set<T, Hash, Allocator> &a, const hash_set<T, Hash, Allocator> &b)
+{
+	RHMAP_ASSERT(&result != &a && &result != &b);
+	const hash_set<T, Hash, Allocator> &small = a.size() <= b.size() ? a : b;
+	const hash_set<T, Hash, Allocator> &large = a.size() <= b.size() ? b : a;
+	if (imp_can_merge(a, b)) {
+		result.clear();
+		result.reserve(a.size() + b.size());
+		imp_merge_sets(a, b, [&](const T &value, uint32_t hash, bool, bool) {
+			result.insert_hashed(value, hash);
+			return true;
+		});
+	} else {
+		result = large;
+		result.reserve(a.size() + b.size());
+		imp_find_batched(large, small.begin(), small.size(), [&](const T &value, uint32_t hash, bool found) {
+			if (!found) result.insert_hashed(value, hash);
+			return true;
+		});
+	}
+}
+
+// Elements of `a` that are not present in `b`.
+template <typename T, typename Hash, const allocator *Allocator>
+void set_difference(hash_set<T, Hash, Allocator> &result, const hash_set<T, Hash, Allocator> &a, const hash_set<T, Hash, Allocator> &b)
+{
+	RHMAP_ASSERT(&result != &a && &result != &b);
+	result.clear();
+	result.reserve(a.size());
+	if (imp_can_merge(a, b)) {
+		imp_merge_sets(a, b, [&](const T &value, uint32_t hash, bool in_a, bool in_b) {
+			if (in_a && !in_b) result.insert_hashed(value, hash);
+			return true;
+		});
+	} else {
+		imp_find_batched(b, a.begin(), a.size(), [&](const T &value, uint32_t hash, bool found) {
+			if (!found) result.insert_hashed(value, hash);
+			return true;
+		});
+	}
+}
+
+// Returns true if every element of `a` is present in `b`.
+template <typename T, typename Hash, const allocator *Allocator>
+bool is_subset(const hash_set<T, Hash, Allocator> &a, const hash_set<T, Hash, Allocator> &b)
+{
+	if (a.size() > b.size()) return false;
+	bool subset = true;
+	if (imp_can_merge(a, b)) {
+		imp_merge_sets(a, b, [&](const T &, uint32_t, bool in_a, bool in_b) {
+			if (in_a && !in_b) subset = false;
+			return subset;
+		});
+	} else {
+		find_batched(b, a.begin(), a.size(), [&](const T &, bool found) {
+			if (!found) subset = false;
+			return subset;
+		});
+	}
+	return subset;
+}
+
+template <typename T, typename Hash, const allocator *Allocator>
+hash_set<T, Hash, Allocator> set_intersection(const hash_set<T, Hash, Allocator> &a, const hash_set<T, Hash, Allocator> &b)
+{
+	hash_set<T, Hash, Allocator> result(a.hash_function());
+	set_intersection(result, a, b);
+	return result;
+}
+
+template <typename T, typename Hash, const allocator *Allocator>
+hash_set<T, Hash, Allocator> set_union(const hash_set<T, Hash, Allocator> &a, const hash_set<T, Hash, Allocator> &b)
+{
+	hash_set<T, Hash, Allocator> result(a.hash_function());
+	set_union(result, a, b);
+	return result;
+}
+
+template <typename T, typename Hash, const allocator *Allocator>
+hash_set<T, Hash, Allocator> set_difference(const hash_set<T, Hash, Allocator> &a, const hash_set<T, Hash, Allocator> &b)
+{
+	hash_set<T, Hash, Allocator> result(a.hash_function());
+	set_difference(result, a, b);
+	return result;
+}
+
+}
+
+#endif
@@ -0,0 +1,173 @@
+#ifndef RH_SPARSE_H_INCLUDED
+#define RH_SPARSE_H_INCLUDED
+
+#include "rh_hash.h"
+
+#include <algorithm>
+
+namespace rh {
+
+// Accumulates values into sparse `uint32_t` indices, eg. a row of a sparse
+// matrix product. Sums are kept densely in first touch order next to their
+// indices and located through an rhmap. `clear()` only zeroes the index slots
+// that were touched, so reusing one accumulator for many small rows doesn't
+// pay for the capacity grown by the largest one.
+template <typename V
+	, const allocator *Allocator=&stdlib_allocator>
+struct sparse_accumulator
+{
+	static const size_t batch_size = 64;
+
+	sparse_accumulator() { }
+	~sparse_accumulator() {
+		void *data = rhmap_reset_inline(&map);
+		if (data) Allocator->free(Allocator->user, data, alloc_size);
+	}
+
+	sparse_accumulator(const sparse_accumulator &) = delete;
+	sparse_accumulator &operator=(const sparse_accumulator &) = delete;
+
+	void add(uint32_t index, const V &value) {
+		if (map.size == map.capacity) imp_grow(0);
+		imp_add(index, imp_hash(index), value);
+	}
+
+	// Add `values[i]` to `indices[i]` in prefetched batches.
+	void scatter_add(const uint32_t *indices, const V *values, size_t count) {
+		imp_scatter(indices, values, count, [](const V &v) { return v; });
+	}
+
+	// Add `scale * values[i]` to `indices[i]`, eg. one row of B scaled by an element of A.
+	void scatter_add(const uint32_t *indices, const V *values, size_t count, const V &scale) {
+		imp_scatter(indices, values, count, [&](const V &v) { return scale * v; });
+	}
+
+	// Accumulated value of `index`, zero if it hasn't been touched.
+	V get(uint32_t index) const {
+		uint32_t hash = imp_hash(index), scan = 0, pos;
+		const uint32_t *idx = touched.data();
+		while (rhmap_find_inline(&map, hash, &scan, &pos)) {
+			if (idx[pos] == index) return sums.data()[pos];
+		}
+		return V();
+	}
+
+	// Touched indices and their sums in first touch order.
+	const uint32_t *indices() const noexcept { return touched.data(); }
+	const V *values() const noexcept { return sums.data(); }
+	size_t size() const noexcept { return touched.size(); }
+
+	// Write the touched indices and sums ordered by index, both outputs must have room for `size()` elements.
+	void gather_sorted(uint32_t *out_indices, V *out_values) {
+		size_t count = touched.size();
+		const uint32_t *idx = touched.data();
+		const V *vals = sums.data();
+		order.resize(count);
+		uint64_t *keys = order.data();
+		for (size_t i = 0; i < count; i++) keys[i] = (uint64_t)idx[i] << 32u | (uint32_t)i;
+		std::sort(keys, keys + count);
+		for (size_t i = 0; i < count; i++) {
+			out_indices[i] = (uint32_t)(keys[i] >> 32u);
+			out_values[i] = vals[(uint32_t)keys[i]];
+		}
+	}
+
+	// Forget all touched indices in O(touched), keeping the allocated capacity.
+	void clear() {
+		size_t count = touched.size();
+		if (count * 4 >= (size_t)map.mask + 1) {
+			rhmap_clear_inline(&map);
+		} else if (count > 0) {
+			// Every entry belongs to a touched index, so zeroing the run from each home
+			// slot up to the next empty slot removes all of them without any lookups.
+			uint64_t *entries = map.entries;
+			uint32_t mask = map.mask;
+			const uint32_t *idx = touched.data();
+			for (size_t i = 0; i < count; i++) {
+				uint32_t slot = imp_hash(idx[i]) & mask;
+				while (entries[slot]) {
+					entries[slot] = 0;
+					slot = (slot + 1) & mask;
+				}
+			}
+			map.size = 0;
+		}
+		touched.clear();
+		sums.clear();
+	}
+
+	void reserve(size_t count) {
+		if (count > map.capacity) imp_grow(count);
+	}
+
+	void reset() {
+		void *data = rhmap_reset_inline(&map);
+		if (data) Allocator->free(Allocator->user, data, alloc_size);
+		alloc_size = 0;
+		touched.reset();
+		sums.reset();
+		order.reset();
+	}
+
+	const rhmap &raw_map() const noexcept { return map; }
+
+protected:
+	rhmap map = { };
+	size_t alloc_size = 0;
+	array<uint32_t, Allocator> touched;
+	array<V, Allocator> sums;
+	array<uint64_t, Allocator> order;
+
+	// Indices are often dense and clustered so they need a full avalanche before masking.
+	static RHMAP_FORCEINLINE uint32_t imp_hash(uint32_t v) {
+		v ^= v >> 16u;
+		v *= 0x85ebca6bu;
+		v ^= v >> 13u;
+		v *= 0xc2b2ae35u;
+		v ^= v >> 16u;
+		return v;
+	}
+
+	RHMAP_FORCEINLINE void imp_add(uint32_t index, uint32_t hash, const V &value) {
+		uint32_t scan = 0, pos;
+		const uint32_t *idx = touched.data();
+		while (rhmap_find_inline(&map, hash, &scan, &pos)) {
+			if (idx[pos] == index) {
+				sums.data()[pos] += value;
+				return;
+			}
+		}
+		pos = (uint32_t)touched.size();
+		touched.push_back(index);
+		sums.push_back(value);
+		rhmap_insert_inline(&map, hash, scan, pos);
+	}
+
+	template <typename Fn>
+	void imp_scatter(const uint32_t *indices, const V *values, size_t count, Fn &&fn) {
+		uint32_t hashes[batch_size];
+		for (size_t base = 0; base < count; base += batch_size) {
+			size_t num = count - base < batch_size ? count - base : batch_size;
+			if (map.size + num > map.capacity) imp_grow(map.size + num);
+			for (size_t i = 0; i < num; i++) hashes[i] = imp_hash(indices[base + i]);
+			for (size_t i = 0; i < num; i++) rhmap_prefetch_inline(&map, hashes[i]);
+			for (size_t i = 0; i < num; i++) imp_add(indices[base + i], hashes[i], fn(values[base + i]));
+		}
+	}
+
+	void imp_grow(size_t min_size) {
+		size_t count, new_size;
+		if ((map.size | min_size) == 0) min_size = 64 / sizeof(V);
+		rhmap_grow_inline(&map, &count, &new_size, min_size, 0.0);
+		void *data = Allocator->allocate(Allocator->user, new_size);
+		void *old_data = rhmap_rehash_inline(&map, count, new_size, data);
+		if (old_data) Allocator->free(Allocator->user, old_data, alloc_size);
+		alloc_size = new_size;
+		touched.reserve(count);
+		sums.reserve(count);
+	}
+};
+
+}
+
+#endif
@@ -0,0 +1,195 @@
+#ifndef RH_SPATIAL_H_INCLUDED
+#define RH_SPATIAL_H_INCLUDED
+
+#include "rh_hash.h"
+
+namespace rh {
+
+// Integer grid cell, `z` is ignored (should be zero) for 2D grids.
+struct spatial_cell {
+	int32_t x = 0, y = 0, z = 0;
+
+	bool operator==(const spatial_cell &rhs) const { return x == rhs.x && y == rhs.y && z == rhs.z; }
+	bool operator!=(const spatial_cell &rhs) const { return !(*this == rhs); }
+};
+
+static RHMAP_FORCEINLINE uint32_t spatial_cell_hash(const spatial_cell &cell)
+{
+	uint64_t h = ((uint64_t)(uint32_t)cell.x << 32u | (uint32_t)cell.y) ^ (uint64_t)(uint32_t)cell.z * UINT64_C(0x9e3779b97f4a7c15);
+	h ^= h >> 33u;
+	h *= UINT64_C(0xff51afd7ed558ccd);
+	h ^= h >> 33u;
+	h *= UINT64_C(0xc4ceb9fe1a85ec53);
+	return (uint32_t)(h >> 32u);
+}
+
+template <typename T>
+struct spatial_entry {
+	spatial_cell cell;
+	T value;
+
+	bool operator==(const spatial_entry &rhs) const { return cell == rhs.cell && value == rhs.value; }
+	bool operator!=(const spatial_entry &rhs) const { return !(*this == rhs); }
+};
+
+// Grid of `Dims` dimensional integer cells each holding any number of values.
+// Every value is a separate rhmap entry keyed by its cell hash, so a cell is
+// found by scanning the entries sharing its hash and there's no per-cell
+// container. Meant to be rebuilt in bulk, eg. every frame, using `rebuild()`
+// which reuses the storage and inserts in prefetched batches. Neighbourhood
+// queries prefetch all 3x3 (or 3x3x3) cells before visiting any of them.
+template <typename T, uint32_t Dims = 2
+	, const allocator *Allocator=&stdlib_allocator>
+struct spatial_hash
+{
+	static_assert(Dims == 2 || Dims == 3, "spatial_hash supports 2D and 3D grids");
+	static const uint32_t num_neighbors = Dims == 2 ? 9 : 27;
+	static const size_t batch_size = 64;
+
+	spatial_hash() { }
+	~spatial_hash() { imp_free(); }
+
+	spatial_hash(const spatial_hash &) = delete;
+	spatial_hash &operator=(const spatial_hash &) = delete;
+
+	void insert(const spatial_cell &cell, const T &value) {
+		if (map.size == map.capacity) imp_grow(0);
+		uint32_t index = (uint32_t)entries.size();
+		entries.push_back(spatial_entry<T>{ cell, value });
+		// Values sharing a cell are separate entries so there's no lookup before inserting
+		rhmap_insert_inline(&map, spatial_cell_hash(cell), 0, index);
+	}
+
+	// Replace the contents with `values[i]` placed in `cells[i]`.
+	void rebuild(const spatial_cell *cells, const T *values, size_t count) {
+		clear();
+		reserve(count);
+		uint32_t hashes[batch_size];
+		for (size_t base = 0; base < count; base += batch_size) {
+			size_t num = count - base < batch_size ? count - base : batch_size;
+			for (size_t i = 0; i < num; i++) hashes[i] = spatial_cell_hash(cells[base + i]);
+			for (size_t i = 0; i < num; i++) rhmap_prefetch_inline(&map, hashes[i]);
+			for (size_t i = 0; i < num; i++) {
+				entries.push_back(spatial_entry<T>{ cells[base + i], values[base + i] });
+				rhmap_insert_inline(&map, hashes[i], 0, (uint32_t)(base + i));
+			}
+		}
+	}
+
+	// Call `fn(const T&)` for every value in `cell`.
+	template <typename Fn>
+	void query_cell(const spatial_cell &cell, Fn &&fn) const {
+		imp_visit(cell, spatial_cell_hash(cell), fn);
+	}
+
+	// Call `fn(const T&)` for every value in `cell` and its neighbouring cells.
+	template <typename Fn>
+	void query_neighbors(const spatial_cell &cell, Fn &&fn) const {
+		spatial_cell cells[num_neighbors];
+		uint32_t hashes[num_neighbors];
+		imp_neighbors(cells, hashes, cell);
+		for (uint32_t i = 0; i < num_neighbors; i++) imp_visit(cells[i], hashes[i], fn);
+	}
+
+	// Neighbourhood queries for many cells, prefetching several queries ahead.
+	// Calls `fn(size_t query_index, const T&)` for every value around `cells[query_index]`.
+	template <typename Fn>
+	void query_neighbors_batched(const spatial_cell *cells, size_t count, Fn &&fn) const {
+		const size_t queries_per_batch = 8;
+		spatial_cell batch_cells[queries_per_batch * num_neighbors];
+		uint32_t batch_hashes[queries_per_batch * num_neighbors];
+		for (size_t base = 0; base < count; base += queries_per_batch) {
+			size_t num = count - base < queries_per_batch ? count - base : queries_per_batch;
+			for (size_t q = 0; q < num; q++) {
+				imp_neighbors(batch_cells + q * num_neighbors, batch_hashes + q * num_neighbors, cells[base + q]);
+			}
+			for (size_t q = 0; q < num; q++) {
+				size_t query_index = base + q;
+				auto visit = [&](const T &value) { fn(query_index, value); };
+				for (uint32_t i = 0; i < num_neighbors; i++) {
+					imp_visit(batch_cells[q * num_neighbors + i], batch_hashes[q * num_neighbors + i], visit);
+				}
+			}
+		}
+	}
+
+	size_t count(const spatial_cell &cell) const {
+		size_t num = 0;
+		query_cell(cell, [&](const T &) { num++; });
+		return num;
+	}
+
+	void reserve(size_t count) {
+		if (count > map.capacity) imp_grow(count);
+	}
+
+	void clear() {
+		rhmap_clear_inline(&map);
+		entries.clear();
+	}
+
+	void reset() {
+		imp_free();
+		entries.reset();
+	}
+
+	RHMAP_FORCEINLINE const spatial_entry<T> *begin() const noexcept { return entries.data(); }
+	RHMAP_FORCEINLINE const spatial_entry<T> *end() const noexcept { return entries.data() + entries.size(); }
+	RHMAP_FORCEINLINE size_t size() const noexcept { return entries.size(); }
+	const rhmap &raw_map() const noexcept { return map; }
+
+protected:
+	rhmap map = { };
+	size_t alloc_size = 0;
+	array<spatial_entry<T>, Allocator> entries;
+
+	// Fills the hashes and prefetches the home slots of the cells around `center`.
+	void imp_neighbors(spatial_cell *cells, uint32_t *hashes, const spatial_cell &center) const {
+		uint32_t n = 0;
+		int32_t z_min = Dims == 3 ? -1 : 0, z_max = Dims == 3 ? 1 : 0;
+		for (int32_t dz = z_min; dz <= z_max; dz++) {
+			for (int32_t dy = -1; dy <= 1; dy++) {
+				for (int32_t dx = -1; dx <= 1; dx++) {
+					// Wraps around at the edges of the coordinate range
+					spatial_cell &cell = cells[n];
+					cell.x = (int32_t)((uint32_t)center.x + (uint32_t)dx);
+					cell.y = (int32_t)((uint32_t)center.y + (uint32_t)dy);
+					cell.z = (int32_t)((uint32_t)center.z + (uint32_t)dz);
+					hashes[n] = spatial_cell_hash(cell);
+					rhmap_prefetch_inline(&map, hashes[n]);
+					n++;
+				}
+			}
+		}
+	}
+
+	template <typename Fn>
+	RHMAP_FORCEINLINE void imp_visit(const spatial_cell &cell, uint32_t hash, Fn &fn) const {
+		const spatial_entry<T> *es = entries.data();
+		uint32_t scan = 0, index;
+		while (rhmap_find_inline(&map, hash, &scan, &index)) {
+			if (es[index].cell == cell) fn(es[index].value);
+		}
+	}
+
+	void imp_grow(size_t min_size) {
+		size_t count, new_size;
+		if ((map.size | min_size) == 0) min_size = 64 / sizeof(spatial_entry<T>);
+		rhmap_grow_inline(&map, &count, &new_size, min_size, 0.0);
+		void *data = Allocator->allocate(Allocator->user, new_size);
+		void *old_data = rhmap_rehash_inline(&map, count, new_size, data);
+		if (old_data) Allocator->free(Allocator->user, old_data, alloc_size);
+		alloc_size = new_size;
+		entries.reserve(count);
+	}
+
+	void imp_free() {
+		void *data = rhmap_reset_inline(&map);
+		if (data) Allocator->free(Allocator->user, data, alloc_size);
+		alloc_size = 0;
+	}
+};
+
+}
+
+#endif
@@ -0,0 +1,215 @@
+#ifndef RH_STATIC_H_INCLUDED
+#define RH_STATIC_H_INCLUDED
+
+#include "rh_hash.h"
+
+namespace rh {
+
+// Compile-time usable string reference for `static_map` keys.
+struct static_str {
+	const char *data = nullptr;
+	size_t size = 0;
+
+	constexpr static_str() { }
+	constexpr static_str(const char *data, size_t size) : data(data), size(size) { }
+	template <size_t N>
+	constexpr static_str(const char (&str)[N]) : data(str), size(N - 1) { }
+
+	constexpr bool operator==(const static_str &rhs) const {
+		if (size != rhs.size) return false;
+		for (size_t i = 0; i < size; i++) {
+			if (data[i] != rhs.data[i]) return false;
+		}
+		return true;
+	}
+	constexpr bool operator!=(const static_str &rhs) const { return !(*this == rhs); }
+};
+
+// constexpr versions of `hash()`, produce the same values as the runtime ones.
+constexpr uint32_t static_hash_u32(uint32_t v) {
+	v ^= v >> 16;
+	v *= UINT32_C(0x7feb352d);
+	v ^= v >> 15;
+	v *= UINT32_C(0x846ca68b);
+	v ^= v >> 16;
+	return v;
+}
+
+constexpr uint32_t static_hash_u64(uint64_t v) {
+	v ^= v >> 32;
+	v *= UINT64_C(0xd6e8feb86659fd93);
+	v ^= v >> 32;
+	v *= UINT64_C(0xd6e8feb86659fd93);
+	v ^= v >> 32;
+	return (uint32_t)v;
+}
+
+// Same as `hash_buffer_align4()` on little-endian targets.
+constexpr uint32_t static_hash_str(const char *data, size_t size) {
+	uint32_t hash = 0;
+	const uint32_t seed = UINT32_C(0x9e3779b9);
+	size_t i = 0;
+	for (; i + 4 <= size; i += 4) {
+		uint32_t w = (uint32_t)(uint8_t)data[i] | (uint32_t)(uint8_t)data[i + 1] << 8u
+			| (uint32_t)(uint8_t)data[i + 2] << 16u | (uint32_t)(uint8_t)data[i + 3] << 24u;
+		hash = ((hash << 5u | hash >> 27u) ^ w) * seed;
+	}
+	if (i < size) {
+		uint32_t w = 0;
+		for (; i < size; i++) {
+			w = w << 8u | (uint8_t)data[i];
+		}
+		hash = ((hash << 5u | hash >> 27u) ^ w) * seed;
+	}
+	return hash;
+}
+
+// Integers are converted the same way as in the `hash()` overloads.
+constexpr uint32_t static_hash_int(bool v) { return v; }
+constexpr uint32_t static_hash_int(char v) { return static_hash_u32((uint32_t)v); }
+constexpr uint32_t static_hash_int(uint8_t v) { return static_hash_u32((uint32_t)v); }
+constexpr uint32_t static_hash_int(int8_t v) { return static_hash_u32((uint32_t)v); }
+constexpr uint32_t static_hash_int(uint16_t v) { return static_hash_u32((uint32_t)v); }
+constexpr uint32_t static_hash_int(int16_t v) { return static_hash_u32((uint32_t)(uint16_t)v); }
+constexpr uint32_t static_hash_int(uint32_t v) { return static_hash_u32(v); }
+constexpr uint32_t static_hash_int(int32_t v) { return static_hash_u32((uint32_t)v); }
+constexpr uint32_t static_hash_int(uint64_t v) { return static_hash_u64(v); }
+constexpr uint32_t static_hash_int(int64_t v) { return static_hash_u64((uint64_t)v); }
+
+template <typename T, typename Enable = void>
+struct static_hash;
+
+template <typename T>
+struct static_hash<T, typename std::enable_if<std::is_integral<T>::value>::type> {
+	constexpr uint32_t operator()(const T &t) const { return static_hash_int(t); }
+};
+
+// Enums hash as their underlying type.
+template <typename T>
+struct static_hash<T, typename std::enable_if<std::is_enum<T>::value>::type> {
+	constexpr uint32_t operator()(const T &t) const { return static_hash_int((typename std::underlying_type<T>::type)t); }
+};
+
+template <>
+struct static_hash<static_str> {
+	constexpr uint32_t operator()(const static_str &s) const {
+		return static_hash_str(s.data, s.size);
+	}
+};
+
+// Not constexpr: reached only for duplicate keys which turns the constant
+// evaluation of `make_static_map()` into a compile error.
+inline void static_map_duplicate_key() {
+	RHMAP_ASSERT(0 && "Duplicate key in static_map");
+}
+
+// Number of rhmap slots needed for `count` entries at the default load factor.
+constexpr uint32_t static_map_slots(size_t count) {
+	uint32_t slots = 2;
+	while ((double)slots * RHMAP_DEFAULT_LOAD_FACTOR < (double)count) slots *= 2;
+	return slots;
+}
+
+// Immutable map whose rhmap index is computed by constant evaluation.
+// Declare it `constexpr` (or `static constexpr`) so that both the slots and the
+// values are emitted as read-only data with no construction at startup:
+//   static constexpr auto opcodes = rh::make_static_map<rh::static_str, int>({
+//       { "add", 1 }, { "sub", 2 },
+//   });
+// Keys and values must be literal types and `Hash` must have a constexpr call operator.
+template <typename K, typename V, size_t N
+	, typename Hash = static_hash<K>>
+struct static_map
+{
+	using key_type = K;
+	using mapped_type = V;
+	using value_type = kv_pair<K, V>;
+	using const_iterator = const value_type*;
+
+	static constexpr uint32_t num_slots = static_map_slots(N);
+	static constexpr uint32_t mask = num_slots - 1;
+
+	uint64_t entries[num_slots] = { };
+	value_type values[N > 0 ? N : 1] = { };
+
+	// An empty map has no pairs to pass in, it's default constructed instead.
+	template <size_t M = N, typename = typename std::enable_if<M == 0>::type>
+	constexpr static_map() { }
+
+	constexpr static_map(const value_type (&pairs)[N > 0 ? N : 1]) {
+		for (uint32_t i = 0; i < N; i++) {
+			uint32_t hash = Hash()(pairs[i].key), scan = 0, index = 0;
+			while (imp_find(hash, scan, index)) {
+				if (values[index].key == pairs[i].key) static_map_duplicate_key();
+			}
+			values[i] = pairs[i];
+			imp_insert(hash, scan, i);
+		}
+	}
+
+	constexpr size_t size() const noexcept { return N; }
+	constexpr bool empty() const noexcept { return N == 0; }
+	constexpr const_iterator begin() const noexcept { return values; }
+	constexpr const_iterator end() const noexcept { return values + N; }
+
+	constexpr const_iterator find(const key_type &key) const {
+		uint32_t hash = Hash()(key), scan = 0, index = 0;
+		while (imp_find(hash, scan, index)) {
+			if (values[index].key == key) return &values[index];
+		}
+		return nullptr;
+	}
+
+	constexpr bool contains(const key_type &key) const { return find(key) != nullptr; }
+
+protected:
+
+	// Same as `rhmap_find()` and `rhmap_insert()`
+	constexpr bool imp_find(uint32_t hash, uint32_t &p_scan, uint32_t &p_value) const {
+		uint32_t scan = p_scan, ref = hash & ~mask;
+		for (;;) {
+			uint64_t entry = entries[(hash + scan) & mask];
+			scan += 1;
+			if ((uint32_t)entry == ref + scan) {
+				p_scan = scan;
+				p_value = (uint32_t)(entry >> 32u);
+				return true;
+			} else if ((entry & mask) < scan) {
+				p_scan = scan - 1;
+				return false;
+			}
+		}
+	}
+
+	constexpr void imp_insert(uint32_t hash, uint32_t scan, uint32_t value) {
+		uint32_t slot = (hash + scan) & mask;
+		uint64_t entry = 0, new_entry = (uint64_t)value << 32u | (hash & ~mask);
+		scan += 1;
+		while ((entry = entries[slot]) != 0) {
+			uint32_t entry_scan = (uint32_t)(entry & mask);
+			if (entry_scan < scan) {
+				entries[slot] = new_entry + scan;
+				new_entry = (entry & ~(uint64_t)mask);
+				scan = entry_scan;
+			}
+			scan += 1;
+			slot = (slot + 1) & mask;
+		}
+		entries[slot] = new_entry + scan;
+	}
+};
+
+template <typename K, typename V, size_t N, typename Hash>
+constexpr uint32_t static_map<K, V, N, Hash>::num_slots;
+
+template <typename K, typename V, size_t N, typename Hash>
+constexpr uint32_t static_map<K, V, N, Hash>::mask;
+
+template <typename K, typename V, typename Hash = static_hash<K>, size_t N>
+constexpr static_map<K, V, N, Hash> make_static_map(const kv_pair<K, V> (&pairs)[N]) {
+	return static_map<K, V, N, Hash>(pairs);
+}
+
+}
+
+#endif
@@ -0,0 +1,185 @@
+#ifndef RH_TOP_K_H_INCLUDED
+#define RH_TOP_K_H_INCLUDED
+
+#include "rh_hash.h"
+
+#include <algorithm>
+
+namespace rh {
+
+template <typename K>
+struct top_k_entry {
+	K key;
+	uint64_t count; // Upper bound of the true count
+	uint64_t error; // `count - error` is a lower bound of the true count
+
+	bool operator==(const top_k_entry &rhs) const { return key == rhs.key && count == rhs.count && error == rhs.error; }
+	bool operator!=(const top_k_entry &rhs) const { return !(*this == rhs); }
+};
+
+// Space-Saving heavy hitter sketch with a fixed number of counters.
+// Counters live in a fixed values array indexed by an rhmap and are ordered
+// by a binary min-heap of counter indices. A key that isn't tracked replaces
+// the minimum counter inheriting its count as the error bound, so memory stays
+// bounded by `capacity` however many distinct keys are seen. Any key occurring
+// more than `total / capacity` times is guaranteed to be tracked.
+template <typename K
+	, typename Hash = default_hash<K>
+	, const allocator *Allocator=&stdlib_allocator>
+struct top_k
+{
+	explicit top_k(size_t capacity, const Hash &hash_fn=Hash())
+		: hash_fn(hash_fn), max_size((uint32_t)capacity) {
+		RHMAP_ASSERT(capacity > 0 && capacity < UINT32_MAX);
+		size_t count;
+		rhmap_grow_inline(&map, &count, &alloc_size, capacity, 0.0);
+		rhmap_rehash_inline(&map, count, alloc_size, Allocator->allocate(Allocator->user, alloc_size));
+		counters.reserve(capacity);
+		heap.reserve(capacity);
+	}
+
+	~top_k() {
+		void *data = rhmap_reset_inline(&map);
+		Allocator->free(Allocator->user, data, alloc_size);
+	}
+
+	top_k(const top_k &) = delete;
+	top_k &operator=(const top_k &) = delete;
+
+	void add(const K &key, uint64_t count=1) {
+		uint32_t hash = hash_fn(key), scan = 0, index;
+		counter *cs = counters.data();
+		total += count;
+		while (rhmap_find_inline(&map, hash, &scan, &index)) {
+			if (cs[index].entry.key == key) {
+				cs[index].entry.count += count;
+				imp_sift_down(cs[index].heap_pos);
+				return;
+			}
+		}
+
+		if (counters.size() < max_size) {
+			index = (uint32_t)counters.size();
+			counters.push_back(counter{ top_k_entry<K>{ key, count, 0 }, hash, index });
+			heap.push_back(index);
+			rhmap_insert_inline(&map, hash, scan, index);
+			imp_sift_up(index);
+			return;
+		}
+
+		// Replace the minimum counter, the new key may have occurred up to its count before
+		index = heap[0];
+		counter &min = cs[index];
+		uint32_t old_scan = 0;
+		rhmap_find_value_inline(&map, min.hash, &old_scan, index);
+		rhmap_remove_inline(&map, min.hash, old_scan);
+		scan = 0;
+		uint32_t ignored;
+		while (rhmap_find_inline(&map, hash, &scan, &ignored)) { }
+		rhmap_insert_inline(&map, hash, scan, index);
+
+		min.entry.key = key;
+		min.entry.error = min.entry.count;
+		min.entry.count += count;
+		min.hash = hash;
+		imp_sift_down(0);
+	}
+
+	// Estimated count of `key`, an upper bound of the true count.
+	uint64_t estimate(const K &key) const {
+		uint32_t hash = const_cast<Hash&>(hash_fn)(key), scan = 0, index;
+		const counter *cs = counters.data();
+		while (rhmap_find_inline(&map, hash, &scan, &index)) {
+			if (cs[index].entry.key == key) return cs[index].entry.count;
+		}
+		return counters.size() < max_size ? 0 : cs[heap[0]].entry.count;
+	}
+
+	// Write the `k` largest counters to `result` in descending order of count.
+	void top(array<top_k_entry<K>> &result, size_t k) const {
+		result.clear();
+		for (const counter &c : counters) result.push_back(c.entry);
+		if (k > result.size()) k = result.size();
+		std::partial_sort(result.begin(), result.begin() + k, result.end(),
+			[](const top_k_entry<K> &a, const top_k_entry<K> &b) { return a.count > b.count; });
+		while (result.size() > k) result.pop_back();
+	}
+
+	array<top_k_entry<K>> top(size_t k) const {
+		array<top_k_entry<K>> result;
+		top(result, k);
+		return result;
+	}
+
+	void clear() {
+		rhmap_clear_inline(&map);
+		counters.clear();
+		heap.clear();
+		total = 0;
+	}
+
+	size_t size() const noexcept { return counters.size(); }
+	size_t capacity() const noexcept { return max_size; }
+
+	// Sum of all counts added.
+	uint64_t total_count() const noexcept { return total; }
+
+protected:
+	struct counter {
+		top_k_entry<K> entry;
+		uint32_t hash;
+		uint32_t heap_pos;
+
+		bool operator==(const counter &rhs) const { return entry == rhs.entry; }
+	};
+
+	#if defined(__has_cpp_attribute) && __has_cpp_attribute(no_unique_address)
+		[[no_unique_address]] Hash hash_fn;
+	#else
+		Hash hash_fn;
+	#endif
+
+	rhmap map = { };
+	size_t alloc_size = 0;
+	uint32_t max_size;
+	uint64_t total = 0;
+	array<counter, Allocator> counters;
+	array<uint32_t, Allocator> heap;
+
+	RHMAP_FORCEINLINE uint64_t imp_count(uint32_t pos) const {
+		return counters.data()[heap.data()[pos]].entry.count;
+	}
+
+	RHMAP_FORCEINLINE void imp_swap(uint32_t a, uint32_t b) {
+		uint32_t *h = heap.data();
+		counter *cs = counters.data();
+		uint32_t t = h[a]; h[a] = h[b]; h[b] = t;
+		cs[h[a]].heap_pos = a;
+		cs[h[b]].heap_pos = b;
+	}
+
+	void imp_sift_up(uint32_t pos) {
+		while (pos > 0) {
+			uint32_t parent = (pos - 1) / 2;
+			if (imp_count(parent) <= imp_count(pos)) break;
+			imp_swap(parent, pos);
+			pos = parent;
+		}
+	}
+
+	void imp_sift_down(uint32_t pos) {
+		uint32_t size = (uint32_t)heap.size();
+		for (;;) {
+			uint32_t child = pos * 2 + 1;
+			if (child >= size) break;
+			if (child + 1 < size && imp_count(child + 1) < imp_count(child)) child++;
+			if (imp_count(pos) <= imp_count(child)) break;
+			imp_swap(pos, child);
+			pos = child;
+		}
+	}
+};
+
+}
+
+#endif
@@ -153,6 +153,9 @@
 		RHMAP_DEFAULT_LOAD_FACTOR: Load factor used if the parameter is <= 0.0.
 		default: 0.75
 
+		RHMAP_PREFETCH(ptr): Used by `rhmap_prefetch()`
+		default: __builtin_prefetch() or _mm_prefetch() if available, otherwise no-op
+
 	rhmap depends on parts of the C standard library, these can be disabled via macros:
 
 		RHMAP_NO_STDLIB: Use built-in memset() and no-op assert() (unless provided)
@@ -226,6 +229,10 @@ void *rhmap_rehash(rhmap *map, size_t count, size_t alloc_size, void *data_ptr);
 // eg. `while (rhmap_find(map, hash, &scan, &value)) { ... }`
 int rhmap_find(const rhmap *map, uint32_t hash, uint32_t *p_scan, uint32_t *p_value);
 
+// Prefetch the first slot that `rhmap_find()` would look at for `hash`.
+// Useful for batched lookups: prefetch a number of hashes ahead before finding them.
+void rhmap_prefetch(const rhmap *map, uint32_t hash);
+
 // Insert a new entry at the iterator `hash + scan`. Use for example `rhmap_find()` to find the place to
 // insert to. If you want to unconditionally insert an entry to the map you can call `rhmap_insert()` directly
 // with a hash and `scan = 0`.
@@ -316,6 +323,17 @@ void rhmap_find_value(const rhmap *map, uint32_t hash, uint32_t *p_scan, uint32_
 
 #endif // RHMAP_NO_STDLIB
 
+#ifndef RHMAP_PREFETCH
+	#if defined(__GNUC__) || defined(__clang__)
+		#define RHMAP_PREFETCH(ptr) __builtin_prefetch(ptr)
+	#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+		#include <xmmintrin.h>
+		#define RHMAP_PREFETCH(ptr) _mm_prefetch((const char*)(ptr), _MM_HINT_T0)
+	#else
+		#define RHMAP_PREFETCH(ptr) (void)(ptr)
+	#endif
+#endif
+
 #ifdef __cplusplus
 	extern "C" {
 #endif
@@ -428,7 +446,7 @@ void *rhmap_rehash(rhmap *map, size_t count, size_t alloc_size, void *data_ptr)
 				uint32_t old_scan = (uint32_t)(new_entry & old_mask) - 1;
 				uint32_t hash = ((uint32_t)new_entry & ~old_mask) | ((i - old_scan) & old_mask);
 				uint32_t slot = hash & mask;
-				new_entry &= ~(uint64_t)mask;
+				new_entry = (new_entry & ~(uint64_t)UINT32_MAX) | (hash & ~mask);
 				uint32_t scan = 1;
 				while ((entry = entries[slot]) != 0) {
 					uint32_t entry_scan = (entry & mask);
@@ -471,6 +489,15 @@ int rhmap_find(const rhmap *map, uint32_t hash, uint32_t *p_scan, uint32_t *p_va
 	}
 }
 
+#ifdef RHMAP_DO_INLINE
+RHMAP_DO_INLINE void rhmap_prefetch_inline(const rhmap *map, uint32_t hash)
+#else
+void rhmap_prefetch(const rhmap *map, uint32_t hash)
+#endif
+{
+	RHMAP_PREFETCH(&map->entries[hash & map->mask]);
+}
+
 #ifdef RHMAP_DO_INLINE
 RHMAP_DO_INLINE void rhmap_insert_inline(rhmap *map, uint32_t hash, uint32_t scan, uint32_t value)
 #else
@@ -0,0 +1,2123 @@
+#include "../extra/rh_hash.h"
+#include "../extra/rh_journal.h"
+#include "../extra/rh_mapped.h"
+#include "../extra/rh_compress.h"
+#include "../extra/rh_diff.h"
+#include "../extra/rh_perfect.h"
+#include "../extra/rh_static.h"
+#include "../extra/rh_intern.h"
+#include "../extra/rh_join.h"
+#include "../extra/rh_group.h"
+#include "../extra/rh_lru.h"
+#include "../extra/rh_expiring.h"
+#include "../extra/rh_bloom.h"
+#include "../extra/rh_dedup.h"
+#include "../extra/rh_set_ops.h"
+#include "../extra/rh_top_k.h"
+#include "../extra/rh_grouped.h"
+#include "../extra/rh_multi_index.h"
+#include "../extra/rh_spatial.h"
+#include "../extra/rh_sparse.h"
+#include "../extra/rh_dictionary.h"
+#include "../extra/rh_blob.h"
+#include "../extra/rh_memo.h"
+#include "../extra/rh_rate_limit.h"
+
+#include <vector>
+#include <string>
+#include <map>
+#include <set>
+#include <algorithm>
+#include <list>
+#include <iterator>
+#include <stdlib.h>
+
+#define check(...) do { if (!(__VA_ARGS__)) { fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #__VA_ARGS__); return false; } } while (0)
+
+struct memory_stream {
+	std::vector<char> data;
+	size_t pos = 0;
+};
+
+rh::writer memory_writer(memory_stream &s)
+{
+	rh::writer w;
+	w.user = &s;
+	w.write = [](void *user, const void *data, size_t size) {
+		memory_stream &s = *(memory_stream*)user;
+		s.data.insert(s.data.end(), (const char*)data, (const char*)data + size);
+		return true;
+	};
+	return w;
+}
+
+rh::reader memory_reader(memory_stream &s)
+{
+	rh::reader r;
+	r.user = &s;
+	r.read = [](void *user, void *data, size_t size) {
+		memory_stream &s = *(memory_stream*)user;
+		if (s.data.size() - s.pos < size) return false;
+		if (size > 0) memcpy(data, s.data.data() + s.pos, size);
+		s.pos += size;
+		return true;
+	};
+	return r;
+}
+
+namespace rh {
+
+template <>
+struct serializer<std::string> {
+	static bool save(writer &w, const std::string &str) {
+		uint32_t size = (uint32_t)str.size();
+		return w.write(w.user, &size, sizeof(size)) && w.write(w.user, str.data(), size);
+	}
+	static bool load(reader &r, std::string *dst) {
+		uint32_t size;
+		if (!r.read(r.user, &size, sizeof(size))) return false;
+		new (dst) std::string(size, '\0');
+		if (!r.read(r.user, &(*dst)[0], size)) {
+			dst->~basic_string();
+			return false;
+		}
+		return true;
+	}
+};
+
+}
+
+bool test_save_load_array()
+{
+	rh::array<int> arr;
+	for (int i = 0; i < 1000; i++) arr.push_back(i * 7);
+
+	memory_stream s;
+	rh::writer w = memory_writer(s);
+	check(arr.save(w));
+
+	rh::array<int> loaded;
+	loaded.push_back(-1);
+	rh::reader r = memory_reader(s);
+	check(loaded.load(r));
+	check(loaded == arr);
+	check(s.pos == s.data.size());
+	return true;
+}
+
+bool test_save_load_hash_map()
+{
+	rh::hash_map<std::string, rh::array<int>> map;
+	for (int i = 0; i < 500; i++) {
+		rh::array<int> &arr = map[std::to_string(i)];
+		for (int j = 0; j < i % 5; j++) arr.push_back(j);
+	}
+	map.remove(std::string("10"));
+
+	memory_stream s;
+	rh::writer w = memory_writer(s);
+	check(map.save(w));
+
+	rh::hash_map<std::string, rh::array<int>> loaded;
+	rh::reader r = memory_reader(s);
+	check(loaded.load(r));
+	check(loaded.size() == 499);
+	check(loaded == map);
+	check(loaded.find(std::string("10")) == nullptr);
+	for (int i = 0; i < 500; i++) {
+		if (i == 10) continue;
+		auto *pair = loaded.find(std::to_string(i));
+		check(pair && pair->value.size() == (size_t)(i % 5));
+	}
+
+	// The loaded map must keep working after the index was read as-is
+	loaded[std::string("new")].push_back(1);
+	check(loaded.remove(std::string("0")));
+	check(loaded.size() == 499);
+	return true;
+}
+
+bool test_save_load_hash_set()
+{
+	rh::hash_set<uint64_t> set;
+	for (uint64_t i = 0; i < 2000; i++) set.insert(i * 0x9e3779b97f4a7c15u);
+
+	memory_stream s;
+	rh::writer w = memory_writer(s);
+	check(set.save(w));
+
+	rh::hash_set<uint64_t> loaded;
+	rh::reader r = memory_reader(s);
+	check(loaded.load(r));
+	check(loaded == set);
+	for (uint64_t i = 0; i < 2000; i++) check(loaded.find(i * 0x9e3779b97f4a7c15u));
+	return true;
+}
+
+bool test_load_truncated()
+{
+	rh::hash_map<std::string, int> map;
+	for (int i = 0; i < 100; i++) map[std::to_string(i)] = i;
+
+	memory_stream full;
+	rh::writer w = memory_writer(full);
+	check(map.save(w));
+
+	// Every truncation must fail cleanly without leaking or constructing anything
+	for (size_t size = 0; size < full.data.size(); size += 7) {
+		memory_stream s;
+		s.data.assign(full.data.begin(), full.data.begin() + size);
+		rh::hash_map<std::string, int> loaded;
+		loaded[std::string("old")] = 1;
+		rh::reader r = memory_reader(s);
+		check(!loaded.load(r));
+	}
+
+	// Loading into a map of a different value type is rejected
+	memory_stream s = full;
+	rh::hash_map<std::string, uint64_t> other;
+	rh::reader r = memory_reader(s);
+	check(!other.load(r));
+	return true;
+}
+
+bool test_load_corrupted()
+{
+	rh::hash_map<uint32_t, uint32_t> map;
+	for (uint32_t i = 0; i < 100; i++) map[i * 3] = i;
+	memory_stream full;
+	rh::writer w = memory_writer(full);
+	check(map.save(w));
+
+	// Header is 6 words followed by the index, find an occupied entry
+	const size_t header_size = 6 * sizeof(uint32_t);
+	uint32_t mask = map.raw_map().mask;
+	size_t slot = 0;
+	while (map.raw_map().entries[slot] == 0) slot++;
+	size_t entry_offset = header_size + slot * sizeof(uint64_t);
+
+	for (int corruption = 0; corruption < 4; corruption++) {
+		memory_stream s = full;
+		if (corruption == 1) {
+			uint32_t capacity = mask + 2;
+			memcpy(s.data.data() + 4 * sizeof(uint32_t), &capacity, sizeof(uint32_t));
+		} else if (corruption == 2) {
+			uint32_t index = (uint32_t)map.size() + 5;
+			memcpy(s.data.data() + entry_offset + sizeof(uint32_t), &index, sizeof(uint32_t));
+		} else if (corruption == 3) {
+			memset(s.data.data() + entry_offset, 0, sizeof(uint64_t));
+		}
+		rh::hash_map<uint32_t, uint32_t> loaded;
+		loaded[1] = 1;
+		rh::reader r = memory_reader(s);
+		bool ok = loaded.load(r);
+		check(ok == (corruption == 0));
+		check(!ok || loaded == map);
+	}
+	return true;
+}
+
+bool test_hash_buffer_unaligned()
+{
+	uint32_t words[8];
+	char bytes[sizeof(words) + 1];
+	for (uint32_t i = 0; i < 8; i++) words[i] = i * 0x01020304u + 5;
+	for (size_t size = 0; size <= sizeof(words); size++) {
+		memcpy(bytes + 1, words, size);
+		check(rh::hash_buffer_unaligned(bytes + 1, size) == rh::hash_buffer_align4(words, size));
+	}
+	return true;
+}
+
+void remove_journal_files(const char *path)
+{
+	const char *suffixes[] = { ".log", ".snap", ".snap.tmp" };
+	for (const char *suffix : suffixes) remove((std::string(path) + suffix).c_str());
+}
+
+bool test_journal_reopen()
+{
+	const char *path = "test_rh_extra_journal";
+	remove_journal_files(path);
+
+	{
+		rh::journaled_hash_map<std::string, int> map;
+		check(map.open(path));
+		for (int i = 0; i < 1000; i++) check(map.set(std::to_string(i), i));
+		for (int i = 0; i < 1000; i += 3) check(map.remove(std::to_string(i)));
+		check(map.set(std::string("1"), -1));
+		// Replay applies the records of a batch in order
+		check(map.remove(std::string("5")) && map.set(std::string("5"), 50));
+		check(map.set(std::string("3"), 30) && map.remove(std::string("3")));
+		check(map.close());
+	}
+
+	rh::journaled_hash_map<std::string, int> map;
+	check(map.open(path));
+	check(map.size() == 666);
+	for (int i = 0; i < 1000; i++) {
+		auto *pair = map.find(std::to_string(i));
+		if (i % 3 == 0) {
+			check(!pair);
+		} else {
+			check(pair && pair->value == (i == 1 ? -1 : i == 5 ? 50 : i));
+		}
+	}
+
+	// Records after a checkpoint go to a fresh log on top of the snapshot
+	check(map.checkpoint());
+	check(map.set(std::string("after"), 1));
+	check(map.remove(std::string("2")));
+	check(map.close());
+
+	rh::journaled_hash_map<std::string, int> reopened;
+	check(reopened.open(path));
+	check(reopened.map() == map.map());
+	check(reopened.find(std::string("after")));
+	check(!reopened.find(std::string("2")));
+	check(reopened.close());
+
+	remove_journal_files(path);
+	return true;
+}
+
+bool test_journal_torn_tail()
+{
+	const char *path = "test_rh_extra_journal";
+	remove_journal_files(path);
+
+	{
+		rh::journaled_hash_map<uint32_t, uint32_t> map;
+		check(map.open(path));
+		for (uint32_t i = 0; i < 100; i++) check(map.set(i, i * i));
+		check(map.close());
+	}
+
+	// Simulate a crash in the middle of writing a record
+	FILE *log = fopen((std::string(path) + ".log").c_str(), "ab");
+	check(log);
+	const char garbage[] = { 13, 0, 0, 0, 1, 2, 3, 4, 1, 9 };
+	check(fwrite(garbage, 1, sizeof(garbage), log) == sizeof(garbage));
+	fclose(log);
+
+	rh::journaled_hash_map<uint32_t, uint32_t> map;
+	check(map.open(path));
+	check(map.size() == 100);
+	for (uint32_t i = 0; i < 100; i++) check(map.find(i) && map.find(i)->value == i * i);
+
+	// The torn record was cut off so new records are readable after it
+	check(map.set(1000, 1));
+	check(map.close());
+	check(map.open(path));
+	check(map.size() == 101);
+	check(map.find(1000));
+	check(map.close());
+
+	remove_journal_files(path);
+	return true;
+}
+
+bool test_journal_write_failure()
+{
+	// The log can't be created in a directory that doesn't exist
+	rh::journal_options opts;
+	opts.sync = rh::fsync_policy::always;
+	rh::journaled_hash_map<uint32_t, uint32_t> map;
+	check(map.open("test_rh_extra_missing_dir/journal", opts));
+	check(!map.set(1, 2));
+	check(map.size() == 0);
+	check(!map.find(1));
+	check(map.close());
+	return true;
+}
+
+bool test_mapped_allocator()
+{
+	rh::mapped_allocator ator;
+	{
+		rh::hash_set<uint64_t> set(&ator);
+		for (uint64_t i = 0; i < 100000; i++) check(set.insert(i * 3).inserted);
+		check(ator.mapped_size() >= set.size() * sizeof(uint64_t));
+		for (uint64_t i = 0; i < 300000; i++) check((set.find(i) != nullptr) == (i % 3 == 0));
+
+		rh::hash_map<std::string, std::string> map(&ator);
+		for (int i = 0; i < 10000; i++) map[std::to_string(i)] = std::to_string(i * 2);
+		for (int i = 0; i < 10000; i += 2) check(map.remove(std::to_string(i)));
+		map.shrink_to_fit();
+		for (int i = 1; i < 10000; i += 2) check(map.find(std::to_string(i))->value == std::to_string(i * 2));
+	}
+	check(ator.mapped_size() == 0);
+	return true;
+}
+
+struct failing_allocator : rh::allocator
+{
+	size_t budget = 0;
+
+	failing_allocator(bool split) {
+		user = this;
+		allocate = [](void *user, size_t size) -> void* {
+			failing_allocator *self = (failing_allocator*)user;
+			if (size > self->budget) return nullptr;
+			self->budget -= size;
+			return malloc(size);
+		};
+		free = [](void *user, void *ptr, size_t size) { ::free(ptr); };
+		if (split) {
+			reallocate = [](void *user, void *ptr, size_t old_size, size_t new_size) -> void* {
+				failing_allocator *self = (failing_allocator*)user;
+				if (new_size > old_size && new_size - old_size > self->budget) return nullptr;
+				if (new_size > old_size) self->budget -= new_size - old_size;
+				return realloc(ptr, new_size);
+			};
+		}
+	}
+};
+
+template <typename T>
+bool check_allocation_failure(failing_allocator &ator, T (*make_value)(int))
+{
+	rh::hash_map<int, T> map(&ator);
+	ator.budget = 4096;
+	int count = 0;
+	for (;; count++) {
+		auto result = map.emplace(count, make_value(count));
+		if (!result.entry) break;
+		check(result.inserted);
+	}
+
+	// The map is left as it was before the failed insert
+	check(count > 0 && map.size() == (size_t)count);
+	for (int i = 0; i < count; i++) check(map.find(i) && map.find(i)->value == make_value(i));
+	check(!map.find(count));
+
+	// Reserving, copying and loading fail without touching the source or leaking
+	ator.budget = 0;
+	check(!map.reserve(map.capacity() * 2) && map.size() == (size_t)count);
+	rh::hash_map<int, T> copy(map);
+	check(copy.empty());
+	copy = map;
+	check(copy.empty());
+
+	memory_stream s;
+	rh::writer w = memory_writer(s);
+	check(map.save(w));
+	size_t index_size = ((size_t)map.raw_map().mask + 1) * sizeof(uint64_t);
+	size_t budgets[] = { 0, index_size, index_size + sizeof(map.begin()[0]) };
+	for (size_t budget : budgets) {
+		rh::hash_map<int, T> loaded(&ator);
+		ator.budget = budget;
+		s.pos = 0;
+		rh::reader r = memory_reader(s);
+		check(!loaded.load(r) && loaded.empty());
+	}
+
+	// It keeps working once memory is available again
+	ator.budget = SIZE_MAX;
+	check(map.emplace(count, make_value(count)).inserted);
+	check(map.size() == (size_t)count + 1);
+	copy = map;
+	check(copy == map);
+	return true;
+}
+
+uint64_t make_int_value(int i) { return (uint64_t)i * 7; }
+std::string make_string_value(int i) { return std::to_string(i); }
+
+bool test_allocation_failure()
+{
+	failing_allocator joined(false), split(true);
+	check(check_allocation_failure(joined, &make_int_value));
+	check(check_allocation_failure(joined, &make_string_value));
+	check(check_allocation_failure(split, &make_int_value));
+	check(check_allocation_failure(split, &make_string_value));
+	return true;
+}
+
+bool test_compress_roundtrip()
+{
+	// Mix of compressible runs, small integers and random bytes
+	std::vector<uint8_t> data(300000), packed(rh::compress_bound(data.size())), unpacked(data.size());
+	uint32_t state = 1;
+	for (size_t i = 0; i < data.size(); i++) {
+		state = state * 1664525u + 1013904223u;
+		if (i < 100000) data[i] = (uint8_t)(i / 1000);
+		else if (i < 200000) data[i] = (uint8_t)((i % 8) < 4 ? i / 8 : 0);
+		else data[i] = (uint8_t)(state >> 24);
+	}
+
+	size_t sizes[] = { 0, 1, 7, 64, 1000, data.size() };
+	size_t elem_sizes[] = { 1, 4, 8, 12 };
+	for (size_t size : sizes) {
+		for (size_t elem_size : elem_sizes) {
+			size_t packed_size = rh::compress(packed.data(), data.data(), size, elem_size);
+			check(packed_size <= rh::compress_bound(size));
+			check(rh::decompress(unpacked.data(), size, packed.data(), packed_size, elem_size));
+			check(size == 0 || !memcmp(unpacked.data(), data.data(), size));
+		}
+	}
+
+	// Runs compress well, corrupted input is rejected
+	size_t packed_size = rh::compress(packed.data(), data.data(), 100000, 1);
+	check(packed_size < 10000);
+	check(!rh::decompress(unpacked.data(), 100000, packed.data(), packed_size / 2, 1));
+	return true;
+}
+
+bool test_compressed_hash_map()
+{
+	rh::hash_map<uint32_t, uint64_t> map;
+	for (uint32_t i = 0; i < 200000; i++) map[i * 2] = (uint64_t)i << 8;
+	for (uint32_t i = 0; i < 200000; i += 5) map.remove(i * 2);
+
+	rh::compress_options opts;
+	opts.block_size = 16 * 1024;
+	opts.num_threads = 4;
+
+	memory_stream s;
+	rh::writer w = memory_writer(s);
+	check(rh::save_compressed(w, map, opts));
+	check(s.data.size() < map.size() * sizeof(uint64_t) * 2);
+
+	rh::hash_map<uint32_t, uint64_t> loaded;
+	loaded[1] = 1;
+	rh::reader r = memory_reader(s);
+	check(rh::load_compressed(r, loaded, opts));
+	check(loaded == map);
+	for (uint32_t i = 0; i < 200000; i++) {
+		auto *pair = loaded.find(i * 2);
+		if (i % 5 == 0) check(!pair); else check(pair && pair->value == (uint64_t)i << 8);
+	}
+	loaded[1] = 1;
+
+	// Truncated snapshots fail to load
+	memory_stream truncated;
+	truncated.data.assign(s.data.begin(), s.data.begin() + s.data.size() / 2);
+	rh::hash_map<uint32_t, uint64_t> partial;
+	rh::reader tr = memory_reader(truncated);
+	check(!rh::load_compressed(tr, partial, opts));
+	return true;
+}
+
+bool test_compressed_hash_set()
+{
+	rh::hash_set<uint64_t> set;
+	memory_stream empty_stream;
+	rh::writer ew = memory_writer(empty_stream);
+	check(rh::save_compressed(ew, set));
+	rh::reader er = memory_reader(empty_stream);
+	check(rh::load_compressed(er, set));
+	check(set.size() == 0);
+
+	for (uint64_t i = 0; i < 50000; i++) set.insert(i * 0x9e3779b97f4a7c15u);
+	memory_stream s;
+	rh::writer w = memory_writer(s);
+	check(rh::save_compressed(w, set));
+	rh::hash_set<uint64_t> loaded;
+	rh::reader r = memory_reader(s);
+	check(rh::load_compressed(r, loaded));
+	check(loaded == set);
+	return true;
+}
+
+template <typename K, typename V>
+bool check_map_equals(const rh::hash_map<K, V> &map, const std::map<K, V> &ref)
+{
+	check(map.size() == ref.size());
+	for (auto &pair : ref) {
+		auto *found = map.find(pair.first);
+		check(found && found->value == pair.second);
+	}
+	return true;
+}
+
+bool check_diff(const rh::hash_map<uint32_t, uint32_t> &old_map, const rh::hash_map<uint32_t, uint32_t> &new_map)
+{
+	std::map<uint32_t, uint32_t> old_ref, new_ref;
+	for (auto &pair : old_map) old_ref[pair.key] = pair.value;
+	for (auto &pair : new_map) new_ref[pair.key] = pair.value;
+
+	std::map<uint32_t, uint32_t> ref_inserts, ref_updates, inserts, updates;
+	std::set<uint32_t> ref_removes, removes;
+	for (auto &pair : new_ref) {
+		auto it = old_ref.find(pair.first);
+		if (it == old_ref.end()) ref_inserts.insert(pair);
+		else if (it->second != pair.second) ref_updates.insert(pair);
+	}
+	for (auto &pair : old_ref) {
+		if (!new_ref.count(pair.first)) ref_removes.insert(pair.first);
+	}
+
+	rh::delta<uint32_t, uint32_t> changes = rh::diff(old_map, new_map);
+	for (auto &pair : changes.inserts) check(inserts.emplace(pair.key, pair.value).second);
+	for (auto &pair : changes.updates) check(updates.emplace(pair.key, pair.value).second);
+	for (uint32_t key : changes.removes) check(removes.insert(key).second);
+	check(inserts == ref_inserts);
+	check(updates == ref_updates);
+	check(removes == ref_removes);
+
+	rh::hash_map<uint32_t, uint32_t> applied = old_map;
+	rh::apply(applied, changes);
+	check(check_map_equals(applied, new_ref));
+
+	// The delta survives serialization
+	memory_stream s;
+	rh::writer w = memory_writer(s);
+	check(changes.save(w));
+	rh::delta<uint32_t, uint32_t> loaded;
+	rh::reader r = memory_reader(s);
+	check(loaded.load(r));
+	check(loaded.size() == changes.size());
+	return true;
+}
+
+bool test_diff_apply()
+{
+	uint32_t state = 1;
+	auto next = [&]() { state = state * 1664525u + 1013904223u; return state >> 8; };
+
+	for (uint32_t round = 0; round < 20; round++) {
+		rh::hash_map<uint32_t, uint32_t> old_map, new_map;
+		uint32_t num = 10 + round * round * 50;
+		for (uint32_t i = 0; i < num; i++) old_map[next() % (num * 2)] = next();
+		new_map = old_map;
+		for (uint32_t i = 0; i < num / 4; i++) {
+			uint32_t key = next() % (num * 2);
+			switch (next() % 4) {
+			case 0: new_map.remove(key); break;
+			case 1: new_map[key] = next(); break;
+			case 2: if (auto *pair = new_map.find(key)) pair->value++; break;
+			default: new_map[key + num * 2] = 1; break;
+			}
+		}
+
+		// Equal capacities take the slot order merge, growing one of them the lookup path
+		if (round % 2 == 1) new_map.reserve(new_map.capacity() * 4);
+		check(check_diff(old_map, new_map));
+		check(check_diff(new_map, old_map));
+	}
+
+	rh::hash_map<uint32_t, uint32_t> empty, map;
+	for (uint32_t i = 0; i < 100; i++) map[i] = i;
+	check(check_diff(empty, map));
+	check(check_diff(map, empty));
+	check(rh::diff(map, map).empty());
+	return true;
+}
+
+struct seeded_hash {
+	uint32_t seed = 0;
+	uint32_t operator()(uint32_t v) const { return rh::hash(v ^ seed); }
+};
+
+struct low_byte_hash {
+	uint32_t operator()(uint32_t v) const { return v % 200 < 100 ? v & 0xff : rh::hash(v); }
+};
+
+template <typename Hash>
+bool check_perfect_map(const rh::hash_map<uint32_t, uint32_t, Hash> &map, uint32_t num)
+{
+	auto perfect = rh::perfect_map<uint32_t, uint32_t, Hash>::build(map);
+	check(perfect.size() == map.size());
+	for (uint32_t i = 0; i < num; i++) {
+		auto *pair = perfect.find(i * 3);
+		check(pair && pair->key == i * 3 && pair->value == i);
+		check(!perfect.find(i * 3 + 1));
+	}
+	size_t count = perfect.overflow_map().size();
+	for (auto &pair : perfect) {
+		check(map.find(pair.key)->value == pair.value);
+		count++;
+	}
+	check(count == map.size());
+	return true;
+}
+
+bool test_perfect_map()
+{
+	rh::hash_map<uint32_t, uint32_t> empty;
+	check(rh::perfect_map<uint32_t, uint32_t>::build(empty).find(1) == nullptr);
+
+	for (uint32_t num : { 1u, 5u, 100u, 50000u }) {
+		rh::hash_map<uint32_t, uint32_t> map;
+		for (uint32_t i = 0; i < num; i++) map[i * 3] = i;
+		check(check_perfect_map(map, num));
+	}
+
+	// Lookups must use the same stateful hash function as the source map
+	seeded_hash hash_fn;
+	hash_fn.seed = 0x12345678;
+	rh::hash_map<uint32_t, uint32_t, seeded_hash> seeded(hash_fn);
+	for (uint32_t i = 0; i < 10000; i++) seeded[i * 3] = i;
+	check(check_perfect_map(seeded, 10000));
+
+	// Keys sharing a full hash go to the overflow map
+	rh::hash_map<uint32_t, uint32_t, low_byte_hash> colliding;
+	for (uint32_t i = 0; i < 10000; i++) colliding[i * 3] = i;
+	check(check_perfect_map(colliding, 10000));
+	auto perfect = rh::perfect_map<uint32_t, uint32_t, low_byte_hash>::build(colliding);
+	check(perfect.overflow_map().size() > 0);
+	return true;
+}
+
+enum class static_color : int16_t { red = -1, green = 1 };
+
+static constexpr auto static_opcodes = rh::make_static_map<rh::static_str, int>({
+	{ "add", 1 }, { "sub", 2 }, { "mul", 3 }, { "div", 4 }, { "load", 5 }, { "store", 6 },
+});
+static_assert(static_opcodes.find("mul")->value == 3, "constexpr lookup");
+static_assert(!static_opcodes.contains("mod"), "constexpr miss");
+
+static constexpr rh::static_map<int, int, 0> static_empty;
+static_assert(static_empty.empty() && !static_empty.contains(0), "empty static_map");
+
+bool test_static_map()
+{
+	check(rh::static_hash<bool>()(true) == rh::hash(true));
+	check(rh::static_hash<bool>()(false) == rh::hash(false));
+	check(rh::static_hash<char>()((char)-1) == rh::hash((char)-1));
+	check(rh::static_hash<int8_t>()(-1) == rh::hash((int8_t)-1));
+	check(rh::static_hash<uint8_t>()(200) == rh::hash((uint8_t)200));
+	check(rh::static_hash<int16_t>()(-1) == rh::hash((int16_t)-1));
+	check(rh::static_hash<uint16_t>()(60000) == rh::hash((uint16_t)60000));
+	check(rh::static_hash<int32_t>()(-5) == rh::hash((int32_t)-5));
+	check(rh::static_hash<uint32_t>()(0xdeadbeefu) == rh::hash((uint32_t)0xdeadbeefu));
+	check(rh::static_hash<int64_t>()(-7) == rh::hash((int64_t)-7));
+	check(rh::static_hash<uint64_t>()(UINT64_C(0x123456789abcdef)) == rh::hash(UINT64_C(0x123456789abcdef)));
+	check(rh::static_hash<static_color>()(static_color::red) == rh::hash((int16_t)-1));
+
+	const char *strs[] = { "", "a", "abc", "abcd", "abcdefg", "abcdefgh", "hello world" };
+	for (const char *str : strs) {
+		size_t len = strlen(str);
+		check(rh::static_hash<rh::static_str>()(rh::static_str(str, len)) == rh::hash_buffer_unaligned(str, len));
+	}
+
+	check(static_opcodes.size() == 6);
+	for (const auto &pair : static_opcodes) {
+		check(static_opcodes.find(pair.key) == &pair);
+	}
+	check(static_opcodes.find("load")->value == 5);
+	check(static_opcodes.find("loa") == nullptr);
+	check(static_empty.find(1) == nullptr);
+	check(static_empty.begin() == static_empty.end());
+	return true;
+}
+
+bool test_string_interner()
+{
+	// Slices at odd offsets of one buffer exercise unaligned hashing
+	std::string text;
+	for (uint32_t i = 0; i < 3000; i++) text += "w" + std::to_string(i * 7919u % 100003u) + " ";
+	std::vector<std::string> words;
+	std::vector<uint32_t> ids;
+	std::map<std::string, uint32_t> ref;
+
+	rh::string_interner interner;
+	check(interner.find("w0") == rh::string_interner::invalid_id);
+	size_t begin = 0;
+	while (begin < text.size()) {
+		size_t end = text.find(' ', begin);
+		const char *word = text.data() + begin;
+		uint32_t id = interner.intern(word, end - begin);
+		auto it = ref.find(text.substr(begin, end - begin));
+		if (it == ref.end()) {
+			check(id == ref.size());
+			ref[text.substr(begin, end - begin)] = id;
+		} else {
+			check(id == it->second);
+		}
+		words.push_back(text.substr(begin, end - begin));
+		ids.push_back(id);
+		begin = end + 1;
+	}
+	check(interner.size() == ref.size());
+
+	// Data pointers stay put while the index grows
+	const char *first = interner.data(0);
+	check(interner.intern("") == ref.size());
+	for (uint32_t i = 0; i < 5000; i++) interner.intern("extra" + std::to_string(i));
+	check(interner.data(0) == first);
+
+	for (size_t i = 0; i < words.size(); i++) {
+		check(interner.find(words[i]) == ids[i]);
+		check(interner.length(ids[i]) == words[i].size());
+		check(!strcmp(interner.data(ids[i]), words[i].c_str()));
+	}
+	check(interner.find("") == ref.size());
+	check(interner.find("missing") == rh::string_interner::invalid_id);
+
+	std::string padded = "." + words[0];
+	check(rh::string_interner::hash_string(padded.data() + 1, words[0].size()) == rh::string_interner::hash_string(words[0].data(), words[0].size()));
+	check(interner.find(padded.data() + 1, words[0].size()) == ids[0]);
+
+	rh::string_interner moved = std::move(interner);
+	check(interner.empty());
+	check(moved.find(words[1]) == ids[1]);
+	check(moved.arena_size() > 0);
+
+	moved.clear();
+	check(moved.empty() && moved.arena_size() == 0);
+	check(moved.find(words[1]) == rh::string_interner::invalid_id);
+	check(moved.intern(words[1]) == 0);
+	return true;
+}
+
+template <typename K>
+bool check_join(rh::hash_join<K> &join, const std::vector<K> &build, const std::vector<K> &probe, uint32_t build_offset, uint32_t probe_offset)
+{
+	join.build(build.data(), build.size(), build_offset);
+	check(join.build_size() == build.size());
+	rh::array<rh::join_pair> pairs = join.probe(probe.data(), probe.size(), probe_offset);
+
+	std::vector<std::pair<uint32_t, uint32_t>> result, ref;
+	for (const rh::join_pair &pair : pairs) result.emplace_back(pair.build_row, pair.probe_row);
+	for (size_t b = 0; b < build.size(); b++) {
+		for (size_t p = 0; p < probe.size(); p++) {
+			if (build[b] == probe[p]) ref.emplace_back(build_offset + (uint32_t)b, probe_offset + (uint32_t)p);
+		}
+	}
+	std::sort(result.begin(), result.end());
+	std::sort(ref.begin(), ref.end());
+	check(result == ref);
+	return true;
+}
+
+bool test_hash_join()
+{
+	std::vector<uint32_t> build, probe;
+	srand(7);
+	for (uint32_t i = 0; i < 1500; i++) build.push_back((uint32_t)rand() % 700);
+	for (uint32_t i = 0; i < 1200; i++) probe.push_back((uint32_t)rand() % 1000);
+
+	rh::hash_join<uint32_t> join;
+	check(check_join(join, build, probe, 0, 0));
+	check(join.num_partitions() == 1);
+
+	// Unpartitioned probes keep the probe row order
+	rh::array<rh::join_pair> pairs = join.probe(probe.data(), probe.size());
+	for (size_t i = 1; i < pairs.size(); i++) check(pairs[i - 1].probe_row <= pairs[i].probe_row);
+
+	rh::join_options opts;
+	opts.partition_rows = 100;
+	opts.max_partition_bits = 3;
+	opts.prefetch_distance = 4;
+	rh::hash_join<uint32_t> partitioned(opts);
+	check(check_join(partitioned, build, probe, 10, 20000));
+	check(partitioned.num_partitions() == 8);
+
+	// Rebuilding replaces the previous build side
+	std::vector<uint32_t> small = { 1, 1, 2 };
+	check(check_join(partitioned, small, probe, 0, 0));
+	check(partitioned.num_partitions() == 1);
+
+	std::vector<uint32_t> none;
+	check(check_join(join, none, probe, 0, 0));
+	check(check_join(join, build, none, 0, 0));
+
+	std::vector<std::string> sbuild, sprobe;
+	for (uint32_t i = 0; i < 300; i++) sbuild.push_back("key" + std::to_string(i % 120));
+	for (uint32_t i = 0; i < 300; i++) sprobe.push_back("key" + std::to_string(i % 150));
+	rh::hash_join<std::string> sjoin(opts);
+	check(check_join(sjoin, sbuild, sprobe, 0, 0));
+	return true;
+}
+
+template <typename Group>
+bool check_group_by(Group &g, const std::vector<uint32_t> &keys, const std::vector<int64_t> &amounts)
+{
+	struct group_ref { uint32_t first; int64_t sum; uint64_t count; int64_t min, max; };
+	std::map<uint32_t, group_ref> ref;
+	for (size_t i = 0; i < keys.size(); i++) {
+		auto it = ref.find(keys[i]);
+		if (it == ref.end()) {
+			uint32_t id = (uint32_t)ref.size();
+			ref[keys[i]] = group_ref{ id, amounts[i], 1, amounts[i], amounts[i] };
+		} else {
+			group_ref &r = it->second;
+			r.sum += amounts[i];
+			r.count++;
+			r.min = std::min(r.min, amounts[i]);
+			r.max = std::max(r.max, amounts[i]);
+		}
+	}
+
+	// Split the rows unevenly over several calls
+	size_t done = 0;
+	for (size_t step = 1; done < keys.size(); step = step * 3 + 1) {
+		size_t num = std::min(step, keys.size() - done);
+		g.add(keys.data() + done, num, amounts.data() + done, nullptr, amounts.data() + done, amounts.data() + done);
+		done += num;
+	}
+
+	check(g.size() == ref.size());
+	for (auto &pair : ref) {
+		const group_ref &r = pair.second;
+		uint32_t id = g.find(pair.first);
+		check(id == r.first);
+		check(g.keys()[id] == pair.first);
+		check(g.template result<0>()[id] == r.sum);
+		check(g.template result<1>()[id] == r.count);
+		check(g.template result<2>()[id] == r.min);
+		check(g.template result<3>()[id] == r.max);
+	}
+	check(g.find(UINT32_MAX) == UINT32_MAX);
+	return true;
+}
+
+bool test_group_by()
+{
+	std::vector<uint32_t> keys;
+	std::vector<int64_t> amounts;
+	srand(11);
+	for (uint32_t i = 0; i < 5000; i++) {
+		keys.push_back((uint32_t)rand() % 900);
+		amounts.push_back((int64_t)(rand() % 2001) - 1000);
+	}
+
+	rh::group_by<uint32_t, rh::agg_sum<int64_t>, rh::agg_count, rh::agg_min<int64_t>, rh::agg_max<int64_t>> g;
+	check(check_group_by(g, keys, amounts));
+	g.clear();
+	check(g.empty());
+	check(g.find(keys[0]) == UINT32_MAX);
+	check(check_group_by(g, keys, amounts));
+
+	// Colliding custom hash
+	rh::basic_group_by<uint32_t, low_byte_hash, rh::agg_sum<int64_t>, rh::agg_count, rh::agg_min<int64_t>, rh::agg_max<int64_t>> lg;
+	check(check_group_by(lg, keys, amounts));
+
+	seeded_hash seeded;
+	seeded.seed = 1234;
+	rh::basic_group_by<uint32_t, seeded_hash, rh::agg_sum<int64_t>, rh::agg_count, rh::agg_min<int64_t>, rh::agg_max<int64_t>> sg(&rh::stdlib_allocator, seeded);
+	check(sg.hash_function().seed == 1234);
+	check(check_group_by(sg, keys, amounts));
+	return true;
+}
+
+// `ref` holds the keys from most to least recently used
+bool check_lru_order(const rh::lru_cache<std::string, std::string> &cache, const std::list<std::pair<std::string, std::string>> &ref)
+{
+	check(cache.size() == ref.size());
+	const auto *vals = cache.map().begin();
+	uint32_t index = cache.most_recent(), prev = rh::lru_cache<std::string, std::string>::nil;
+	for (auto &pair : ref) {
+		check(index != rh::lru_cache<std::string, std::string>::nil);
+		check(vals[index].key == pair.first);
+		check(vals[index].value.value == pair.second);
+		check(vals[index].value.prev == prev);
+		prev = index;
+		index = vals[index].value.next;
+	}
+	check(index == rh::lru_cache<std::string, std::string>::nil);
+	check(cache.least_recent() == prev);
+	return true;
+}
+
+bool test_lru_cache()
+{
+	const size_t capacity = 50;
+	rh::lru_cache<std::string, std::string> cache(capacity);
+	std::list<std::pair<std::string, std::string>> ref;
+	auto ref_find = [&](const std::string &key) {
+		return std::find_if(ref.begin(), ref.end(), [&](const std::pair<std::string, std::string> &p) { return p.first == key; });
+	};
+
+	// Long keys and values so that a moved-from string is noticed
+	srand(3);
+	for (uint32_t i = 0; i < 20000; i++) {
+		std::string key = "a fairly long key that does not fit inline " + std::to_string(rand() % 120);
+		switch (rand() % 4) {
+		case 0: case 1: {
+			std::string value = "value " + std::to_string(i) + " padded past the small string buffer";
+			auto it = ref_find(key);
+			if (it != ref.end()) {
+				ref.erase(it);
+			} else if (ref.size() == capacity) {
+				ref.pop_back();
+			}
+			ref.emplace_front(key, value);
+			check(cache.put(key, value) == value);
+		} break;
+		case 2: {
+			auto it = ref_find(key);
+			std::string *value = cache.get(key);
+			check((value != nullptr) == (it != ref.end()));
+			if (value) {
+				check(*value == it->second);
+				ref.splice(ref.begin(), ref, it);
+			}
+		} break;
+		default:
+			if (rand() % 2) {
+				auto it = ref_find(key);
+				check(cache.remove(key) == (it != ref.end()));
+				if (it != ref.end()) ref.erase(it);
+			} else {
+				std::string evicted_key, evicted_value;
+				check(cache.evict(&evicted_key, &evicted_value) == !ref.empty());
+				if (!ref.empty()) {
+					check(evicted_key == ref.back().first);
+					check(evicted_value == ref.back().second);
+					check(!cache.contains(evicted_key));
+					ref.pop_back();
+				}
+			}
+			break;
+		}
+		if (i % 97 == 0) check(check_lru_order(cache, ref));
+	}
+	check(check_lru_order(cache, ref));
+
+	// peek() doesn't touch the recency
+	if (!ref.empty()) {
+		check(*cache.peek(ref.back().first) == ref.back().second);
+		check(check_lru_order(cache, ref));
+	}
+
+	cache.set_capacity(10);
+	while (ref.size() > 10) ref.pop_back();
+	check(check_lru_order(cache, ref));
+
+	cache.clear();
+	check(cache.empty());
+	check(!cache.evict());
+	return true;
+}
+
+bool test_expiring_map()
+{
+	// Reference of key -> (value, deadline)
+	std::map<uint32_t, std::pair<uint32_t, uint64_t>> ref;
+	rh::expiring_map<uint32_t, uint32_t> map(1000);
+	uint64_t now = 1000;
+
+	uint64_t state = 5;
+	auto next = [&]() { state = state * UINT64_C(6364136223846793005) + 1442695040888963407u; return state >> 20; };
+	// Mostly short timeouts with some spanning several wheel levels
+	auto timeout = [&]() -> uint64_t {
+		switch (next() % 4) {
+		case 0: return 1 + next() % 64;
+		case 1: return 1 + next() % 5000;
+		case 2: return 1 + next() % 1000000;
+		default: return 1 + next() % UINT64_C(100000000000);
+		}
+	};
+
+	for (uint32_t i = 0; i < 30000; i++) {
+		uint32_t key = (uint32_t)(next() % 2000);
+		auto it = ref.find(key);
+		bool live = it != ref.end() && it->second.second > now;
+		switch (next() % 6) {
+		case 0: case 1: {
+			uint64_t deadline = now + timeout();
+			check(map.put(key, i, deadline) == i);
+			ref[key] = std::make_pair(i, deadline);
+		} break;
+		case 2: {
+			uint64_t deadline = now + timeout();
+			bool was_live = live;
+			uint32_t &value = map.update(key, [&](uint32_t &v, bool inserted) {
+				if (inserted) v = 0;
+				v++;
+				return deadline;
+			});
+			uint32_t expected = was_live ? it->second.first + 1 : 1;
+			check(value == expected);
+			ref[key] = std::make_pair(expected, deadline);
+		} break;
+		case 3: {
+			uint64_t deadline = now + timeout();
+			check(map.expire_at(key, deadline) == live);
+			if (live) it->second.second = deadline;
+		} break;
+		case 4: {
+			check(map.remove(key) == (it != ref.end()));
+			if (it != ref.end()) ref.erase(it);
+		} break;
+		default: {
+			uint64_t target = now + (next() % 8 == 0 ? timeout() : next() % 100);
+			uint64_t last_deadline = 0;
+			size_t expired_count = 0;
+			bool ok = true;
+			size_t removed = map.advance(target, [&](const uint32_t &k, uint32_t &v) {
+				auto r = ref.find(k);
+				// Expired entries come out in deadline order
+				if (r == ref.end() || r->second.first != v || r->second.second > target || r->second.second < last_deadline) ok = false;
+				if (r != ref.end()) {
+					last_deadline = r->second.second;
+					ref.erase(r);
+				}
+				expired_count++;
+			});
+			check(ok);
+			check(removed == expired_count);
+			now = target;
+			check(map.now() == now);
+			for (auto &pair : ref) check(pair.second.second > now);
+		} break;
+		}
+
+		check(map.size() == ref.size());
+		uint32_t probe = (uint32_t)(next() % 2000);
+		auto r = ref.find(probe);
+		const uint32_t *value = map.find(probe);
+		if (r != ref.end() && r->second.second > now) {
+			check(value && *value == r->second.first);
+		} else {
+			check(value == nullptr);
+		}
+	}
+
+	// Everything expires eventually
+	size_t count = ref.size();
+	check(map.advance(UINT64_MAX) == count);
+	check(map.empty());
+	return true;
+}
+
+bool test_bloom()
+{
+	rh::blocked_bloom filter;
+	check(!filter.maybe_contains(rh::hash(1u)));
+	filter.init(10000);
+	check(filter.size_in_bytes() == 10000 * 12 / 8 + 40);
+	for (uint32_t i = 0; i < 10000; i++) filter.add(rh::hash(i));
+	for (uint32_t i = 0; i < 10000; i++) check(filter.maybe_contains(rh::hash(i)));
+	uint32_t false_positives = 0;
+	for (uint32_t i = 10000; i < 110000; i++) false_positives += filter.maybe_contains(rh::hash(i));
+	check(false_positives < 100000 / 50);
+	filter.clear();
+	check(!filter.maybe_contains(rh::hash(1u)));
+
+	rh::bloom_hash_set<uint32_t> set;
+	std::set<uint32_t> ref;
+	check(!set.contains(0));
+	srand(17);
+	for (uint32_t i = 0; i < 20000; i++) {
+		uint32_t value = (uint32_t)rand() % 30000;
+		if (rand() % 4 == 0) {
+			check(set.remove(value) == (ref.erase(value) > 0));
+		} else {
+			check(set.insert(value).inserted == ref.insert(value).second);
+		}
+	}
+	check(set.size() == ref.size());
+	for (uint32_t i = 0; i < 30000; i++) check(set.contains(i) == (ref.count(i) > 0));
+	set.reserve(100000);
+	for (uint32_t value : ref) check(set.find(value) && *set.find(value) == value);
+	set.clear();
+	check(set.empty() && !set.contains(*ref.begin()));
+	check(set.insert(5).inserted && set.contains(5));
+
+	rh::bloom_hash_map<std::string, uint32_t> map;
+	std::map<std::string, uint32_t> map_ref;
+	for (uint32_t i = 0; i < 5000; i++) {
+		std::string key = "key" + std::to_string((uint32_t)rand() % 3000);
+		if (i % 5 == 0) {
+			check(map.remove(key) == (map_ref.erase(key) > 0));
+		} else if (i % 2 == 0) {
+			map[key] = i;
+			map_ref[key] = i;
+		} else {
+			check(map.emplace(key, i).inserted == map_ref.emplace(key, i).second);
+		}
+	}
+	check(map.size() == map_ref.size());
+	for (uint32_t i = 0; i < 3000; i++) {
+		std::string key = "key" + std::to_string(i);
+		auto it = map_ref.find(key);
+		const auto *pair = ((const rh::bloom_hash_map<std::string, uint32_t>&)map).find(key);
+		if (it == map_ref.end()) {
+			check(pair == nullptr);
+		} else {
+			check(pair && pair->value == it->second);
+		}
+	}
+	return true;
+}
+
+bool check_dedup(const std::string &input, const rh::dedup_options &opts, size_t chunk_size, bool expect_spill)
+{
+	std::vector<std::string> records;
+	size_t begin = 0;
+	while (begin < input.size()) {
+		size_t end = input.find(opts.separator, begin);
+		if (end == std::string::npos) end = input.size();
+		records.push_back(input.substr(begin, end - begin));
+		begin = end + 1;
+	}
+	std::set<std::string> unique(records.begin(), records.end());
+
+	memory_stream s;
+	{
+		rh::dedup_stream dedup(memory_writer(s), opts);
+		for (size_t pos = 0; pos < input.size(); pos += chunk_size) {
+			check(dedup.push(input.data() + pos, std::min(chunk_size, input.size() - pos)));
+		}
+		check(dedup.finish());
+		check(dedup.num_input() == records.size());
+		check(dedup.num_output() == unique.size());
+		check((dedup.num_spilled() > 0) == expect_spill);
+	}
+
+	std::vector<std::string> output;
+	std::string out(s.data.begin(), s.data.end());
+	begin = 0;
+	while (begin < out.size()) {
+		size_t end = out.find(opts.separator, begin);
+		check(end != std::string::npos);
+		output.push_back(out.substr(begin, end - begin));
+		begin = end + 1;
+	}
+	check(output.size() == unique.size());
+	check(std::set<std::string>(output.begin(), output.end()) == unique);
+
+	// Without spilling the first occurrences come out in input order
+	if (!expect_spill) {
+		std::vector<std::string> first;
+		std::set<std::string> emitted;
+		for (const std::string &r : records) if (emitted.insert(r).second) first.push_back(r);
+		check(output == first);
+	}
+	return true;
+}
+
+bool test_dedup_stream()
+{
+	std::string input;
+	srand(23);
+	for (uint32_t i = 0; i < 60000; i++) {
+		input += "record-" + std::to_string((uint32_t)rand() % 20000);
+		if (i % 7 == 0) input += "-with-a-longer-tail";
+		input += "\n";
+	}
+	input += "trailing-without-separator";
+
+	rh::dedup_options opts;
+	check(check_dedup(input, opts, input.size(), false));
+	check(check_dedup(input, opts, 1000, false));
+	check(check_dedup(input, opts, 7, false));
+
+	// Partitions still exceed the limit and are spilled again
+	opts.num_partitions = 4;
+	opts.max_memory = 200 * 1024;
+	check(check_dedup(input, opts, 4096, true));
+	opts.num_partitions = 64;
+	check(check_dedup(input, opts, 333, true));
+
+	// Only one record fits per level
+	std::string small = input.substr(0, input.find("\n", 8000) + 1);
+	opts.num_partitions = 8;
+	opts.max_memory = 0;
+	check(check_dedup(small, opts, 4096, true));
+
+	std::string commas = "a,b,a,,c,b,";
+	rh::dedup_options comma_opts;
+	comma_opts.separator = ',';
+	check(check_dedup(commas, comma_opts, 3, false));
+	comma_opts.max_memory = 0;
+	check(check_dedup(commas, comma_opts, 3, true));
+
+	// push_file() maps the input
+	const char *path = "test_rh_extra_dedup.txt";
+	FILE *f = fopen(path, "wb");
+	check(f != nullptr);
+	check(fwrite(input.data(), 1, input.size(), f) == input.size());
+	fclose(f);
+	memory_stream s;
+	{
+		rh::dedup_stream dedup(memory_writer(s));
+		check(dedup.push_file(path));
+		check(dedup.finish());
+		check(dedup.num_input() == 60001);
+	}
+	remove(path);
+	memory_stream ref;
+	{
+		rh::dedup_stream dedup(memory_writer(ref));
+		check(dedup.push(input.data(), input.size()));
+		check(dedup.finish());
+	}
+	check(s.data == ref.data);
+	return true;
+}
+
+template <typename Hash>
+bool check_set_equals(const rh::hash_set<uint32_t, Hash> &set, const std::set<uint32_t> &ref)
+{
+	check(set.size() == ref.size());
+	for (uint32_t value : ref) check(set.find(value) != nullptr);
+	return true;
+}
+
+template <typename Hash>
+bool check_set_ops(const rh::hash_set<uint32_t, Hash> &a, const rh::hash_set<uint32_t, Hash> &b)
+{
+	std::set<uint32_t> ra(a.begin(), a.end()), rb(b.begin(), b.end()), ref;
+
+	ref.clear();
+	std::set_intersection(ra.begin(), ra.end(), rb.begin(), rb.end(), std::inserter(ref, ref.end()));
+	check(check_set_equals(rh::set_intersection(a, b), ref));
+	check(check_set_equals(rh::set_intersection(b, a), ref));
+
+	ref.clear();
+	std::set_union(ra.begin(), ra.end(), rb.begin(), rb.end(), std::inserter(ref, ref.end()));
+	check(check_set_equals(rh::set_union(a, b), ref));
+	check(check_set_equals(rh::set_union(b, a), ref));
+
+	ref.clear();
+	std::set_difference(ra.begin(), ra.end(), rb.begin(), rb.end(), std::inserter(ref, ref.end()));
+	check(check_set_equals(rh::set_difference(a, b), ref));
+	ref.clear();
+	std::set_difference(rb.begin(), rb.end(), ra.begin(), ra.end(), std::inserter(ref, ref.end()));
+	check(check_set_equals(rh::set_difference(b, a), ref));
+
+	check(rh::is_subset(a, b) == std::includes(rb.begin(), rb.end(), ra.begin(), ra.end()));
+	check(rh::is_subset(b, a) == std::includes(ra.begin(), ra.end(), rb.begin(), rb.end()));
+
+	// The result set is cleared before use
+	rh::hash_set<uint32_t, Hash> result(a.hash_function());
+	result.insert(UINT32_MAX);
+	rh::set_intersection(result, a, b);
+	check(!result.find(UINT32_MAX) || (ra.count(UINT32_MAX) && rb.count(UINT32_MAX)));
+	ref.clear();
+	std::set_union(ra.begin(), ra.end(), rb.begin(), rb.end(), std::inserter(ref, ref.end()));
+	rh::set_union(result, a, b);
+	check(check_set_equals(result, ref));
+
+	std::vector<uint32_t> probes(rb.begin(), rb.end());
+	probes.push_back(UINT32_MAX - 1);
+	size_t calls = 0;
+	bool ok = true;
+	rh::find_batched(a, probes.data(), probes.size(), [&](const uint32_t &value, bool found) {
+		if (value != probes[calls] || found != (ra.count(value) > 0)) ok = false;
+		calls++;
+		return true;
+	});
+	check(ok && calls == probes.size());
+	return true;
+}
+
+template <typename Hash>
+bool check_set_ops_random(uint32_t seed)
+{
+	srand(seed);
+	for (uint32_t round = 0; round < 30; round++) {
+		rh::hash_set<uint32_t, Hash> a, b;
+		uint32_t range = 50 + round * 200;
+		uint32_t num_a = (uint32_t)rand() % (range / 2), num_b = (uint32_t)rand() % range;
+		for (uint32_t i = 0; i < num_a; i++) a.insert((uint32_t)rand() % range);
+		for (uint32_t i = 0; i < num_b; i++) b.insert((uint32_t)rand() % range);
+		// Odd rounds merge in slot order, even ones use lookups
+		if (round % 2 == 1) {
+			size_t capacity = std::max(a.capacity(), b.capacity());
+			a.reserve(capacity);
+			b.reserve(capacity);
+			check(a.raw_map().mask == b.raw_map().mask);
+		} else {
+			a.reserve(a.capacity() * 2 + 16);
+		}
+		check(check_set_ops(a, b));
+	}
+
+	rh::hash_set<uint32_t, Hash> empty, some, subset;
+	for (uint32_t i = 0; i < 100; i++) some.insert(i * 3);
+	for (uint32_t i = 0; i < 100; i += 4) subset.insert(i * 3);
+	check(check_set_ops(empty, some));
+	check(check_set_ops(some, some));
+	check(check_set_ops(subset, some));
+	check(rh::is_subset(empty, some));
+	check(rh::is_subset(subset, some));
+	check(!rh::is_subset(some, subset));
+	return true;
+}
+
+struct few_hashes {
+	uint32_t operator()(uint32_t v) const { return rh::hash(v % 16); }
+};
+
+bool test_set_ops()
+{
+	check(check_set_ops_random<rh::default_hash<uint32_t>>(29));
+	check(check_set_ops_random<low_byte_hash>(31));
+	// Groups of more than 64 equal hashes take the fallback lookups of the slot order merge
+	check(check_set_ops_random<few_hashes>(37));
+	return true;
+}
+
+bool test_top_k()
+{
+	const size_t capacity = 64;
+	rh::top_k<uint32_t> sketch(capacity);
+	std::map<uint32_t, uint64_t> ref;
+	uint64_t total = 0;
+
+	// Skewed stream where a few keys dominate
+	srand(41);
+	for (uint32_t i = 0; i < 50000; i++) {
+		uint32_t r = (uint32_t)rand();
+		uint32_t key = r % 3 == 0 ? r % 8 : r % 2 == 0 ? 100 + r % 100 : 1000 + r % 20000;
+		uint64_t count = i % 10 == 0 ? 3 : 1;
+		sketch.add(key, count);
+		ref[key] += count;
+		total += count;
+	}
+	check(sketch.total_count() == total);
+	check(sketch.size() == capacity);
+
+	rh::array<rh::top_k_entry<uint32_t>> all = sketch.top(capacity * 2);
+	check(all.size() == capacity);
+	uint64_t sum = 0;
+	for (size_t i = 0; i < all.size(); i++) {
+		const rh::top_k_entry<uint32_t> &e = all[i];
+		if (i > 0) check(all[i - 1].count >= e.count);
+		uint64_t actual = ref.count(e.key) ? ref[e.key] : 0;
+		check(e.count - e.error <= actual && actual <= e.count);
+		check(sketch.estimate(e.key) == e.count);
+		sum += e.count;
+	}
+	check(sum == total);
+
+	// Every key above total / capacity is tracked and the estimates are upper bounds
+	for (auto &pair : ref) {
+		if (pair.second > total / capacity) {
+			bool found = false;
+			for (const auto &e : all) found |= e.key == pair.first;
+			check(found);
+		}
+		check(sketch.estimate(pair.first) >= pair.second);
+	}
+
+	rh::array<rh::top_k_entry<uint32_t>> top = sketch.top(8);
+	check(top.size() == 8);
+	std::set<uint32_t> top_keys;
+	for (const auto &e : top) top_keys.insert(e.key);
+	for (uint32_t key = 0; key < 8; key++) check(top_keys.count(key));
+
+	sketch.clear();
+	check(sketch.size() == 0 && sketch.total_count() == 0);
+	check(sketch.estimate(1) == 0);
+
+	// Exact while below capacity
+	rh::top_k<std::string> words(16);
+	const char *text[] = { "a", "b", "a", "c", "a", "b", "d" };
+	for (const char *w : text) words.add(w);
+	check(words.estimate("a") == 3 && words.estimate("b") == 2 && words.estimate("e") == 0);
+	rh::array<rh::top_k_entry<std::string>> word_top = words.top(2);
+	check(word_top.size() == 2 && word_top[0].key == "a" && word_top[1].key == "b");
+	check(word_top[0].error == 0);
+	return true;
+}
+
+bool check_grouped(const rh::grouped_map<uint32_t, std::string> &map, const std::map<uint32_t, std::vector<std::string>> &ref)
+{
+	check(map.size() == ref.size());
+	size_t num_values = 0;
+	for (auto &pair : ref) {
+		std::vector<std::string> values;
+		map.for_each(pair.first, [&](const std::string &v) { values.push_back(v); });
+		check(values == pair.second);
+		num_values += values.size();
+		if (map.frozen()) {
+			rh::grouped_range<std::string> range = map.find(pair.first);
+			check(std::vector<std::string>(range.begin(), range.end()) == pair.second);
+		}
+	}
+	check(map.num_values() == num_values);
+
+	// Frozen ranges are contiguous and laid out in key order
+	if (map.frozen()) {
+		const std::string *next = nullptr;
+		for (size_t i = 0; i < map.size(); i++) {
+			rh::grouped_range<std::string> range = map.values_at(i);
+			check(range.size() == ref.at(map.key_at(i)).size());
+			if (next) check(range.begin() == next);
+			next = range.end();
+		}
+	}
+	return true;
+}
+
+bool test_grouped_map()
+{
+	rh::grouped_map<uint32_t, std::string> map;
+	std::map<uint32_t, std::vector<std::string>> ref;
+	check(map.frozen() && map.find(1).empty());
+
+	srand(43);
+	for (uint32_t round = 0; round < 4; round++) {
+		for (uint32_t i = 0; i < 5000; i++) {
+			uint32_t key = (uint32_t)rand() % (i % 3 == 0 ? 10 : 500);
+			std::string value = "value number " + std::to_string(round * 10000 + i) + " past small string size";
+			if (i % 50 == 0) {
+				std::string batch[300];
+				size_t count = (size_t)rand() % 300;
+				for (size_t j = 0; j < count; j++) {
+					batch[j] = value + "/" + std::to_string(j);
+					ref[key].push_back(batch[j]);
+				}
+				map.add(key, batch, count);
+			} else {
+				map.add(key, value);
+				ref[key].push_back(value);
+			}
+		}
+		check(!map.frozen());
+		check(check_grouped(map, ref));
+		map.freeze();
+		check(map.frozen());
+		check(check_grouped(map, ref));
+	}
+
+	check(map.contains(0) && !map.contains(1000));
+	check(map.find(1000).empty());
+
+	map.clear();
+	ref.clear();
+	check(check_grouped(map, ref));
+	map.add(7, std::string("seven"));
+	ref[7].push_back("seven");
+	map.freeze();
+	check(check_grouped(map, ref));
+	return true;
+}
+
+struct counting_allocator_state {
+	size_t live_bytes = 0;
+	size_t num_allocs = 0;
+};
+
+counting_allocator_state counting_state;
+
+extern const rh::allocator counting_allocator = {
+	&counting_state,
+	[](void *user, size_t size) -> void* {
+		counting_allocator_state *state = (counting_allocator_state*)user;
+		state->live_bytes += size;
+		state->num_allocs++;
+		return malloc(size);
+	},
+	[](void *user, void *ptr, size_t size) {
+		counting_allocator_state *state = (counting_allocator_state*)user;
+		state->live_bytes -= size;
+		free(ptr);
+	},
+};
+
+struct employee {
+	uint32_t id;
+	std::string name;
+	uint32_t team;
+
+	bool operator==(const employee &rhs) const { return id == rhs.id && name == rhs.name && team == rhs.team; }
+};
+
+struct employee_id { uint32_t operator()(const employee &e) const { return e.id; } };
+struct employee_name { const std::string &operator()(const employee &e) const { return e.name; } };
+struct employee_team { uint32_t operator()(const employee &e) const { return e.team; } };
+
+template <typename Index>
+bool check_employees(const Index &index, const std::map<uint32_t, employee> &ref)
+{
+	check(index.size() == ref.size());
+	std::map<uint32_t, size_t> team_sizes;
+	for (auto &pair : ref) {
+		const employee &e = pair.second;
+		const employee *by_id = index.template find<0>(e.id);
+		check(by_id && *by_id == e);
+		check(index.template find<1>(e.name) == by_id);
+		team_sizes[e.team]++;
+	}
+	for (auto &pair : team_sizes) {
+		check(index.template count<2>(pair.first) == pair.second);
+		bool ok = true;
+		index.template find_all<2>(pair.first, [&](const employee &e) { if (e.team != pair.first) ok = false; });
+		check(ok);
+	}
+	return true;
+}
+
+template <const rh::allocator *Allocator>
+using employee_index = rh::basic_multi_index<employee, Allocator
+	, rh::hashed_unique<uint32_t, employee_id>
+	, rh::hashed_unique<std::string, employee_name>
+	, rh::hashed_non_unique<uint32_t, employee_team>>;
+
+bool test_multi_index()
+{
+	check(counting_state.live_bytes == 0);
+	{
+		employee_index<&counting_allocator> index;
+		std::map<uint32_t, employee> ref;
+		std::set<std::string> names;
+
+		srand(47);
+		for (uint32_t i = 0; i < 20000; i++) {
+			uint32_t id = (uint32_t)rand() % 3000;
+			std::string name = "employee " + std::to_string((uint32_t)rand() % 3000);
+			uint32_t team = (uint32_t)rand() % 40;
+			auto it = ref.find(id);
+			switch (rand() % 4) {
+			case 0: case 1: {
+				auto result = index.insert(employee{ id, name, team });
+				bool expected = it == ref.end() && !names.count(name);
+				check(result.inserted == expected);
+				if (expected) {
+					ref[id] = employee{ id, name, team };
+					names.insert(name);
+				} else {
+					check(result.entry->id == id || result.entry->name == name);
+				}
+			} break;
+			case 2: {
+				if (it == ref.end()) break;
+				// Renaming to a taken name is rejected and leaves the value intact
+				const employee *pos = index.find<0>(id);
+				bool expected = !names.count(name) || it->second.name == name;
+				bool ok = index.modify(pos, [&](employee &e) { e.name = name; e.team = team; });
+				check(ok == expected);
+				if (ok) {
+					names.erase(it->second.name);
+					names.insert(name);
+					it->second.name = name;
+					it->second.team = team;
+				}
+				check(*index.find<0>(id) == it->second);
+				check(index.find<0>(id) == pos);
+			} break;
+			default: {
+				size_t removed = index.remove_key<0>(id);
+				check(removed == (it != ref.end() ? 1u : 0u));
+				if (it != ref.end()) {
+					names.erase(it->second.name);
+					ref.erase(it);
+				}
+			} break;
+			}
+			if (i % 1000 == 0) check(check_employees(index, ref));
+		}
+		check(check_employees(index, ref));
+
+		// Removing a whole team through the non-unique index
+		size_t team_size = index.count<2>(3);
+		check(index.remove_key<2>(3) == team_size);
+		for (auto it = ref.begin(); it != ref.end();) {
+			if (it->second.team == 3) { names.erase(it->second.name); it = ref.erase(it); } else ++it;
+		}
+		check(check_employees(index, ref));
+
+		check(counting_state.live_bytes > 0);
+		index.clear();
+		check(index.empty() && index.find<0>(1) == nullptr);
+		index.reset();
+		check(counting_state.live_bytes == 0);
+		check(index.insert(employee{ 1, "one", 1 }).inserted);
+	}
+	check(counting_state.live_bytes == 0);
+	check(counting_state.num_allocs > 0);
+
+	rh::multi_index<employee, rh::hashed_unique<uint32_t, employee_id>> by_id;
+	check(by_id.insert(employee{ 5, "five", 0 }).inserted);
+	check(!by_id.insert(employee{ 5, "other", 0 }).inserted);
+	check(by_id.find<0>(5)->name == "five");
+	return true;
+}
+
+template <uint32_t Dims>
+bool check_spatial(const rh::spatial_hash<uint32_t, Dims> &grid, const std::vector<rh::spatial_cell> &cells, const std::vector<rh::spatial_cell> &queries)
+{
+	check(grid.size() == cells.size());
+	std::vector<std::vector<uint32_t>> batched(queries.size());
+	grid.query_neighbors_batched(queries.data(), queries.size(), [&](size_t q, const uint32_t &value) { batched[q].push_back(value); });
+
+	for (size_t q = 0; q < queries.size(); q++) {
+		const rh::spatial_cell &center = queries[q];
+		std::vector<uint32_t> ref, in_cell, found;
+		for (uint32_t i = 0; i < (uint32_t)cells.size(); i++) {
+			const rh::spatial_cell &c = cells[i];
+			int64_t dx = (int64_t)c.x - center.x, dy = (int64_t)c.y - center.y, dz = (int64_t)c.z - center.z;
+			if (dx >= -1 && dx <= 1 && dy >= -1 && dy <= 1 && dz >= -1 && dz <= 1 && (Dims == 3 || dz == 0)) ref.push_back(i);
+			if (c == center) in_cell.push_back(i);
+		}
+		grid.query_neighbors(center, [&](const uint32_t &value) { found.push_back(value); });
+		std::sort(found.begin(), found.end());
+		check(found == ref);
+		std::sort(batched[q].begin(), batched[q].end());
+		check(batched[q] == ref);
+
+		found.clear();
+		grid.query_cell(center, [&](const uint32_t &value) { found.push_back(value); });
+		std::sort(found.begin(), found.end());
+		check(found == in_cell);
+		check(grid.count(center) == in_cell.size());
+	}
+	return true;
+}
+
+template <uint32_t Dims>
+bool check_spatial_random(uint32_t seed)
+{
+	srand(seed);
+	std::vector<rh::spatial_cell> cells, queries;
+	std::vector<uint32_t> values;
+	for (uint32_t i = 0; i < 3000; i++) {
+		rh::spatial_cell cell;
+		cell.x = rand() % 40 - 20;
+		cell.y = rand() % 40 - 20;
+		cell.z = Dims == 3 ? rand() % 10 - 5 : 0;
+		cells.push_back(cell);
+		values.push_back(i);
+	}
+	for (uint32_t i = 0; i < 200; i++) {
+		rh::spatial_cell cell;
+		cell.x = rand() % 44 - 22;
+		cell.y = rand() % 44 - 22;
+		cell.z = Dims == 3 ? rand() % 12 - 6 : 0;
+		queries.push_back(cell);
+	}
+
+	rh::spatial_hash<uint32_t, Dims> grid;
+	for (uint32_t i = 0; i < (uint32_t)cells.size(); i++) grid.insert(cells[i], i);
+	check(check_spatial(grid, cells, queries));
+
+	// Rebuilding reuses the storage with new positions
+	for (rh::spatial_cell &cell : cells) cell.x += rand() % 3 - 1;
+	grid.rebuild(cells.data(), values.data(), cells.size());
+	check(check_spatial(grid, cells, queries));
+
+	grid.clear();
+	check(grid.size() == 0 && grid.count(cells[0]) == 0);
+	grid.reset();
+	grid.rebuild(cells.data(), values.data(), 10);
+	cells.resize(10);
+	check(check_spatial(grid, cells, queries));
+	return true;
+}
+
+bool test_spatial_hash()
+{
+	check(check_spatial_random<2>(53));
+	check(check_spatial_random<3>(59));
+
+	// Neighbours of the extreme cells wrap around instead of overflowing
+	rh::spatial_hash<uint32_t, 2> grid;
+	rh::spatial_cell max_cell, min_cell;
+	max_cell.x = max_cell.y = INT32_MAX;
+	min_cell.x = min_cell.y = INT32_MIN;
+	grid.insert(max_cell, 1);
+	grid.insert(min_cell, 2);
+	std::vector<uint32_t> found;
+	grid.query_neighbors(max_cell, [&](const uint32_t &value) { found.push_back(value); });
+	std::sort(found.begin(), found.end());
+	check(found == std::vector<uint32_t>({ 1, 2 }));
+	return true;
+}
+
+bool check_sparse(rh::sparse_accumulator<int64_t> &acc, const std::map<uint32_t, int64_t> &ref, const std::vector<uint32_t> &first_touch)
+{
+	check(acc.size() == ref.size());
+	for (size_t i = 0; i < acc.size(); i++) {
+		check(acc.indices()[i] == first_touch[i]);
+		check(acc.values()[i] == ref.at(first_touch[i]));
+	}
+	for (auto &pair : ref) check(acc.get(pair.first) == pair.second);
+
+	std::vector<uint32_t> indices(acc.size());
+	std::vector<int64_t> values(acc.size());
+	acc.gather_sorted(indices.data(), values.data());
+	size_t i = 0;
+	for (auto &pair : ref) {
+		check(indices[i] == pair.first && values[i] == pair.second);
+		i++;
+	}
+	return true;
+}
+
+bool test_sparse_accumulator()
+{
+	rh::sparse_accumulator<int64_t> acc;
+	srand(61);
+	std::vector<uint32_t> previous;
+	// Rows of very different sizes exercise both ways of clearing
+	for (uint32_t row = 0; row < 60; row++) {
+		std::map<uint32_t, int64_t> ref;
+		std::vector<uint32_t> first_touch;
+		size_t count = row % 10 == 0 ? 20000 : (size_t)rand() % 200;
+		uint32_t range = row % 3 == 0 ? 1000000000u : 3000u;
+		std::vector<uint32_t> indices;
+		std::vector<int64_t> values;
+		for (size_t i = 0; i < count; i++) {
+			indices.push_back(row % 2 == 0 ? (uint32_t)rand() % range : (uint32_t)(i % 700) * 4);
+			values.push_back(rand() % 100 - 50);
+		}
+
+		int64_t scale = row % 4 == 0 ? 3 : 1;
+		size_t half = count / 2;
+		for (size_t i = 0; i < half; i++) acc.add(indices[i], values[i] * scale);
+		if (scale == 1) acc.scatter_add(indices.data() + half, values.data() + half, count - half);
+		else acc.scatter_add(indices.data() + half, values.data() + half, count - half, scale);
+
+		for (size_t i = 0; i < count; i++) {
+			if (!ref.count(indices[i])) first_touch.push_back(indices[i]);
+			ref[indices[i]] += values[i] * scale;
+		}
+		check(check_sparse(acc, ref, first_touch));
+
+		// Nothing from the previous rows remains
+		for (uint32_t index : previous) {
+			if (!ref.count(index)) check(acc.get(index) == 0);
+		}
+		previous.assign(first_touch.begin(), first_touch.end());
+		acc.clear();
+		check(acc.size() == 0 && acc.raw_map().size == 0);
+		for (uint32_t index : previous) check(acc.get(index) == 0);
+	}
+
+	acc.reset();
+	acc.add(5, 7);
+	acc.add(5, -2);
+	check(acc.get(5) == 5 && acc.size() == 1);
+	return true;
+}
+
+bool test_dictionary_encoder()
+{
+	// Encode chunks with their own dictionaries, then merge them into a global one
+	const uint32_t num_chunks = 6;
+	std::vector<std::vector<std::string>> chunks(num_chunks);
+	std::vector<std::vector<uint32_t>> codes(num_chunks);
+	std::vector<rh::dictionary_encoder<std::string>> dicts(num_chunks);
+	srand(67);
+	for (uint32_t c = 0; c < num_chunks; c++) {
+		for (uint32_t i = 0; i < 3000; i++) {
+			chunks[c].push_back("value " + std::to_string((uint32_t)rand() % (500 + c * 300)));
+		}
+		codes[c].resize(chunks[c].size());
+		dicts[c].encode(chunks[c].data(), chunks[c].size(), codes[c].data());
+
+		// Codes are dense in order of first appearance
+		std::map<std::string, uint32_t> ref;
+		for (size_t i = 0; i < chunks[c].size(); i++) {
+			auto it = ref.find(chunks[c][i]);
+			uint32_t expected = it != ref.end() ? it->second : (uint32_t)ref.size();
+			if (it == ref.end()) ref[chunks[c][i]] = expected;
+			check(codes[c][i] == expected);
+		}
+		check(dicts[c].size() == ref.size());
+		for (auto &pair : ref) check(dicts[c].find(pair.first) == pair.second);
+		check(dicts[c].find("missing") == rh::dictionary_encoder<std::string>::invalid_code);
+	}
+
+	rh::dictionary_encoder<std::string> global;
+	std::set<std::string> all;
+	for (uint32_t c = 0; c < num_chunks; c++) {
+		std::vector<uint32_t> remap(dicts[c].size());
+		global.merge(dicts[c], remap.data());
+		for (uint32_t code = 0; code < (uint32_t)dicts[c].size(); code++) {
+			check(global.decode(remap[code]) == dicts[c].decode(code));
+		}
+		rh::dictionary_encoder<std::string>::remap_codes(codes[c].data(), codes[c].size(), remap.data());
+		all.insert(chunks[c].begin(), chunks[c].end());
+	}
+	check(global.size() == all.size());
+
+	for (uint32_t c = 0; c < num_chunks; c++) {
+		std::vector<std::string> decoded(codes[c].size());
+		global.decode(codes[c].data(), codes[c].size(), decoded.data());
+		check(decoded == chunks[c]);
+		for (size_t i = 0; i < chunks[c].size(); i++) check(global.encode(chunks[c][i]) == codes[c][i]);
+	}
+
+	// Merging a dictionary into itself keeps every code
+	std::vector<uint32_t> identity(global.size());
+	size_t size = global.size();
+	global.merge(global, identity.data());
+	check(global.size() == size);
+	for (uint32_t i = 0; i < (uint32_t)size; i++) check(identity[i] == i);
+
+	global.clear();
+	check(global.empty() && global.find(chunks[0][0]) == rh::dictionary_encoder<std::string>::invalid_code);
+	check(global.encode(chunks[0][0]) == 0);
+	return true;
+}
+
+bool test_blob_cache()
+{
+	std::string a(100, 'a'), b(100, 'b'), c(100, 'c'), d(100, 'd');
+	{
+		rh::blob_cache cache(250);
+		const rh::blob *ba = cache.insert(a.data(), a.size());
+		check(ba->size == 100 && !memcmp(ba->data(), a.data(), 100) && ba->refs == 1);
+		check(cache.insert(a.data(), a.size()) == ba && ba->refs == 2);
+		check(cache.num_hits() == 1 && cache.num_misses() == 1);
+		check(cache.size() == 1 && cache.total_bytes() == 100);
+
+		// Unreferenced buffers stay cached until the limit is exceeded
+		cache.release(ba);
+		cache.release(ba);
+		check(ba->refs == 0 && cache.find(a.data(), a.size()) == ba);
+		const rh::blob *bb = cache.insert(b.data(), b.size());
+		const rh::blob *bc = cache.insert(c.data(), c.size());
+		check(cache.find(a.data(), a.size()) == nullptr);
+		check(cache.size() == 2 && cache.total_bytes() == 200);
+
+		// Referenced buffers are never evicted, released ones go in release order
+		const rh::blob *bd = cache.insert(d.data(), d.size());
+		check(cache.total_bytes() == 300);
+		cache.release(bc);
+		check(cache.find(c.data(), c.size()) == nullptr);
+		cache.release(bb);
+		check(cache.find(b.data(), b.size()) == bb);
+		cache.release(bd);
+		check(cache.find(b.data(), b.size()) == bb && cache.find(d.data(), d.size()) == bd);
+
+		// acquire() takes a cached buffer off the LRU list but never copies
+		check(cache.acquire(b.data(), b.size()) == bb && bb->refs == 1);
+		check(cache.acquire(a.data(), a.size()) == nullptr);
+		cache.set_max_bytes(0);
+		check(cache.size() == 1 && cache.find(b.data(), b.size()) == bb);
+		cache.retain(bb);
+		cache.release(bb);
+		check(cache.size() == 1);
+		cache.release(bb);
+		check(cache.size() == 0 && cache.total_bytes() == 0);
+	}
+
+	// Random workload against a reference refcount model
+	rh::blob_cache cache;
+	std::vector<std::string> buffers;
+	srand(71);
+	for (uint32_t i = 0; i < 400; i++) buffers.push_back(std::string((size_t)rand() % 300, (char)('a' + i % 26)) + std::to_string(i));
+	std::vector<const rh::blob*> held;
+	std::map<std::string, uint32_t> refs;
+	for (uint32_t round = 0; round < 3000; round++) {
+		if (held.empty() || rand() % 3 != 0) {
+			const void *data[8];
+			size_t sizes[8];
+			const rh::blob *result[8];
+			size_t count = 1 + (size_t)rand() % 8;
+			for (size_t i = 0; i < count; i++) {
+				const std::string &buf = buffers[(size_t)rand() % buffers.size()];
+				data[i] = buf.data();
+				sizes[i] = buf.size();
+			}
+			cache.insert_batch(data, sizes, count, result);
+			for (size_t i = 0; i < count; i++) {
+				check(result[i]->size == sizes[i] && !memcmp(result[i]->data(), data[i], sizes[i]));
+				refs[std::string((const char*)data[i], sizes[i])]++;
+				held.push_back(result[i]);
+			}
+			// A batch may reference the same buffer several times
+			for (size_t i = 0; i < count; i++) {
+				check(result[i]->refs == refs[std::string((const char*)data[i], sizes[i])]);
+			}
+		} else {
+			size_t pos = (size_t)rand() % held.size();
+			const rh::blob *blob = held[pos];
+			held[pos] = held.back();
+			held.pop_back();
+			std::string key((const char*)blob->data(), blob->size);
+			if (--refs[key] == 0) refs.erase(key);
+			cache.release(blob);
+		}
+		if (round % 500 == 0) cache.trim();
+	}
+	cache.trim();
+	check(cache.size() == refs.size());
+	size_t bytes = 0;
+	for (auto &pair : refs) {
+		const rh::blob *blob = cache.find(pair.first.data(), pair.first.size());
+		check(blob && blob->refs == pair.second);
+		bytes += pair.first.size();
+	}
+	check(cache.total_bytes() == bytes);
+	for (const rh::blob *blob : held) cache.release(blob);
+	check(cache.size() == refs.size());
+	cache.trim();
+	check(cache.size() == 0 && cache.total_bytes() == 0);
+	return true;
+}
+
+struct memo_fib {
+	rh::memo_cache<uint64_t(uint32_t)> cache;
+	size_t map_capacity;
+	uint32_t calls = 0;
+	bool ok = true;
+
+	memo_fib(size_t capacity) : cache(capacity), map_capacity(cache.map().capacity()) { }
+
+	uint64_t fib(uint32_t n) {
+		return cache.get_or_compute(n, [&](uint32_t n) -> uint64_t {
+			calls++;
+			if (n < 2) return n;
+			uint64_t result = fib(n - 1);
+			result += fib(n - 2);
+			if (cache.size() > cache.capacity() || cache.map().capacity() != map_capacity) ok = false;
+			return result;
+		});
+	}
+};
+
+bool test_memo_cache()
+{
+	// Memoized recursion re-enters the cache while computing
+	uint64_t ref[91] = { 0, 1 };
+	for (uint32_t i = 2; i <= 90; i++) ref[i] = ref[i - 1] + ref[i - 2];
+	{
+		// A tiny cache evicts while the recursion is in flight
+		memo_fib small(4);
+		check(small.fib(20) == ref[20]);
+		check(small.ok && small.cache.size() <= 4);
+		check(small.cache.map().capacity() == small.map_capacity);
+		for (uint32_t i = 0; i <= 20; i++) check(small.fib(i) == ref[i]);
+		check(small.ok);
+
+		memo_fib large(200);
+		check(large.fib(90) == ref[90]);
+		check(large.calls == 91);
+		check(large.fib(50) == ref[50] && large.calls == 91);
+	}
+
+	rh::memo_cache<std::string(const std::string&, int)> cache(3);
+	uint32_t calls = 0;
+	auto repeat = [&](const std::string &s, int n) {
+		calls++;
+		std::string result;
+		for (int i = 0; i < n; i++) result += s;
+		return result;
+	};
+	check(cache.get_or_compute("ab", 2, repeat) == "abab" && calls == 1);
+	check(cache.get_or_compute("ab", 2, repeat) == "abab" && calls == 1);
+	check(cache.num_hits() == 1 && cache.num_misses() == 1);
+	check(cache.get_or_compute("x", 3, repeat) == "xxx");
+	check(cache.get_or_compute("y", 1, repeat) == "y");
+	check(cache.size() == 3);
+
+	// CLOCK spares the entry that was used since the last sweep
+	check(*cache.find("ab", 2) == "abab");
+	check(cache.get_or_compute("z", 2, repeat) == "zz");
+	check(cache.size() == 3);
+	check(cache.find("ab", 2) != nullptr);
+	check(cache.find("x", 3) == nullptr);
+	check(cache.find("y", 1) != nullptr && cache.find("z", 2) != nullptr);
+
+	check(cache.remove("ab", 2) && !cache.remove("ab", 2));
+	check(cache.size() == 2);
+	cache.clear();
+	check(cache.size() == 0 && cache.find("y", 1) == nullptr);
+
+	// New entries survive a sweep, stale ones are evicted instead
+	rh::memo_cache<int(int)> ints(4);
+	auto square = [](int x) { return x * x; };
+	for (int i = 1; i <= 4; i++) ints.get_or_compute(i, square);
+	for (int i = 0; i < 10; i++) {
+		check(ints.get_or_compute(100, square) == 10000);
+		check(ints.get_or_compute(101, square) == 10201);
+	}
+	check(ints.num_hits() == 18 && ints.num_misses() == 6);
+	check(ints.find(1) == nullptr && ints.find(2) == nullptr);
+	check(ints.find(3) != nullptr && ints.find(4) != nullptr);
+	return true;
+}
+
+bool test_rate_limiter()
+{
+	// Burst of 5 tokens refilling one every 10 ticks
+	rh::rate_limiter<uint32_t> limiter(10, 5);
+	check(limiter.tokens(1, 0) == 5);
+	for (uint32_t i = 0; i < 5; i++) check(limiter.allow(1, 0));
+	check(!limiter.allow(1, 0) && limiter.tokens(1, 0) == 0);
+	check(!limiter.allow(1, 9));
+	check(limiter.allow(1, 10) && !limiter.allow(1, 10));
+	check(limiter.tokens(1, 35) == 2);
+
+	// Idle buckets refill only up to the burst
+	check(limiter.tokens(1, 1000) == 5);
+	for (uint32_t i = 0; i < 5; i++) check(limiter.allow(1, 1000));
+	check(!limiter.allow(1, 1000));
+
+	check(limiter.allow(2, 1000, 5) && !limiter.allow(2, 1000, 1));
+	check(!limiter.allow(3, 1000, 6) && limiter.tokens(3, 1000) == 5);
+	check(limiter.allow(3, 1000, 3) && limiter.tokens(3, 1000) == 2);
+
+	// Full buckets are dropped, which doesn't change the results
+	check(limiter.evict_idle(5000) == 3 && limiter.size() == 0);
+	check(limiter.tokens(1, 5000) == 5);
+
+	// Batches against a reference GCRA, crossing the internal batch size
+	rh::rate_limiter<uint32_t> batched(10, 5);
+	std::map<uint32_t, uint64_t> ref;
+	std::vector<uint32_t> keys;
+	uint64_t now = 0;
+	srand(7);
+	for (uint32_t iter = 0; iter < 200; iter++) {
+		now += (uint64_t)(rand() % 4);
+		keys.resize((size_t)(rand() % 150));
+		for (uint32_t &key : keys) key = (uint32_t)(rand() % 40);
+		bool result[150];
+		batched.allow(keys.data(), keys.size(), now, result);
+		for (size_t i = 0; i < keys.size(); i++) {
+			uint64_t &tat = ref[keys[i]];
+			uint64_t next = (tat > now ? tat : now) + 10;
+			bool allowed = next - now <= 50;
+			if (allowed) tat = next;
+			check(result[i] == allowed);
+		}
+		if (iter % 50 == 49) batched.evict_idle(now);
+	}
+	for (auto &pair : ref) {
+		uint64_t tat = pair.second > now ? pair.second : now;
+		check(batched.tokens(pair.first, now) == (uint32_t)((now + 50 - tat) / 10));
+	}
+	return true;
+}
+
+void runtest_imp(const char *name, bool (*func)())
+{
+	if (!func()) {
+		fprintf(stderr, "Failed: %s\n", name);
+		exit(1);
+	}
+	printf("%s: ok\n", name);
+}
+
+#define runtest(name) runtest_imp(#name, &name)
+
+int main(int argc, char **argv)
+{
+	runtest(test_save_load_array);
+	runtest(test_save_load_hash_map);
+	runtest(test_save_load_hash_set);
+	runtest(test_load_truncated);
+	runtest(test_load_corrupted);
+	runtest(test_hash_buffer_unaligned);
+	runtest(test_journal_reopen);
+	runtest(test_journal_torn_tail);
+	runtest(test_journal_write_failure);
+	runtest(test_mapped_allocator);
+	runtest(test_allocation_failure);
+	runtest(test_compress_roundtrip);
+	runtest(test_compressed_hash_map);
+	runtest(test_compressed_hash_set);
+	runtest(test_diff_apply);
+	runtest(test_perfect_map);
+	runtest(test_static_map);
+	runtest(test_string_interner);
+	runtest(test_hash_join);
+	runtest(test_group_by);
+	runtest(test_lru_cache);
+	runtest(test_expiring_map);
+	runtest(test_bloom);
+	runtest(test_dedup_stream);
+	runtest(test_set_ops);
+	runtest(test_top_k);
+	runtest(test_grouped_map);
+	runtest(test_multi_index);
+	runtest(test_spatial_hash);
+	runtest(test_sparse_accumulator);
+	runtest(test_dictionary_encoder);
+	runtest(test_blob_cache);
+	runtest(test_memo_cache);
+	runtest(test_rate_limiter);
+
+	return 0;
+}
@@ -1,4 +1,5 @@
 #include "../extra/rh_hash.h"
+#include "../extra/rh_grouped.h"
 
 #include <vector>
 #include <unordered_map>
@@ -104,6 +105,25 @@ bool bench_map_of_arrays_rh(size_t num)
 	return true;
 }
 
+bool bench_map_of_arrays_grouped(size_t num)
+{
+	rh::grouped_map<int, int> map;
+	for (size_t i = 0; i < num; i++) {
+		int key = (int)(i * 2654435761u);
+		map.add(key & 0xffff, key);
+	}
+
+	map.freeze();
+	for (size_t i = 0; i < map.size(); i++) {
+		int key = map.key_at(i);
+		for (int val : map.values_at(i)) {
+			if ((val & 0xffff) != (key & 0xffff)) return false;
+		}
+	}
+
+	return true;
+}
+
 bool bench_map_of_arrays_std(size_t num)
 {
 	std::unordered_map<int, std::vector<int>> map;
@@ -160,6 +180,7 @@ int main(int argc, char **argv)
 	{
 		size_t num = 1000000;
 		timeit(bench_map_of_arrays_rh, num);
+		timeit(bench_map_of_arrays_grouped, num);
 		timeit(bench_map_of_arrays_std, num);
 	}
 